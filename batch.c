@@ -0,0 +1,308 @@
+#define _POSIX_C_SOURCE 200112L
+#include "batch.h"
+#include "ds.h"
+#include "render.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Inputs are read and rendered in pieces of this many bytes, which grow
+// up to PT_BATCH_MAX_CHUNK to find a place to cut
+#define PT_BATCH_CHUNK (1 << 20)
+#define PT_BATCH_MAX_CHUNK (1 << 23)
+#define PT_BATCH_COPY_SIZE (1 << 16)
+
+typedef struct {
+        FILE *out;
+        pid_t pid;
+        int status;
+} PTBatchJob;
+
+/**
+ * Renders `len` bytes of `buf` as one chunk. The byte after the chunk is
+ * temporarily replaced by a terminator so the chunk can be used in place.
+ */
+static int pt_batch_render_chunk(char *buf, size_t len, bool formatted,
+                                 FILE *out) {
+        char saved = buf[len];
+        buf[len] = '\0';
+        pt_str chunk = pt_str_view(buf, len);
+        int rc = pt_render_to_stream(&chunk, formatted, out);
+        buf[len] = saved;
+        return rc;
+}
+
+/** Finds two `c` in a row in the `len` bytes at `s`, or returns NULL */
+static const char *pt_batch_find_pair(const char *s, size_t len, char c) {
+        for (size_t i = 0; i + 1 < len; i++) {
+                if (s[i] == c && s[i + 1] == c)
+                        return s + i;
+        }
+        return NULL;
+}
+
+/** Whether a code fence starts at `i` */
+static bool pt_batch_is_fence(const char *buf, size_t len, size_t i) {
+        return (i == 0 || buf[i - 1] == '\n') && len - i >= 3 &&
+               memcmp(buf + i, "```", 3) == 0;
+}
+
+/**
+ * Where a chunk taken from the `len` bytes at `buf` can end without
+ * changing how the document renders: after the last blank line that is
+ * outside code fences, bold text and wikilinks. The formatter looks ahead
+ * for the end of those, so the scan stops at one that does not end in
+ * `buf`. Returns 0 if there is no such place.
+ */
+static size_t pt_batch_cut(const char *buf, size_t len) {
+        size_t cut = 0;
+        bool in_fence = false;
+        size_t i = 0;
+        while (i < len) {
+                const char *end = NULL;
+                size_t skip = 0;
+                if (buf[i] == '#' && (i == 0 || buf[i - 1] == '\n')) {
+                        // A heading takes up the rest of its line
+                        size_t hashes = i;
+                        while (hashes < len && buf[hashes] == '#')
+                                hashes++;
+                        if (hashes == len)
+                                break;
+                        if (buf[hashes] == ' ') {
+                                end = memchr(buf + hashes, '\n', len - hashes);
+                                if (!end)
+                                        break;
+                                skip = 1;
+                        }
+                } else if (i + 1 < len && buf[i + 1] == buf[i] &&
+                           (buf[i] == '*' || buf[i] == '[')) {
+                        char close = buf[i] == '*' ? '*' : ']';
+                        end = pt_batch_find_pair(buf + i + 2, len - i - 2,
+                                                 close);
+                        if (!end)
+                                break;
+                        skip = 2;
+                }
+
+                if (end) {
+                        // Fences inside the span still open or close one
+                        size_t next = (size_t)(end - buf) + skip;
+                        for (size_t k = i + 1; k < next; k++) {
+                                if (pt_batch_is_fence(buf, len, k))
+                                        in_fence = !in_fence;
+                        }
+                        i = next;
+                        continue;
+                }
+                if (pt_batch_is_fence(buf, len, i))
+                        in_fence = !in_fence;
+                else if (buf[i] == '\n' && i > 0 && buf[i - 1] == '\n' &&
+                         !in_fence)
+                        cut = i + 1;
+                i++;
+        }
+        return cut;
+}
+
+/**
+ * Where a chunk with no place for pt_batch_cut is cut anyway: after the
+ * last blank line, or else the last newline, or else before the last
+ * character. Markup left open there renders as it does within the chunk.
+ */
+static size_t pt_batch_force_cut(const char *buf, size_t len) {
+        size_t line = 0;
+        for (size_t i = len; i > 0; i--) {
+                if (buf[i - 1] != '\n')
+                        continue;
+                if (i > 1 && buf[i - 2] == '\n')
+                        return i;
+                if (line == 0)
+                        line = i;
+        }
+        if (line > 0)
+                return line;
+
+        // Only the last character may be cut short
+        size_t cut = len - 1;
+        while (cut > 0 && ((unsigned char)buf[cut] & 0xC0) == 0x80)
+                cut--;
+        return cut > 0 ? cut : len;
+}
+
+/**
+ * Streams one file through the formatter and the line wrapper, in chunks
+ * cut where pt_batch_cut allows. A chunk with no such place grows until it
+ * has one, up to PT_BATCH_MAX_CHUNK, where it is cut by pt_batch_force_cut
+ * instead, so that one unclosed `**` does not pull in the rest of the file.
+ * `ends_line` tells whether the file ended with a newline.
+ */
+static int pt_batch_render_file(const char *path, bool formatted, FILE *out,
+                                bool *ends_line) {
+        *ends_line = true;
+        FILE *in = fopen(path, "r");
+        if (!in) {
+                perror(path);
+                return -1;
+        }
+
+        size_t cap = PT_BATCH_CHUNK;
+        char *buf = malloc(cap + 1);
+        if (!buf) {
+                fclose(in);
+                return -1;
+        }
+
+        int rc = 0;
+        size_t filled = 0;
+        bool eof = false;
+        while (rc == 0 && !eof) {
+                size_t nread = fread(buf + filled, 1, cap - filled, in);
+                filled += nread;
+                if (filled < cap) {
+                        if (ferror(in)) {
+                                perror(path);
+                                rc = -1;
+                                break;
+                        }
+                        eof = true;
+                }
+
+                size_t cut = eof ? filled : pt_batch_cut(buf, filled);
+                if (cut == 0 && !eof && cap >= PT_BATCH_MAX_CHUNK)
+                        cut = pt_batch_force_cut(buf, filled);
+                if (cut == 0 && !eof) {
+                        char *bigger = realloc(buf, cap * 2 + 1);
+                        if (!bigger) {
+                                perror(path);
+                                rc = -1;
+                                break;
+                        }
+                        buf = bigger;
+                        cap *= 2;
+                        continue;
+                }
+
+                if (cut > 0) {
+                        *ends_line = buf[cut - 1] == '\n';
+                        rc = pt_batch_render_chunk(buf, cut, formatted, out);
+                }
+                memmove(buf, buf + cut, filled - cut);
+                filled -= cut;
+        }
+
+        free(buf);
+        fclose(in);
+        return rc;
+}
+
+/**
+ * Renders file `index` of `paths`. When there are several, each comes
+ * under a header with its name, as head(1) does, and ends with a newline.
+ */
+static int pt_batch_render_entry(char *const paths[], int count, int index,
+                                 bool formatted, FILE *out) {
+        if (count > 1 && fprintf(out, "%s==> %s <==\n", index > 0 ? "\n" : "",
+                                 paths[index]) < 0)
+                return -1;
+        bool ends_line;
+        int rc = pt_batch_render_file(paths[index], formatted, out, &ends_line);
+        if (rc == 0 && count > 1 && !ends_line && fputc('\n', out) == EOF)
+                rc = -1;
+        return rc;
+}
+
+static void pt_batch_start(PTBatchJob *job, char *const paths[], int count,
+                           int index, bool formatted) {
+        job->out = tmpfile();
+        if (!job->out) {
+                perror("tmpfile");
+                job->pid = -1;
+                job->status = 1;
+                return;
+        }
+
+        // Anything still buffered would otherwise be written by the child too
+        fflush(stdout);
+        job->pid = fork();
+        if (job->pid == 0) {
+                int rc = pt_batch_render_entry(paths, count, index, formatted,
+                                               job->out);
+                if (fflush(job->out) == EOF)
+                        rc = -1;
+                _exit(rc == 0 ? 0 : 1);
+        }
+
+        if (job->pid < 0) {
+                // Could not fork: do the work here instead
+                job->status = pt_batch_render_entry(paths, count, index,
+                                                    formatted, job->out)
+                                      ? 1
+                                      : 0;
+        }
+}
+
+static int pt_batch_finish(PTBatchJob *job) {
+        if (job->pid > 0) {
+                int wstatus;
+                if (waitpid(job->pid, &wstatus, 0) < 0 ||
+                    !WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0)
+                        job->status = 1;
+        }
+        if (!job->out)
+                return 1;
+
+        rewind(job->out);
+        char buf[PT_BATCH_COPY_SIZE];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), job->out)) > 0) {
+                if (fwrite(buf, 1, n, stdout) != n) {
+                        job->status = 1;
+                        break;
+                }
+        }
+        fclose(job->out);
+        job->out = NULL;
+        return job->status;
+}
+
+int pt_batch_render(char *const paths[], int count, bool formatted) {
+        long workers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (workers < 1)
+                workers = 1;
+
+        if (count == 1 || workers == 1) {
+                int failed = 0;
+                for (int i = 0; i < count; i++) {
+                        if (pt_batch_render_entry(paths, count, i, formatted,
+                                                  stdout) != 0)
+                                failed = 1;
+                }
+                return fflush(stdout) == EOF ? 1 : failed;
+        }
+
+        PTBatchJob *jobs = calloc((size_t)count, sizeof(PTBatchJob));
+        if (!jobs) {
+                perror("calloc");
+                return 1;
+        }
+
+        // Keep up to `workers` files in flight and emit them in order
+        int failed = 0;
+        int next = 0;
+        for (int i = 0; i < count; i++) {
+                while (next < count && next - i < workers) {
+                        pt_batch_start(&jobs[next], paths, count, next,
+                                       formatted);
+                        next++;
+                }
+                if (pt_batch_finish(&jobs[i]) != 0)
+                        failed = 1;
+        }
+
+        free(jobs);
+        return fflush(stdout) == EOF ? 1 : failed;
+}
@@ -0,0 +1,13 @@
+#ifndef PT_BATCH_H
+#define PT_BATCH_H
+#include <stdbool.h>
+
+/**
+ * Renders every file in `paths` to stdout without touching the terminal.
+ * Files are processed concurrently, one worker process per core, and their
+ * output is written in the order they were given.
+ * Returns 0 when every file was rendered, 1 otherwise.
+ */
+int pt_batch_render(char *const paths[], int count, bool formatted);
+
+#endif
@@ -0,0 +1,330 @@
+#define _POSIX_C_SOURCE 200112L
+#include "ds.h"
+#include "editor.h"
+#include "render.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Benchmarks for the buffer, the formatter and the render pipeline.
+ *
+ * Usage: porta_bench <max-size> <out.json>
+ *
+ * Every benchmark runs on generated corpora from 1 KiB up to <max-size>
+ * (which takes K, M and G suffixes), growing 16x per step. Screen output
+ * goes to /dev/null and the results are written to <out.json>.
+ */
+
+#define PT_BENCH_MIN_SIZE 1024
+#define PT_BENCH_SIZE_STEP 16
+// Repeat each measurement until it has run at least this long
+#define PT_BENCH_MIN_SECONDS 0.2
+// A benchmark whose single run takes longer skips the larger sizes
+#define PT_BENCH_SKIP_SECONDS 3.0
+#define PT_BENCH_PIECE 64
+
+typedef enum {
+        PT_CORPUS_PROSE,
+        PT_CORPUS_HEADINGS,
+        PT_CORPUS_UNMATCHED,
+        PT_CORPUS_NON_ASCII,
+        PT_CORPUS_COUNT
+} PTCorpusKind;
+
+static const char *const corpus_names[PT_CORPUS_COUNT] = {
+        "prose", "heading-heavy", "unmatched-markup", "non-ascii"};
+
+typedef void (*PTBenchFn)(const pt_str *corpus);
+
+typedef struct {
+        const char *name;
+        PTBenchFn run;
+        bool is_skipped[PT_CORPUS_COUNT];
+} PTBench;
+
+static unsigned long pt_bench_rng = 88172645463325252UL;
+
+static unsigned long pt_bench_rand(void) {
+        // xorshift, so corpora are identical between runs
+        pt_bench_rng ^= pt_bench_rng << 13;
+        pt_bench_rng ^= pt_bench_rng >> 7;
+        pt_bench_rng ^= pt_bench_rng << 17;
+        return pt_bench_rng;
+}
+
+static double pt_bench_now(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* ---- corpora ---- */
+
+static const char *const ascii_words[] = {
+        "the",   "quiet", "river", "carried", "letters", "across", "a",
+        "long",  "and",   "patient", "valley", "where",  "nobody", "wrote",
+        "about", "it",    "before", "morning", "light",  "came"};
+
+static const char *const non_ascii_words[] = {
+        "café", "naïve", "Größe", "日本語", "тетрадь", "χαρά", "señor",
+        "😀",   "über",  "fjörð"};
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+static void pt_bench_sentence(pt_str *out, PTCorpusKind kind) {
+        size_t words = 5 + pt_bench_rand() % 15;
+        for (size_t w = 0; w < words; w++) {
+                if (w > 0)
+                        pt_str_append_char(out, ' ');
+                if (kind == PT_CORPUS_NON_ASCII && pt_bench_rand() % 2) {
+                        pt_str_append(out, non_ascii_words
+                                              [pt_bench_rand() %
+                                               ARRAY_SIZE(non_ascii_words)]);
+                } else {
+                        pt_str_append(out, ascii_words[pt_bench_rand() %
+                                                       ARRAY_SIZE(ascii_words)]);
+                }
+                if (kind == PT_CORPUS_UNMATCHED && pt_bench_rand() % 8 == 0)
+                        pt_str_append(out, pt_bench_rand() % 2 ? "**" : "[[");
+        }
+        pt_str_append(out, ". ");
+}
+
+/** Generates exactly `size` bytes of text, cut at the end if needed */
+static pt_str *pt_bench_corpus(PTCorpusKind kind, size_t size) {
+        pt_str *out = pt_str_new();
+        while (out->len < size) {
+                if (kind == PT_CORPUS_HEADINGS ||
+                    (kind != PT_CORPUS_UNMATCHED && pt_bench_rand() % 8 == 0)) {
+                        pt_str_append(out, pt_bench_rand() % 2 ? "# " : "## ");
+                        pt_bench_sentence(out, kind);
+                        pt_str_append_char(out, '\n');
+                }
+
+                size_t sentences = 1 + pt_bench_rand() % 6;
+                for (size_t i = 0; i < sentences; i++)
+                        pt_bench_sentence(out, kind);
+                if (kind != PT_CORPUS_UNMATCHED && pt_bench_rand() % 4 == 0) {
+                        pt_str_append(out, "Some **bold** and a [[note|link]]. ");
+                }
+                pt_str_append(out, "\n\n");
+        }
+        out->len = size;
+        out->data[size] = '\0';
+        return out;
+}
+
+/* ---- benchmarks ---- */
+
+static void pt_free_str(pt_str *s) {
+        pt_str_free(s);
+        free(s);
+}
+
+static void bench_str_append_char(const pt_str *corpus) {
+        pt_str *s = pt_str_new();
+        for (size_t i = 0; i < corpus->len; i++)
+                pt_str_append_char(s, corpus->data[i]);
+        pt_free_str(s);
+}
+
+static void bench_str_append(const pt_str *corpus) {
+        char piece[PT_BENCH_PIECE + 1];
+        pt_str *s = pt_str_new();
+        for (size_t i = 0; i < corpus->len; i += PT_BENCH_PIECE) {
+                size_t n = corpus->len - i < PT_BENCH_PIECE ? corpus->len - i
+                                                             : PT_BENCH_PIECE;
+                memcpy(piece, corpus->data + i, n);
+                piece[n] = '\0';
+                pt_str_append(s, piece);
+        }
+        pt_free_str(s);
+}
+
+static void bench_str_from(const pt_str *corpus) {
+        pt_free_str(pt_str_from(corpus->data));
+}
+
+static void bench_str_delete_char(const pt_str *corpus) {
+        pt_str *s = pt_str_from(corpus->data);
+        while (s->len > 0)
+                pt_str_delete_char(s);
+        pt_free_str(s);
+}
+
+static void bench_format(const pt_str *corpus) {
+        pt_free_str(pt_format_string(corpus));
+}
+
+static void bench_split_lines(const pt_str *corpus) {
+        pt_str *lines = NULL;
+        int line_count = pt_split_lines(corpus, &lines);
+        for (int i = 0; i < line_count; i++)
+                pt_str_free(&lines[i]);
+        free(lines);
+}
+
+static PTState *bench_state;
+
+/** One key typed into a document holding the corpus, up to the flushed frame */
+static void bench_keystroke(const pt_str *corpus) {
+        (void)corpus;
+        pt_process_key(bench_state, 'a');
+        pt_render_state(bench_state);
+        pt_process_key(bench_state, '\x7f');
+        pt_render_state(bench_state);
+}
+
+static PTState *pt_bench_state(const pt_str *corpus) {
+        PTState *state = pt_new_glob_state(pt_str_from("bench.md"));
+        state->rows = 50;
+        state->cols = 120;
+        pt_str_append(state->content, corpus->data);
+        pt_stats_rebuild(&state->buffers[0].stats, state->content->data,
+                         state->content->len);
+        return state;
+}
+
+static void pt_bench_free_state(PTState *state) {
+        PTBuffer *buffer = &state->buffers[0];
+        pt_drop_layout(buffer);
+        pt_spell_free(&buffer->spell);
+        pt_history_free(&buffer->history);
+        pt_cold_free(&buffer->cold);
+        pt_free_str(buffer->content);
+        pt_free_str(buffer->filename);
+        pt_search_free(&state->search);
+        free(state->buffers);
+        free(state);
+}
+
+/* ---- driver ---- */
+
+static size_t pt_bench_parse_size(const char *text) {
+        char *end;
+        unsigned long long value = strtoull(text, &end, 10);
+        switch (*end) {
+        case 'k':
+        case 'K':
+                value <<= 10;
+                break;
+        case 'm':
+        case 'M':
+                value <<= 20;
+                break;
+        case 'g':
+        case 'G':
+                value <<= 30;
+                break;
+        default:
+                break;
+        }
+        return (size_t)value;
+}
+
+static bool pt_bench_first_result = true;
+
+static void pt_bench_report(FILE *json, const char *name, PTCorpusKind kind,
+                            size_t size, unsigned long iterations,
+                            double seconds, bool skipped) {
+        fprintf(json, "%s\n    {\"name\": \"%s\", \"corpus\": \"%s\", "
+                      "\"bytes\": %zu, ",
+                pt_bench_first_result ? "" : ",", name, corpus_names[kind],
+                size);
+        if (skipped) {
+                fprintf(json, "\"skipped\": true}");
+        } else {
+                double per_op = seconds / (double)iterations;
+                fprintf(json,
+                        "\"iterations\": %lu, \"ns_per_op\": %.0f, "
+                        "\"mb_per_s\": %.2f}",
+                        iterations, per_op * 1e9,
+                        (double)size / per_op / (1024.0 * 1024.0));
+        }
+        pt_bench_first_result = false;
+
+        if (skipped)
+                fprintf(stderr, "%-20s %-17s %11zu  skipped\n", name,
+                        corpus_names[kind], size);
+        else
+                fprintf(stderr, "%-20s %-17s %11zu  %12.0f ns/op\n", name,
+                        corpus_names[kind], size,
+                        seconds / (double)iterations * 1e9);
+}
+
+static void pt_bench_run(FILE *json, PTBench *bench, PTCorpusKind kind,
+                         const pt_str *corpus) {
+        if (bench->is_skipped[kind]) {
+                pt_bench_report(json, bench->name, kind, corpus->len, 0, 0,
+                                true);
+                return;
+        }
+
+        unsigned long iterations = 0;
+        double start = pt_bench_now();
+        double elapsed;
+        do {
+                bench->run(corpus);
+                iterations++;
+                elapsed = pt_bench_now() - start;
+        } while (elapsed < PT_BENCH_MIN_SECONDS);
+
+        if (elapsed / (double)iterations > PT_BENCH_SKIP_SECONDS)
+                bench->is_skipped[kind] = true;
+        pt_bench_report(json, bench->name, kind, corpus->len, iterations,
+                        elapsed, false);
+}
+
+int main(int argc, char *argv[]) {
+        if (argc != 3) {
+                fprintf(stderr, "Usage: %s <max-size> <out.json>\n", argv[0]);
+                return 1;
+        }
+        size_t max_size = pt_bench_parse_size(argv[1]);
+        FILE *json = fopen(argv[2], "w");
+        if (!json) {
+                perror(argv[2]);
+                return 1;
+        }
+
+        // Frames are rendered as if on kitty, to nowhere
+        setenv("TERM", "xterm-kitty", 1);
+        if (!freopen("/dev/null", "w", stdout)) {
+                perror("/dev/null");
+                return 1;
+        }
+
+        PTBench benches[] = {
+                {"pt_str_append_char", bench_str_append_char, {false}},
+                {"pt_str_append", bench_str_append, {false}},
+                {"pt_str_from", bench_str_from, {false}},
+                {"pt_str_delete_char", bench_str_delete_char, {false}},
+                {"pt_format_string", bench_format, {false}},
+                {"pt_split_lines", bench_split_lines, {false}},
+                {"keystroke_to_frame", bench_keystroke, {false}},
+        };
+
+        fprintf(json, "{\n  \"version\": 1,\n  \"timestamp\": %ld,\n"
+                      "  \"max_bytes\": %zu,\n  \"results\": [",
+                (long)time(NULL), max_size);
+
+        for (size_t size = PT_BENCH_MIN_SIZE; size <= max_size;
+             size *= PT_BENCH_SIZE_STEP) {
+                for (int kind = 0; kind < PT_CORPUS_COUNT; kind++) {
+                        pt_str *corpus =
+                                pt_bench_corpus((PTCorpusKind)kind, size);
+                        bench_state = pt_bench_state(corpus);
+                        for (size_t b = 0; b < ARRAY_SIZE(benches); b++)
+                                pt_bench_run(json, &benches[b],
+                                             (PTCorpusKind)kind, corpus);
+                        pt_bench_free_state(bench_state);
+                        pt_free_str(corpus);
+                }
+        }
+
+        fprintf(json, "\n  ]\n}\n");
+        return fclose(json) == 0 ? 0 : 1;
+}
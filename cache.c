@@ -0,0 +1,494 @@
+// For st_mtim and st_ctim
+#define _POSIX_C_SOURCE 200809L
+#include "cache.h"
+#include "cold.h"
+#include "ds.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Sidecar file: a header, a table with one entry per cold block, the lines
+ * of the layout each ended by a NUL, then the compressed blocks. Numbers
+ * are in the byte order of the machine that wrote it. The checksum covers
+ * everything before the blocks; each block is checked against the hash of
+ * its text when it is first decompressed.
+ */
+
+#define PT_CACHE_MAGIC "porta-cache 2"
+#define PT_CACHE_BYTE_ORDER 0x01020304u
+#define PT_CACHE_STATS 5
+
+typedef struct {
+        char magic[16];
+        uint32_t byte_order;
+        uint32_t text_width;
+        uint32_t is_formatted;
+        uint32_t line_count;
+        uint64_t file_size;
+        uint64_t file_ino;
+        uint64_t file_mtime_ns;
+        uint64_t file_ctime_ns;
+        uint64_t block_count;
+        uint64_t tail_hash;
+        uint64_t stats[PT_CACHE_STATS];
+        uint64_t lines_size;
+        uint64_t checksum; // with this field set to 0
+} PTCacheHeader;
+
+typedef struct {
+        uint64_t offset; // from the start of the file
+        uint64_t size;
+        uint64_t len;
+        uint64_t hash;
+} PTCacheBlock;
+
+void pt_cache_describe(PTCache *cache, const struct stat *st) {
+        cache->file_size = (unsigned long long)st->st_size;
+        cache->file_ino = (unsigned long long)st->st_ino;
+        cache->file_mtime_ns = (long long)st->st_mtim.tv_sec * 1000000000LL +
+                               st->st_mtim.tv_nsec;
+        cache->file_ctime_ns = (long long)st->st_ctim.tv_sec * 1000000000LL +
+                               st->st_ctim.tv_nsec;
+}
+
+void pt_cache_path(const char *path, pt_str *out) {
+        const char *slash = strrchr(path, '/');
+        const char *name = slash ? slash + 1 : path;
+        pt_str_append_n(out, path, (size_t)(name - path));
+        pt_str_append_char(out, '.');
+        pt_str_append(out, name);
+        pt_str_append(out, ".porta-cache");
+}
+
+static void pt_cache_stats_out(const PTStats *stats, uint64_t *out) {
+        out[0] = stats->words;
+        out[1] = stats->chars;
+        out[2] = stats->lines;
+        out[3] = stats->paragraphs;
+        out[4] = stats->tail_newlines;
+}
+
+static void pt_cache_stats_in(const uint64_t *in, PTStats *stats) {
+        stats->words = (size_t)in[0];
+        stats->chars = (size_t)in[1];
+        stats->lines = (size_t)in[2];
+        stats->paragraphs = (size_t)in[3];
+        stats->tail_newlines = (size_t)in[4];
+}
+
+static unsigned long long pt_cache_checksum(const PTCacheHeader *header,
+                                            const PTCacheBlock *table,
+                                            const char *lines) {
+        PTCacheHeader copy = *header;
+        copy.checksum = 0;
+        unsigned long long hash = pt_hash_bytes(
+                PT_HASH_SEED, (const char *)&copy, sizeof(copy));
+        hash = pt_hash_bytes(hash, (const char *)table,
+                             (size_t)header->block_count *
+                                     sizeof(PTCacheBlock));
+        return pt_hash_bytes(hash, lines, (size_t)header->lines_size);
+}
+
+/** Makes `cache->lines` out of `count` NUL-ended lines. Returns 0 on success */
+static int pt_cache_read_lines(PTCache *cache, const char *lines, size_t size,
+                               size_t count) {
+        if (count == 0)
+                return 0;
+        cache->lines = malloc(count * sizeof(pt_str));
+        if (!cache->lines)
+                return -1;
+        const char *end = lines + size;
+        for (size_t i = 0; i < count; i++) {
+                const char *nul = memchr(lines, '\0', (size_t)(end - lines));
+                if (!nul)
+                        return -1;
+                pt_str_init(&cache->lines[i]);
+                cache->line_count++;
+                pt_str_append_n(&cache->lines[i], lines, (size_t)(nul - lines));
+                lines = nul + 1;
+        }
+        return lines == end ? 0 : -1;
+}
+
+bool pt_cache_open(const char *path, PTCache *cache) {
+        memset(cache, 0, sizeof(PTCache));
+        struct stat doc;
+        if (stat(path, &doc) != 0)
+                return false;
+        pt_cache_describe(cache, &doc);
+
+        pt_str sidecar;
+        pt_str_init(&sidecar);
+        pt_cache_path(path, &sidecar);
+        int fd = open(sidecar.data, O_RDONLY);
+        pt_str_free(&sidecar);
+        if (fd < 0)
+                return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(PTCacheHeader)) {
+                close(fd);
+                return false;
+        }
+        size_t size = (size_t)st.st_size;
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+                return false;
+        cache->cold.map = map;
+        cache->cold.map_size = size;
+
+        const PTCacheHeader *header = map;
+        const PTCacheBlock *table =
+                (const PTCacheBlock *)(const void *)((const char *)map +
+                                                     sizeof(PTCacheHeader));
+        size_t table_end = sizeof(PTCacheHeader);
+        bool is_valid =
+                memcmp(header->magic, PT_CACHE_MAGIC,
+                       sizeof(PT_CACHE_MAGIC)) == 0 &&
+                header->byte_order == PT_CACHE_BYTE_ORDER &&
+                header->file_size == cache->file_size &&
+                header->file_ino == cache->file_ino &&
+                header->file_mtime_ns == (uint64_t)cache->file_mtime_ns &&
+                header->file_ctime_ns == (uint64_t)cache->file_ctime_ns &&
+                header->block_count <= size / sizeof(PTCacheBlock);
+        if (is_valid) {
+                table_end += (size_t)header->block_count * sizeof(PTCacheBlock);
+                is_valid = table_end <= size &&
+                           header->lines_size <= size - table_end &&
+                           pt_cache_checksum(header, table,
+                                             (const char *)map + table_end) ==
+                                   header->checksum;
+        }
+        for (size_t i = 0; is_valid && i < header->block_count; i++) {
+                const PTCacheBlock *b = &table[i];
+                is_valid = b->offset <= size && b->size <= size - b->offset &&
+                           pt_cold_push_mapped(&cache->cold,
+                                               (char *)map + b->offset,
+                                               (size_t)b->size,
+                                               (size_t)b->len, b->hash) == 0;
+        }
+        is_valid = is_valid && cache->cold.len <= header->file_size &&
+                   pt_cache_read_lines(cache, (const char *)map + table_end,
+                                       (size_t)header->lines_size,
+                                       header->line_count) == 0;
+        if (!is_valid) {
+                pt_cache_free(cache);
+                return false;
+        }
+
+        pt_cache_stats_in(header->stats, &cache->stats);
+        cache->tail_hash = header->tail_hash;
+        cache->text_width = header->text_width;
+        cache->is_formatted = header->is_formatted != 0;
+
+        // Damaged blocks are read again from the document
+        cache->cold.source = open(path, O_RDONLY);
+        cache->cold.has_source = cache->cold.source >= 0;
+        return true;
+}
+
+/** Writes the whole cache to `file`. Returns 0 on success */
+static int pt_cache_write_file(const PTCache *cache, FILE *file) {
+        const PTColdStore *cold = &cache->cold;
+        size_t lines_size = 0;
+        for (int i = 0; i < cache->line_count; i++)
+                lines_size += cache->lines[i].len + 1;
+        char *lines = malloc(lines_size + 1);
+        if (!lines)
+                return -1;
+        char *end = lines;
+        for (int i = 0; i < cache->line_count; i++) {
+                memcpy(end, cache->lines[i].data, cache->lines[i].len + 1);
+                end += cache->lines[i].len + 1;
+        }
+
+        PTCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, PT_CACHE_MAGIC, sizeof(PT_CACHE_MAGIC));
+        header.byte_order = PT_CACHE_BYTE_ORDER;
+        header.text_width = cache->text_width;
+        header.is_formatted = cache->is_formatted;
+        header.line_count = (uint32_t)cache->line_count;
+        header.file_size = cache->file_size;
+        header.file_ino = cache->file_ino;
+        header.file_mtime_ns = (uint64_t)cache->file_mtime_ns;
+        header.file_ctime_ns = (uint64_t)cache->file_ctime_ns;
+        header.block_count = cold->block_count;
+        header.tail_hash = cache->tail_hash;
+        pt_cache_stats_out(&cache->stats, header.stats);
+        header.lines_size = lines_size;
+
+        PTCacheBlock *table =
+                calloc(cold->block_count ? cold->block_count : 1,
+                       sizeof(PTCacheBlock));
+        if (!table) {
+                free(lines);
+                return -1;
+        }
+        uint64_t offset = sizeof(header) +
+                          cold->block_count * sizeof(PTCacheBlock) + lines_size;
+        for (size_t i = 0; i < cold->block_count; i++) {
+                const PTColdBlock *block = cold->blocks[i];
+                table[i].offset = offset;
+                table[i].size = block->size;
+                table[i].len = block->len;
+                table[i].hash = block->hash;
+                offset += block->size;
+        }
+        header.checksum = pt_cache_checksum(&header, table, lines);
+
+        bool is_ok =
+                fwrite(&header, sizeof(header), 1, file) == 1 &&
+                fwrite(table, sizeof(PTCacheBlock), cold->block_count, file) ==
+                        cold->block_count &&
+                fwrite(lines, 1, lines_size, file) == lines_size;
+        for (size_t i = 0; is_ok && i < cold->block_count; i++) {
+                const PTColdBlock *block = cold->blocks[i];
+                is_ok = fwrite(block->data, 1, block->size, file) ==
+                        block->size;
+        }
+        free(table);
+        free(lines);
+        return is_ok ? 0 : -1;
+}
+
+int pt_cache_write(const char *path, const PTCache *cache) {
+        pt_str sidecar;
+        pt_str_init(&sidecar);
+        pt_cache_path(path, &sidecar);
+        pt_str tmp;
+        pt_str_init(&tmp);
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+        pt_str_append(&tmp, sidecar.data);
+        pt_str_append(&tmp, suffix);
+
+        int rc = -1;
+        FILE *file = fopen(tmp.data, "wb");
+        if (file) {
+                rc = pt_cache_write_file(cache, file);
+                if (fclose(file) != 0)
+                        rc = -1;
+                if (rc == 0)
+                        rc = rename(tmp.data, sidecar.data);
+                if (rc != 0)
+                        remove(tmp.data);
+        }
+        pt_str_free(&tmp);
+        pt_str_free(&sidecar);
+        return rc;
+}
+
+void pt_cache_free(PTCache *cache) {
+        pt_cold_free(&cache->cold);
+        for (int i = 0; i < cache->line_count; i++)
+                pt_str_free(&cache->lines[i]);
+        free(cache->lines);
+        cache->lines = NULL;
+        cache->line_count = 0;
+}
+
+#ifdef PT_TEST
+
+#include <assert.h>
+#include <time.h>
+
+static char *test_prose(size_t len) {
+        static const char *const words[] = {"quiet", "river", "letters",
+                                            "valley", "morning", "light"};
+        char *out = malloc(len + 1);
+        unsigned long rng = 42;
+        size_t i = 0;
+        while (i < len) {
+                rng = rng * 6364136223846793005UL + 1442695040888963407UL;
+                const char *word = words[(rng >> 33) % 6];
+                for (const char *c = word; *c && i < len; c++)
+                        out[i++] = *c;
+                if (i < len)
+                        out[i++] = (rng >> 40) % 11 == 0 ? '\n' : ' ';
+        }
+        out[len] = '\0';
+        return out;
+}
+
+/** A document of `blocks` cold blocks and a short tail, written to `path` */
+static char *test_document(const char *path, size_t blocks, PTCache *cache) {
+        size_t cold_len = blocks * PT_COLD_BLOCK_SIZE;
+        size_t len = cold_len + 1000;
+        char *text = test_prose(len);
+        FILE *file = fopen(path, "wb");
+        assert(file && fwrite(text, 1, len, file) == len);
+        assert(fclose(file) == 0);
+
+        memset(cache, 0, sizeof(PTCache));
+        for (size_t i = 0; i < blocks; i++)
+                assert(pt_cold_push(&cache->cold,
+                                    text + i * PT_COLD_BLOCK_SIZE,
+                                    PT_COLD_BLOCK_SIZE) == 0);
+        struct stat st;
+        assert(stat(path, &st) == 0);
+        pt_cache_describe(cache, &st);
+        pt_stats_rebuild(&cache->stats, text, len);
+        cache->tail_hash =
+                pt_hash_bytes(PT_HASH_SEED, text + cold_len, len - cold_len);
+        cache->line_count = 2;
+        cache->lines = malloc(2 * sizeof(pt_str));
+        pt_str_init(&cache->lines[0]);
+        pt_str_init(&cache->lines[1]);
+        pt_str_append(&cache->lines[0], "first line");
+        cache->text_width = 80;
+        cache->is_formatted = true;
+        return text;
+}
+
+static void test_path(void) {
+        pt_str out;
+        pt_str_init(&out);
+        pt_cache_path("notes/today.md", &out);
+        assert(strcmp(out.data, "notes/.today.md.porta-cache") == 0);
+        pt_str_free(&out);
+        pt_str_init(&out);
+        pt_cache_path("today.md", &out);
+        assert(strcmp(out.data, ".today.md.porta-cache") == 0);
+        pt_str_free(&out);
+        putchar('.');
+}
+
+static void test_round_trip(void) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/porta_cache_%ld.md",
+                 (long)getpid());
+        PTCache written;
+        char *text = test_document(path, 3, &written);
+        assert(pt_cache_write(path, &written) == 0);
+
+        PTCache cache;
+        assert(pt_cache_open(path, &cache));
+        assert(cache.cold.block_count == 3);
+        assert(cache.cold.len == written.cold.len);
+        assert(cache.cold.has_source);
+        assert(cache.tail_hash == written.tail_hash);
+        assert(cache.stats.words == written.stats.words &&
+               cache.stats.chars == written.stats.chars &&
+               cache.stats.lines == written.stats.lines);
+        assert(cache.line_count == 2 && cache.text_width == 80 &&
+               cache.is_formatted);
+        assert(strcmp(cache.lines[0].data, "first line") == 0);
+        assert(cache.lines[1].len == 0);
+        for (size_t i = 0; i < 3; i++) {
+                const char *block = pt_cold_block(&cache.cold, i);
+                assert(block && memcmp(block, text + i * PT_COLD_BLOCK_SIZE,
+                                       PT_COLD_BLOCK_SIZE) == 0);
+        }
+        pt_cache_free(&cache);
+
+        // Neither is one rewritten at the same size within the same second,
+        // once the file system clock has ticked
+        struct timespec tick = {0, 20000000L};
+        nanosleep(&tick, NULL);
+        int fd = open(path, O_WRONLY);
+        assert(fd >= 0 && write(fd, text, 1) == 1 && close(fd) == 0);
+        assert(!pt_cache_open(path, &cache));
+
+        // A changed document is not trusted
+        FILE *file = fopen(path, "ab");
+        assert(file && fputc('x', file) == 'x' && fclose(file) == 0);
+        assert(!pt_cache_open(path, &cache));
+
+        pt_str sidecar;
+        pt_str_init(&sidecar);
+        pt_cache_path(path, &sidecar);
+        remove(sidecar.data);
+        pt_str_free(&sidecar);
+        remove(path);
+        pt_cache_free(&written);
+        free(text);
+        putchar('.');
+}
+
+/** Flips one byte of the sidecar of `path` at `offset` */
+static void test_damage(const char *path, long offset) {
+        pt_str sidecar;
+        pt_str_init(&sidecar);
+        pt_cache_path(path, &sidecar);
+        FILE *file = fopen(sidecar.data, "r+b");
+        assert(file && fseek(file, offset, SEEK_SET) == 0);
+        int c = fgetc(file);
+        assert(c != EOF && fseek(file, offset, SEEK_SET) == 0);
+        fputc(c ^ 0x20, file);
+        assert(fclose(file) == 0);
+        pt_str_free(&sidecar);
+}
+
+static void test_corrupt(void) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/porta_cache_bad_%ld.md",
+                 (long)getpid());
+        PTCache written;
+        char *text = test_document(path, 2, &written);
+
+        // Anything before the blocks fails the checksum
+        assert(pt_cache_write(path, &written) == 0);
+        test_damage(path, (long)offsetof(PTCacheHeader, stats));
+        PTCache cache;
+        assert(!pt_cache_open(path, &cache));
+        assert(pt_cache_write(path, &written) == 0);
+        test_damage(path, (long)sizeof(PTCacheHeader) + 8);
+        assert(!pt_cache_open(path, &cache));
+
+        // A damaged block is read again from the document
+        assert(pt_cache_write(path, &written) == 0);
+        long first = (long)(sizeof(PTCacheHeader) + 2 * sizeof(PTCacheBlock) +
+                            strlen("first line") + 2);
+        test_damage(path, first + 100);
+        assert(pt_cache_open(path, &cache));
+        const char *block = pt_cold_block(&cache.cold, 0);
+        assert(block && memcmp(block, text, PT_COLD_BLOCK_SIZE) == 0);
+        assert(!cache.cold.blocks[0]->is_mapped);
+        pt_cache_free(&cache);
+
+        // ... unless it changed there as well
+        assert(pt_cache_open(path, &cache));
+        int fd = open(path, O_WRONLY);
+        assert(fd >= 0 && write(fd, "X", 1) == 1 && close(fd) == 0);
+        assert(pt_cold_block(&cache.cold, 0) == NULL);
+        assert(pt_cold_block(&cache.cold, 1) != NULL);
+        // and then it is not taken out of the store either
+        char *out = malloc(PT_COLD_BLOCK_SIZE);
+        assert(pt_cold_pop(&cache.cold, out) == PT_COLD_BLOCK_SIZE);
+        assert(pt_cold_pop(&cache.cold, out) == 0);
+        assert(cache.cold.block_count == 1);
+        free(out);
+        pt_cache_free(&cache);
+
+        pt_str sidecar;
+        pt_str_init(&sidecar);
+        pt_cache_path(path, &sidecar);
+        remove(sidecar.data);
+        pt_str_free(&sidecar);
+        remove(path);
+        pt_cache_free(&written);
+        free(text);
+        putchar('.');
+}
+
+int main(void) {
+        printf("Running sidecar cache tests...\n");
+        test_path();
+        test_round_trip();
+        test_corrupt();
+
+        putchar('\n');
+        printf("All sidecar cache tests passed.\n");
+        return 0;
+}
+
+#endif /* PT_TEST */
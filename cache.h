@@ -0,0 +1,56 @@
+#ifndef PT_CACHE_H
+#define PT_CACHE_H
+#include "cold.h"
+#include "ds.h"
+#include "stats.h"
+#include <stdbool.h>
+#include <sys/stat.h>
+
+/*
+ * Sidecar cache that makes reopening a huge document instant. Next to
+ * `notes.md` it is `.notes.md.porta-cache`, holding the cold blocks as they
+ * are compressed in memory, the stats of the whole document and the wrapped
+ * lines of the hot tail. It is mapped as is, and only trusted while the
+ * document has the size, inode, mtime and ctime it was written for, the
+ * times to the nanosecond so that saves within a second differ.
+ */
+
+typedef struct {
+        // The document it was written for, see pt_cache_describe
+        unsigned long long file_size;
+        unsigned long long file_ino;
+        long long file_mtime_ns;
+        long long file_ctime_ns;
+
+        PTColdStore cold;
+        PTStats stats;                // of the whole document
+        unsigned long long tail_hash; // of the text after the cold blocks
+
+        // Layout of that text, NULL if there is none
+        pt_str *lines;
+        int line_count;
+        unsigned text_width;
+        bool is_formatted; // for kitty
+} PTCache;
+
+/** Records the document described by `st` as the one `cache` is for */
+void pt_cache_describe(PTCache *cache, const struct stat *st);
+
+/** Appends the path of the sidecar of the document at `path` to `out` */
+void pt_cache_path(const char *path, pt_str *out);
+
+/**
+ * Maps the sidecar of `path` into `cache` if it is intact and was written
+ * for the document as it is now. The blocks are checked when first used,
+ * against the document if needed. Returns false if there is no usable
+ * sidecar.
+ */
+bool pt_cache_open(const char *path, PTCache *cache);
+
+/** Replaces the sidecar of `path` with `cache`. Returns 0 on success */
+int pt_cache_write(const char *path, const PTCache *cache);
+
+/** Frees the blocks and lines that are still in `cache` */
+void pt_cache_free(PTCache *cache);
+
+#endif
@@ -0,0 +1,677 @@
+#define _POSIX_C_SOURCE 200112L
+#include "cold.h"
+#include "ds.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * Codec: the LZ4 block format. A sequence is a token byte holding the
+ * literal length in its high nibble and the match length minus 4 in its
+ * low one, with 15 meaning that more length bytes follow (each adds up to
+ * 255), then the literals, then a 2-byte little-endian match offset and
+ * the extra match length bytes. The last sequence has literals only.
+ */
+#define PT_LZ_MIN_MATCH 4
+#define PT_LZ_MAX_OFFSET 65535
+#define PT_LZ_HASH_BITS 13
+// Misses in a row before the match finder starts skipping ahead
+#define PT_LZ_SKIP_SHIFT 6
+// Short copies are done with this many bytes when there is room, which is
+// cheaper than an exact one. What lands past the end is overwritten later.
+#define PT_LZ_COPY 16
+// Worst case output for incompressible input
+#define PT_LZ_BOUND(len) ((len) + (len) / 255 + 16)
+
+static uint32_t pt_lz_read32(const char *p) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+}
+
+static size_t pt_lz_hash(uint32_t seq) {
+        return (size_t)((seq * 2654435761u) >> (32 - PT_LZ_HASH_BITS));
+}
+
+static size_t pt_lz_put_length(unsigned char *out, size_t op, size_t n) {
+        while (n >= 255) {
+                out[op++] = 255;
+                n -= 255;
+        }
+        out[op++] = (unsigned char)n;
+        return op;
+}
+
+/**
+ * Appends a sequence to `dst` at `*op`. A `match` of 0 makes it the last
+ * one. Returns false if it does not fit in `cap`.
+ */
+static bool pt_lz_emit(char *dst, size_t cap, size_t *op, const char *lit,
+                       size_t lit_len, size_t offset, size_t match) {
+        size_t extra = match ? match - PT_LZ_MIN_MATCH : 0;
+        if (*op + 1 + lit_len / 255 + 1 + lit_len + 2 + extra / 255 + 1 > cap)
+                return false;
+
+        unsigned char *out = (unsigned char *)dst;
+        size_t o = *op;
+        out[o++] = (unsigned char)((lit_len < 15 ? lit_len : 15) << 4 |
+                                   (extra < 15 ? extra : 15));
+        if (lit_len >= 15)
+                o = pt_lz_put_length(out, o, lit_len - 15);
+        memcpy(out + o, lit, lit_len);
+        o += lit_len;
+        if (match) {
+                out[o++] = (unsigned char)(offset & 0xFF);
+                out[o++] = (unsigned char)(offset >> 8);
+                if (extra >= 15)
+                        o = pt_lz_put_length(out, o, extra - 15);
+        }
+        *op = o;
+        return true;
+}
+
+/**
+ * Compresses `len` bytes into `dst`. Returns the compressed size, or 0 if
+ * it would not fit in `cap`.
+ */
+static size_t pt_lz_compress(const char *src, size_t len, char *dst,
+                             size_t cap) {
+        // Positions + 1 of the last sequence with each hash, 0 for none
+        static uint32_t table[1 << PT_LZ_HASH_BITS];
+        memset(table, 0, sizeof(table));
+
+        size_t ip = 0;
+        size_t anchor = 0;
+        size_t op = 0;
+        while (ip + PT_LZ_MIN_MATCH <= len) {
+                uint32_t seq = pt_lz_read32(src + ip);
+                size_t h = pt_lz_hash(seq);
+                size_t ref = table[h];
+                table[h] = (uint32_t)(ip + 1);
+                if (ref == 0 || ip - (ref - 1) > PT_LZ_MAX_OFFSET ||
+                    pt_lz_read32(src + ref - 1) != seq) {
+                        // Incompressible stretches are crossed faster
+                        ip += 1 + ((ip - anchor) >> PT_LZ_SKIP_SHIFT);
+                        continue;
+                }
+                ref--;
+
+                size_t match = PT_LZ_MIN_MATCH;
+                while (ip + match < len && src[ref + match] == src[ip + match])
+                        match++;
+                if (!pt_lz_emit(dst, cap, &op, src + anchor, ip - anchor,
+                                ip - ref, match))
+                        return 0;
+                ip += match;
+                anchor = ip;
+        }
+        if (!pt_lz_emit(dst, cap, &op, src + anchor, len - anchor, 0, 0))
+                return 0;
+        return op;
+}
+
+/**
+ * Decompresses `size` bytes into `dst`. Returns the length of the text, or
+ * 0 if `src` is corrupt or the text does not fit in `cap`.
+ */
+static size_t pt_lz_decompress(const char *src, size_t size, char *dst,
+                               size_t cap) {
+        const unsigned char *in = (const unsigned char *)src;
+        size_t ip = 0;
+        size_t op = 0;
+        while (ip < size) {
+                unsigned char token = in[ip++];
+                size_t lit_len = (size_t)(token >> 4);
+                if (lit_len == 15) {
+                        unsigned char b;
+                        do {
+                                if (ip >= size)
+                                        return 0;
+                                b = in[ip++];
+                                lit_len += b;
+                        } while (b == 255);
+                }
+                if (lit_len > size - ip || lit_len > cap - op)
+                        return 0;
+                if (lit_len <= PT_LZ_COPY && size - ip >= PT_LZ_COPY &&
+                    cap - op >= PT_LZ_COPY)
+                        memcpy(dst + op, in + ip, PT_LZ_COPY);
+                else
+                        memcpy(dst + op, in + ip, lit_len);
+                ip += lit_len;
+                op += lit_len;
+                if (ip == size)
+                        break;
+
+                if (size - ip < 2)
+                        return 0;
+                size_t offset = (size_t)in[ip] | (size_t)in[ip + 1] << 8;
+                ip += 2;
+                if (offset == 0 || offset > op)
+                        return 0;
+                size_t match = (size_t)(token & 0x0F);
+                if (match == 15) {
+                        unsigned char b;
+                        do {
+                                if (ip >= size)
+                                        return 0;
+                                b = in[ip++];
+                                match += b;
+                        } while (b == 255);
+                }
+                match += PT_LZ_MIN_MATCH;
+                if (match > cap - op)
+                        return 0;
+                if (offset >= PT_LZ_COPY && match <= PT_LZ_COPY &&
+                    cap - op >= PT_LZ_COPY) {
+                        memcpy(dst + op, dst + op - offset, PT_LZ_COPY);
+                } else if (offset >= match) {
+                        memcpy(dst + op, dst + op - offset, match);
+                } else {
+                        // The match overlaps its own output
+                        for (size_t i = 0; i < match; i++)
+                                dst[op + i] = dst[op - offset + i];
+                }
+                op += match;
+        }
+        return op;
+}
+
+static bool pt_is_continuation(char c) {
+        return ((unsigned char)c & 0xC0) == 0x80;
+}
+
+size_t pt_cold_cut(const char *data, size_t len) {
+        for (size_t i = len; i > 0; i--) {
+                if (data[i - 1] == '\n')
+                        return i;
+        }
+        for (size_t i = len; i > 0; i--) {
+                if (data[i - 1] == ' ' || data[i - 1] == '\t' ||
+                    data[i - 1] == '\r')
+                        return i;
+        }
+        size_t i = len;
+        while (i > 0 && pt_is_continuation(data[i - 1]))
+                i--;
+        // Stop before the lead byte unless it is the only one
+        return i > 1 ? i - 1 : len;
+}
+
+static PTColdBlock *pt_cold_add(PTColdStore *cold) {
+        if (cold->block_count == cold->block_cap) {
+                size_t new_cap = cold->block_cap ? cold->block_cap * 2 : 64;
+                PTColdBlock **blocks =
+                        realloc(cold->blocks, new_cap * sizeof(PTColdBlock *));
+                if (!blocks)
+                        return NULL;
+                cold->blocks = blocks;
+                cold->block_cap = new_cap;
+        }
+        return calloc(1, sizeof(PTColdBlock));
+}
+
+/** Puts `block` on top, taking over the reference the store had there */
+static void pt_cold_link(PTColdStore *cold, PTColdBlock *block) {
+        block->refs = 1;
+        block->prev = cold->block_count > 0
+                              ? cold->blocks[cold->block_count - 1]
+                              : NULL;
+        block->start = cold->len;
+        cold->blocks[cold->block_count++] = block;
+        cold->len += block->len;
+        cold->size += block->size;
+}
+
+/** Compresses `len` bytes into `block`, which keeps its place */
+static int pt_cold_pack(PTColdBlock *block, const char *data, size_t len) {
+        char *packed = malloc(PT_LZ_BOUND(len));
+        if (!packed)
+                return -1;
+        size_t size = pt_lz_compress(data, len, packed, len - 1);
+        if (size == 0) {
+                // Does not compress: keep it as it is
+                memcpy(packed, data, len);
+                size = len;
+        }
+        char *fitted = realloc(packed, size);
+        if (fitted)
+                packed = fitted;
+
+        block->data = packed;
+        block->size = size;
+        block->len = len;
+        block->hash = pt_hash_bytes(PT_HASH_SEED, data, len);
+        block->is_mapped = false;
+        return 0;
+}
+
+int pt_cold_push(PTColdStore *cold, const char *data, size_t len) {
+        if (len == 0 || len > PT_COLD_BLOCK_SIZE)
+                return -1;
+        PTColdBlock *block = pt_cold_add(cold);
+        if (!block)
+                return -1;
+        if (pt_cold_pack(block, data, len) != 0) {
+                free(block);
+                return -1;
+        }
+        pt_cold_link(cold, block);
+        return 0;
+}
+
+int pt_cold_push_mapped(PTColdStore *cold, char *data, size_t size,
+                        size_t len, unsigned long long hash) {
+        if (len == 0 || len > PT_COLD_BLOCK_SIZE || size > len)
+                return -1;
+        PTColdBlock *block = pt_cold_add(cold);
+        if (!block)
+                return -1;
+
+        block->data = data;
+        block->size = size;
+        block->len = len;
+        block->hash = hash;
+        block->is_mapped = true;
+        pt_cold_link(cold, block);
+        return 0;
+}
+
+static size_t pt_cold_decode(const PTColdBlock *block, char *out) {
+        if (block->size == block->len) {
+                memcpy(out, block->data, block->len);
+                return block->len;
+        }
+        size_t len =
+                pt_lz_decompress(block->data, block->size, out, block->len);
+        return len == block->len ? len : 0;
+}
+
+/**
+ * Reads the text of a damaged mapped block from the document into `out`
+ * and compresses it anew. Returns its length, 0 if the document changed.
+ */
+static size_t pt_cold_recover(PTColdStore *cold, PTColdBlock *block,
+                              char *out) {
+        if (!cold->has_source ||
+            lseek(cold->source, (off_t)block->start, SEEK_SET) < 0)
+                return 0;
+        size_t got = 0;
+        while (got < block->len) {
+                ssize_t n = read(cold->source, out + got, block->len - got);
+                if (n <= 0)
+                        return 0;
+                got += (size_t)n;
+        }
+        if (pt_hash_bytes(PT_HASH_SEED, out, got) != block->hash)
+                return 0;
+
+        size_t size = block->size;
+        if (pt_cold_pack(block, out, got) != 0)
+                return 0;
+        // Blocks that only snapshots hold are not counted in the store
+        if (cold->block_count > 0 &&
+            cold->blocks[pt_cold_find(cold, block->start)] == block)
+                cold->size = cold->size - size + block->size;
+        return got;
+}
+
+static size_t pt_cold_unpack(PTColdStore *cold, PTColdBlock *block,
+                             char *out) {
+        size_t len = pt_cold_decode(block, out);
+        if (!block->is_mapped || block->is_checked)
+                return len;
+        if (len > 0 && pt_hash_bytes(PT_HASH_SEED, out, len) == block->hash) {
+                block->is_checked = true;
+                return len;
+        }
+        return pt_cold_recover(cold, block, out);
+}
+
+size_t pt_cold_read(PTColdStore *cold, PTColdBlock *block, char *out) {
+        return pt_cold_unpack(cold, block, out);
+}
+
+size_t pt_cold_pop(PTColdStore *cold, char *out) {
+        if (cold->block_count == 0)
+                return 0;
+        size_t index = cold->block_count - 1;
+        PTColdBlock *block = cold->blocks[index];
+        size_t len = pt_cold_unpack(cold, block, out);
+        if (len == 0)
+                return 0;
+
+        for (size_t i = 0; i < PT_COLD_CACHE_SLOTS; i++) {
+                if (cold->cache[i].block == index + 1)
+                        cold->cache[i].block = 0;
+        }
+        cold->len -= block->len;
+        cold->size -= block->size;
+        cold->block_count--;
+        // The block below is now held by the store, and this one only by
+        // the snapshots that still have it
+        if (block->prev)
+                block->prev->refs++;
+        pt_cold_release(block);
+        return len;
+}
+
+PTColdBlock *pt_cold_share(PTColdStore *cold) {
+        if (cold->block_count == 0)
+                return NULL;
+        PTColdBlock *top = cold->blocks[cold->block_count - 1];
+        top->refs++;
+        return top;
+}
+
+void pt_cold_release(PTColdBlock *block) {
+        // A loop rather than recursion, as chains are as long as documents
+        while (block && --block->refs == 0) {
+                PTColdBlock *prev = block->prev;
+                if (!block->is_mapped)
+                        free(block->data);
+                free(block);
+                block = prev;
+        }
+}
+
+int pt_cold_restore(PTColdStore *cold, PTColdBlock *top) {
+        size_t count = 0;
+        for (PTColdBlock *b = top; b; b = b->prev)
+                count++;
+        if (count > cold->block_cap) {
+                PTColdBlock **blocks =
+                        realloc(cold->blocks, count * sizeof(PTColdBlock *));
+                if (!blocks)
+                        return -1;
+                cold->blocks = blocks;
+                cold->block_cap = count;
+        }
+
+        pt_cold_release(cold->block_count > 0
+                                ? cold->blocks[cold->block_count - 1]
+                                : NULL);
+        cold->block_count = count;
+        cold->size = 0;
+        for (PTColdBlock *b = top; b; b = b->prev) {
+                cold->blocks[--count] = b;
+                cold->size += b->size;
+        }
+        cold->len = top ? top->start + top->len : 0;
+        for (size_t i = 0; i < PT_COLD_CACHE_SLOTS; i++)
+                cold->cache[i].block = 0;
+        return 0;
+}
+
+size_t pt_cold_find(const PTColdStore *cold, size_t offset) {
+        size_t lo = 0;
+        size_t hi = cold->block_count;
+        while (hi - lo > 1) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (cold->blocks[mid]->start <= offset)
+                        lo = mid;
+                else
+                        hi = mid;
+        }
+        return lo;
+}
+
+const char *pt_cold_block(PTColdStore *cold, size_t index) {
+        if (index >= cold->block_count)
+                return NULL;
+
+        PTColdSlot *victim = &cold->cache[0];
+        for (size_t i = 0; i < PT_COLD_CACHE_SLOTS; i++) {
+                PTColdSlot *slot = &cold->cache[i];
+                if (slot->block == index + 1) {
+                        slot->last_used = ++cold->clock;
+                        return slot->data;
+                }
+                if (slot->block == 0 ||
+                    (victim->block != 0 && slot->last_used < victim->last_used))
+                        victim = slot;
+        }
+
+        if (!victim->data) {
+                victim->data = malloc(PT_COLD_BLOCK_SIZE);
+                if (!victim->data)
+                        return NULL;
+        }
+        victim->block = 0;
+        if (pt_cold_unpack(cold, cold->blocks[index], victim->data) == 0)
+                return NULL;
+        victim->block = index + 1;
+        victim->last_used = ++cold->clock;
+        return victim->data;
+}
+
+void pt_cold_free(PTColdStore *cold) {
+        if (cold->block_count > 0)
+                pt_cold_release(cold->blocks[cold->block_count - 1]);
+        free(cold->blocks);
+        for (size_t i = 0; i < PT_COLD_CACHE_SLOTS; i++)
+                free(cold->cache[i].data);
+        if (cold->map)
+                munmap(cold->map, cold->map_size);
+        if (cold->has_source)
+                close(cold->source);
+        memset(cold, 0, sizeof(PTColdStore));
+}
+
+static const char *pt_cold_segment(const pt_text *text, size_t offset,
+                                   size_t *start, size_t *seg_len) {
+        PTColdStore *cold = text->store;
+        size_t index = pt_cold_find(cold, offset);
+        *start = cold->blocks[index]->start;
+        *seg_len = cold->blocks[index]->len;
+        return pt_cold_block(cold, index);
+}
+
+void pt_cold_text(PTColdStore *cold, const pt_str *tail, pt_text *text) {
+        pt_text_init(text, tail->data, cold->len + tail->len);
+        text->data_start = cold->len;
+        text->segment = pt_cold_segment;
+        text->store = cold;
+}
+
+#ifdef PT_TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+static unsigned long test_rng = 2463534242UL;
+
+static unsigned long test_rand(void) {
+        test_rng ^= test_rng << 13;
+        test_rng ^= test_rng >> 17;
+        test_rng ^= test_rng << 5;
+        return test_rng & 0xFFFFFFFFUL;
+}
+
+/** `len` bytes of prose-like text made of a few words */
+static char *test_prose(size_t len) {
+        static const char *const words[] = {"the ",   "cold ",   "block ",
+                                            "stores ", "text\n", "of ",
+                                            "notes ", "a ",      "long, "};
+        char *text = malloc(len + 1);
+        size_t i = 0;
+        while (i < len) {
+                const char *w = words[test_rand() % 9];
+                while (*w && i < len)
+                        text[i++] = *w++;
+        }
+        text[len] = '\0';
+        return text;
+}
+
+static void assert_round_trip(const char *data, size_t len) {
+        char *packed = malloc(PT_LZ_BOUND(len));
+        char *out = malloc(len + 1);
+        size_t size = pt_lz_compress(data, len, packed, PT_LZ_BOUND(len));
+        assert(size > 0);
+        assert(pt_lz_decompress(packed, size, out, len) == len ||
+               len == 0);
+        assert(memcmp(out, data, len) == 0);
+        free(packed);
+        free(out);
+}
+
+static void test_codec_round_trip(void) {
+        assert_round_trip("", 0);
+        assert_round_trip("a", 1);
+        assert_round_trip("abcabcabcabcabcabcabcabc", 24);
+
+        char *prose = test_prose(PT_COLD_BLOCK_SIZE);
+        assert_round_trip(prose, PT_COLD_BLOCK_SIZE);
+        char packed[PT_LZ_BOUND(PT_COLD_BLOCK_SIZE)];
+        size_t size = pt_lz_compress(prose, PT_COLD_BLOCK_SIZE, packed,
+                                     sizeof(packed));
+        assert(size < PT_COLD_BLOCK_SIZE / 2);
+
+        // Long runs need the extra length bytes
+        memset(prose, 'z', PT_COLD_BLOCK_SIZE);
+        assert_round_trip(prose, PT_COLD_BLOCK_SIZE);
+
+        for (size_t i = 0; i < PT_COLD_BLOCK_SIZE; i++)
+                prose[i] = (char)test_rand();
+        assert_round_trip(prose, PT_COLD_BLOCK_SIZE);
+        // Random bytes do not fit in less than they take
+        assert(pt_lz_compress(prose, PT_COLD_BLOCK_SIZE, packed,
+                              PT_COLD_BLOCK_SIZE - 1) == 0);
+        free(prose);
+        putchar('.');
+}
+
+static void test_codec_corrupt(void) {
+        char *prose = test_prose(4096);
+        char packed[PT_LZ_BOUND(4096)];
+        char out[4096];
+        size_t size = pt_lz_compress(prose, 4096, packed, sizeof(packed));
+
+        // Truncated input and a short output are refused
+        assert(pt_lz_decompress(packed, size / 2, out, sizeof(out)) != 4096);
+        assert(pt_lz_decompress(packed, size, out, 100) == 0);
+        // Damaged input never writes out of bounds
+        for (int round = 0; round < 1000; round++) {
+                char damaged[sizeof(packed)];
+                memcpy(damaged, packed, size);
+                damaged[test_rand() % size] = (char)test_rand();
+                pt_lz_decompress(damaged, size, out, sizeof(out));
+        }
+        const char zero_offset[] = {0x10, 'a', 0, 0};
+        assert(pt_lz_decompress(zero_offset, 4, out, sizeof(out)) == 0);
+        free(prose);
+        putchar('.');
+}
+
+static void test_cut(void) {
+        assert(pt_cold_cut("one\ntwo", 7) == 4);
+        assert(pt_cold_cut("a\nb\n", 4) == 4);
+        assert(pt_cold_cut("abc", 3) == 2);
+        assert(pt_cold_cut("ab cd", 5) == 3);
+        // "é" is not split
+        assert(pt_cold_cut("ab\xc3\xa9", 4) == 2);
+        assert(pt_cold_cut("\xc3\xa9", 2) == 2);
+        putchar('.');
+}
+
+static void test_store(void) {
+        size_t len = 10 * PT_COLD_BLOCK_SIZE + 123;
+        char *prose = test_prose(len);
+        PTColdStore cold;
+        memset(&cold, 0, sizeof(cold));
+
+        size_t offset = 0;
+        while (offset < len) {
+                size_t n = len - offset < PT_COLD_BLOCK_SIZE
+                                   ? len - offset
+                                   : pt_cold_cut(prose + offset,
+                                                 PT_COLD_BLOCK_SIZE);
+                assert(pt_cold_push(&cold, prose + offset, n) == 0);
+                offset += n;
+        }
+        assert(cold.len == len);
+        assert(cold.size < len / 2);
+
+        // Reading every block in turn cycles through the cache slots
+        for (int pass = 0; pass < 2; pass++) {
+                for (size_t i = 0; i < cold.block_count; i++) {
+                        const PTColdBlock *block = cold.blocks[i];
+                        assert(pt_cold_find(&cold, block->start) == i);
+                        assert(pt_cold_find(&cold, block->start + block->len -
+                                                           1) == i);
+                        const char *text = pt_cold_block(&cold, i);
+                        assert(text);
+                        assert(memcmp(text, prose + block->start,
+                                      block->len) == 0);
+                }
+        }
+        assert(pt_cold_block(&cold, cold.block_count) == NULL);
+
+        // Blocks come back last first
+        char *out = malloc(PT_COLD_BLOCK_SIZE);
+        while (cold.block_count > 0) {
+                size_t start = cold.blocks[cold.block_count - 1]->start;
+                size_t n = pt_cold_pop(&cold, out);
+                assert(n > 0 && start + n == len);
+                assert(memcmp(out, prose + start, n) == 0);
+                len = start;
+        }
+        assert(cold.len == 0 && cold.size == 0);
+        assert(pt_cold_pop(&cold, out) == 0);
+
+        pt_cold_free(&cold);
+        free(out);
+        free(prose);
+        putchar('.');
+}
+
+static void test_text_view(void) {
+        size_t len = 3 * PT_COLD_BLOCK_SIZE;
+        char *prose = test_prose(len);
+        PTColdStore cold;
+        memset(&cold, 0, sizeof(cold));
+        for (size_t i = 0; i < 2; i++)
+                assert(pt_cold_push(&cold, prose + i * PT_COLD_BLOCK_SIZE,
+                                    PT_COLD_BLOCK_SIZE) == 0);
+        pt_str *tail = pt_str_from(prose + 2 * PT_COLD_BLOCK_SIZE);
+
+        pt_text text;
+        pt_cold_text(&cold, tail, &text);
+        pt_text flat;
+        pt_text_init(&flat, prose, len);
+        assert(text.len == len);
+        assert(pt_text_hash(&text) == pt_text_hash(&flat));
+
+        char out[64];
+        for (size_t i = 1; i < 3; i++) {
+                size_t at = i * PT_COLD_BLOCK_SIZE - 20;
+                assert(pt_text_copy(&text, at, out, 40) == 40);
+                assert(memcmp(out, prose + at, 40) == 0);
+                assert(pt_text_at(&text, at) == prose[at]);
+        }
+
+        pt_str_free(tail);
+        free(tail);
+        pt_cold_free(&cold);
+        free(prose);
+        putchar('.');
+}
+
+int main(void) {
+        printf("Running cold storage tests...\n");
+        test_codec_round_trip();
+        test_codec_corrupt();
+        test_cut();
+        test_store();
+        test_text_view();
+
+        putchar('\n');
+        printf("All cold storage tests passed.\n");
+        return 0;
+}
+
+#endif /* PT_TEST */
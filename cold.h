@@ -0,0 +1,126 @@
+#ifndef PT_COLD_H
+#define PT_COLD_H
+#include "ds.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Compressed storage for the old part of huge documents. The text before
+ * the hot tail that is being edited is kept in blocks of up to
+ * PT_COLD_BLOCK_SIZE bytes, each compressed on its own with a small LZ77
+ * codec of the LZ4 family. Blocks are decompressed on demand into a few
+ * cached slots.
+ *
+ * Blocks can also come from a mapped file, such as the sidecar cache. Their
+ * text is checked against its hash the first time it is decompressed, and
+ * read again from the document when it does not match.
+ *
+ * Each block holds a reference to the one before it, so the blocks of the
+ * store at some point are all reachable from its last block then. Keeping
+ * that block keeps a snapshot of the store, which later pushes and pops
+ * leave alone.
+ */
+
+#define PT_COLD_BLOCK_SIZE (64 * 1024)
+#define PT_COLD_CACHE_SLOTS 4
+
+typedef struct PTColdBlock {
+        unsigned long refs;
+        struct PTColdBlock *prev; // held by this block
+        char *data; // compressed, or as is when `size` == `len`
+        size_t size;
+        size_t len;   // of the text
+        size_t start; // offset of the text in the document
+        unsigned long long hash; // pt_hash_bytes of the text
+        bool is_mapped;  // `data` is in `map`
+        bool is_checked; // mapped text known to match `hash`
+} PTColdBlock;
+
+typedef struct {
+        char *data;
+        size_t block; // index + 1, 0 when empty
+        unsigned long last_used;
+} PTColdSlot;
+
+typedef struct {
+        PTColdBlock **blocks; // first to last, the last one held by the store
+        size_t block_count;
+        size_t block_cap;
+        size_t len;  // text in all blocks
+        size_t size; // what the blocks take
+        PTColdSlot cache[PT_COLD_CACHE_SLOTS];
+        unsigned long clock;
+
+        // Mapped blocks, and the document to read their text from again
+        void *map;
+        size_t map_size;
+        int source;
+        bool has_source;
+} PTColdStore;
+
+/**
+ * Where to end a block taken from the `len` bytes at `data`: after the
+ * last newline, or else after the last blank, or else, within a single
+ * word, before its last UTF-8 character.
+ */
+size_t pt_cold_cut(const char *data, size_t len);
+
+/**
+ * Compresses `len` bytes, at most PT_COLD_BLOCK_SIZE, into a new block at
+ * the end of the store. Returns 0 on success.
+ */
+int pt_cold_push(PTColdStore *cold, const char *data, size_t len);
+
+/**
+ * Adds a block whose `size` bytes of data are in `cold->map` and are only
+ * checked when first used. Returns 0 on success.
+ */
+int pt_cold_push_mapped(PTColdStore *cold, char *data, size_t size,
+                        size_t len, unsigned long long hash);
+
+/**
+ * Removes the last block and writes its text to `out`, which has room for
+ * PT_COLD_BLOCK_SIZE bytes. Returns the length of the text, 0 if the store
+ * is empty or the text is lost, in which case the block stays.
+ */
+size_t pt_cold_pop(PTColdStore *cold, char *out);
+
+/**
+ * Writes the text of `block` to `out`, which has room for
+ * PT_COLD_BLOCK_SIZE bytes. The block may have left the store since it was
+ * shared. Returns the length of the text, 0 if it is lost.
+ */
+size_t pt_cold_read(PTColdStore *cold, PTColdBlock *block, char *out);
+
+/** Returns a new reference to the last block, NULL if there is none */
+PTColdBlock *pt_cold_share(PTColdStore *cold);
+
+/** Drops a reference to `block`, freeing the blocks no one holds anymore */
+void pt_cold_release(PTColdBlock *block);
+
+/**
+ * Makes the store hold the blocks up to `top`, taking over that reference.
+ * Returns 0 on success, and -1 with nothing changed if out of memory.
+ */
+int pt_cold_restore(PTColdStore *cold, PTColdBlock *top);
+
+/** Index of the block holding `offset`, which must be below `cold->len` */
+size_t pt_cold_find(const PTColdStore *cold, size_t offset);
+
+/**
+ * Returns the text of block `index`, or NULL if it is lost.
+ * It stays valid until PT_COLD_CACHE_SLOTS other blocks have been asked
+ * for.
+ */
+const char *pt_cold_block(PTColdStore *cold, size_t index);
+
+/**
+ * Frees the blocks, unmaps `map` and closes `source`. Blocks shared from
+ * the store must have been released, as mapped ones point into `map`.
+ */
+void pt_cold_free(PTColdStore *cold);
+
+/** Makes `text` a view of the blocks followed by `tail` */
+void pt_cold_text(PTColdStore *cold, const pt_str *tail, pt_text *text);
+
+#endif
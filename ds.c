@@ -4,6 +4,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+static size_t alloc_count;
+
+size_t pt_str_alloc_count(void) { return alloc_count; }
+
 pt_str *pt_str_new(void) {
         pt_str *str = malloc(sizeof(pt_str));
         if (!str)
@@ -19,58 +23,132 @@ pt_str *pt_str_new(void) {
 
 pt_str *pt_str_from(const char *str) {
         pt_str *new_str = pt_str_new();
-        pt_str_append(new_str, str);
+        if (new_str)
+                pt_str_append_n(new_str, str, strlen(str));
         return new_str;
 }
 
 int pt_str_init(pt_str *s) {
-        s->cap = 16;
+        s->cap = PT_STR_INLINE;
         s->len = 0;
-        s->data = malloc(s->cap);
-        if (!s->data)
-                return -1;
+        s->data = s->small;
         s->data[0] = '\0';
         return 0;
 }
 
 void pt_str_free(pt_str *s) {
-        free(s->data);
+        if (s->cap > PT_STR_INLINE)
+                free(s->data);
         s->data = NULL;
         s->len = 0;
         s->cap = 0;
 }
 
-int pt_str_append(pt_str *s, const char *suffix) {
-        if (!s || !s->data || s->cap == 0) {
-                return -1;
-        }
+void pt_str_moved(pt_str *s) {
+        if (s->cap == PT_STR_INLINE)
+                s->data = s->small;
+}
 
-        size_t suffix_len = strlen(suffix);
-        size_t required = s->len + suffix_len + 1;
+pt_str pt_str_view(char *data, size_t len) {
+        pt_str view;
+        memset(&view, 0, sizeof(view));
+        view.data = data;
+        view.len = len;
+        return view;
+}
 
-        if (required > s->cap) {
-                size_t new_cap = s->cap;
-                while (new_cap < required) {
-                        new_cap *= 2;
-                }
-                char *new_data = realloc(s->data, new_cap);
-                if (!new_data) {
-                        return -1;
-                }
-                s->data = new_data;
-                s->cap = new_cap;
+/*
+ * Capacities double up to PT_STR_LARGE, then grow by a quarter in whole
+ * pages. Allocators move blocks that large by remapping their pages, so
+ * growing a multi-GB buffer neither copies it nor leaves a GB unused.
+ */
+#define PT_STR_LARGE (1024 * 1024)
+#define PT_STR_PAGE 4096
+
+/** Moves the text to a heap block of `cap` bytes. Returns 0 on success */
+static int pt_str_realloc(pt_str *s, size_t cap) {
+        char *data;
+        if (s->cap == PT_STR_INLINE) {
+                data = malloc(cap);
+                if (data)
+                        memcpy(data, s->small, s->len + 1);
+        } else {
+                data = realloc(s->data, cap);
         }
+        if (!data)
+                return -1;
+        alloc_count++;
+        s->data = data;
+        s->cap = cap;
+        return 0;
+}
+
+/** Makes room for `required` bytes, NUL included */
+static int pt_str_grow(pt_str *s, size_t required) {
+        if (!s || !s->data || s->cap == 0)
+                return -1;
+        if (required <= s->cap)
+                return 0;
+
+        size_t new_cap = s->cap;
+        while (new_cap < required && new_cap < PT_STR_LARGE)
+                new_cap *= 2;
+        if (new_cap < required) {
+                new_cap += new_cap / 4;
+                if (new_cap < required)
+                        new_cap = required;
+                new_cap = (new_cap + PT_STR_PAGE - 1) / PT_STR_PAGE *
+                          PT_STR_PAGE;
+        }
+        return pt_str_realloc(s, new_cap);
+}
 
-        memcpy(s->data + s->len, suffix, suffix_len);
-        s->len += suffix_len;
+int pt_str_append_n(pt_str *s, const char *data, size_t len) {
+        if (pt_str_grow(s, s ? s->len + len + 1 : 0) != 0)
+                return -1;
+        memcpy(s->data + s->len, data, len);
+        s->len += len;
         s->data[s->len] = '\0';
+        return 0;
+}
 
+int pt_str_append(pt_str *s, const char *suffix) {
+        size_t suffix_len = strlen(suffix);
+        if (pt_str_append_n(s, suffix, suffix_len) != 0)
+                return -1;
         return (int)suffix_len;
 }
 
 void pt_str_append_char(pt_str *s, char c) {
-        char buf[2] = {c, '\0'};
-        pt_str_append(s, buf);
+        if (s->len + 2 > s->cap && pt_str_grow(s, s->len + 2) != 0)
+                return;
+        s->data[s->len++] = c;
+        s->data[s->len] = '\0';
+}
+
+int pt_str_reserve(pt_str *s, size_t len) {
+        if (!s || !s->data || s->cap == 0)
+                return -1;
+        if (len + 1 <= s->cap)
+                return 0;
+        return pt_str_realloc(s, len + 1);
+}
+
+void pt_str_shrink(pt_str *s) {
+        if (s->cap <= PT_STR_INLINE || s->len + 1 == s->cap)
+                return;
+        if (s->len < PT_STR_INLINE) {
+                memcpy(s->small, s->data, s->len + 1);
+                free(s->data);
+                s->data = s->small;
+                s->cap = PT_STR_INLINE;
+                return;
+        }
+        char *data = realloc(s->data, s->len + 1);
+        if (data) {
+                s->data = data;
+                s->cap = s->len + 1;
+        }
 }
 
 void pt_str_delete_char(pt_str *s) {
@@ -79,6 +157,218 @@ void pt_str_delete_char(pt_str *s) {
         }
 }
 
+unsigned long long pt_hash_bytes(unsigned long long hash, const char *data,
+                                 size_t len) {
+        for (size_t i = 0; i < len; i++) {
+                hash ^= (unsigned char)data[i];
+                hash *= 1099511628211ULL;
+        }
+        return hash;
+}
+
+void pt_text_init(pt_text *text, const char *data, size_t len) {
+        text->len = len;
+        text->data = data;
+        text->data_start = 0;
+        text->segment = NULL;
+        text->store = NULL;
+}
+
+const char *pt_text_segment(const pt_text *text, size_t offset, size_t *start,
+                            size_t *seg_len) {
+        if (offset >= text->data_start) {
+                *start = text->data_start;
+                *seg_len = text->len - text->data_start;
+                return text->data;
+        }
+        return text->segment(text, offset, start, seg_len);
+}
+
+char pt_text_at(const pt_text *text, size_t offset) {
+        if (offset >= text->data_start)
+                return text->data[offset - text->data_start];
+        size_t start;
+        size_t seg_len;
+        const char *seg = text->segment(text, offset, &start, &seg_len);
+        return seg ? seg[offset - start] : '\0';
+}
+
+size_t pt_text_copy(const pt_text *text, size_t offset, char *out, size_t n) {
+        size_t copied = 0;
+        while (copied < n && offset < text->len) {
+                size_t start;
+                size_t seg_len;
+                const char *seg =
+                        pt_text_segment(text, offset, &start, &seg_len);
+                if (!seg)
+                        break;
+                size_t k = start + seg_len - offset;
+                if (k > n - copied)
+                        k = n - copied;
+                memcpy(out + copied, seg + (offset - start), k);
+                copied += k;
+                offset += k;
+        }
+        return copied;
+}
+
+unsigned long long pt_text_hash(const pt_text *text) {
+        unsigned long long hash = PT_HASH_SEED;
+        size_t offset = 0;
+        while (offset < text->len) {
+                size_t start;
+                size_t seg_len;
+                const char *seg =
+                        pt_text_segment(text, offset, &start, &seg_len);
+                if (!seg)
+                        break;
+                hash = pt_hash_bytes(hash, seg + (offset - start),
+                                     start + seg_len - offset);
+                offset = start + seg_len;
+        }
+        return hash;
+}
+
+#define PT_MAP_INITIAL_CAP 16
+
+static size_t pt_map_hash(const char *key) {
+        // FNV-1a
+        size_t h = (size_t)14695981039346656037ULL;
+        for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+                h ^= *p;
+                h *= (size_t)1099511628211ULL;
+        }
+        return h;
+}
+
+/** Returns the slot holding `key`, or the empty slot where it would go */
+static size_t pt_map_slot(const pt_map *m, const char *key) {
+        size_t mask = m->cap - 1;
+        size_t i = pt_map_hash(key) & mask;
+        while (m->keys[i] && strcmp(m->keys[i], key) != 0)
+                i = (i + 1) & mask;
+        return i;
+}
+
+int pt_map_init(pt_map *m) {
+        m->len = 0;
+        m->cap = PT_MAP_INITIAL_CAP;
+        m->keys = calloc(m->cap, sizeof(char *));
+        m->values = calloc(m->cap, sizeof(size_t));
+        if (!m->keys || !m->values) {
+                free(m->keys);
+                free(m->values);
+                m->keys = NULL;
+                m->values = NULL;
+                m->cap = 0;
+                return -1;
+        }
+        return 0;
+}
+
+void pt_map_free(pt_map *m) {
+        for (size_t i = 0; i < m->cap; i++)
+                free(m->keys[i]);
+        free(m->keys);
+        free(m->values);
+        m->keys = NULL;
+        m->values = NULL;
+        m->len = 0;
+        m->cap = 0;
+}
+
+static int pt_map_grow(pt_map *m) {
+        pt_map bigger = {0};
+        bigger.cap = m->cap * 2;
+        bigger.keys = calloc(bigger.cap, sizeof(char *));
+        bigger.values = calloc(bigger.cap, sizeof(size_t));
+        if (!bigger.keys || !bigger.values) {
+                free(bigger.keys);
+                free(bigger.values);
+                return -1;
+        }
+
+        // Move the existing keys over without copying them
+        for (size_t i = 0; i < m->cap; i++) {
+                if (!m->keys[i])
+                        continue;
+                size_t slot = pt_map_slot(&bigger, m->keys[i]);
+                bigger.keys[slot] = m->keys[i];
+                bigger.values[slot] = m->values[i];
+        }
+        bigger.len = m->len;
+
+        free(m->keys);
+        free(m->values);
+        *m = bigger;
+        return 0;
+}
+
+int pt_map_put(pt_map *m, const char *key, size_t value) {
+        if (!m || m->cap == 0)
+                return -1;
+
+        // Keep the load factor under 0.7 so probe sequences stay short
+        if ((m->len + 1) * 10 > m->cap * 7 && pt_map_grow(m) != 0)
+                return -1;
+
+        size_t slot = pt_map_slot(m, key);
+        if (!m->keys[slot]) {
+                size_t key_len = strlen(key);
+                char *copy = malloc(key_len + 1);
+                if (!copy)
+                        return -1;
+                memcpy(copy, key, key_len + 1);
+                m->keys[slot] = copy;
+                m->len++;
+        }
+        m->values[slot] = value;
+        return 0;
+}
+
+bool pt_map_get(const pt_map *m, const char *key, size_t *value) {
+        if (!m || m->cap == 0)
+                return false;
+
+        size_t slot = pt_map_slot(m, key);
+        if (!m->keys[slot])
+                return false;
+        if (value)
+                *value = m->values[slot];
+        return true;
+}
+
+bool pt_map_remove(pt_map *m, const char *key) {
+        if (!m || m->cap == 0)
+                return false;
+
+        size_t mask = m->cap - 1;
+        size_t hole = pt_map_slot(m, key);
+        if (!m->keys[hole])
+                return false;
+        free(m->keys[hole]);
+        m->len--;
+
+        // Backward shift deletion: pull later entries of the probe sequence
+        // into the hole so that lookups never need tombstones
+        size_t j = hole;
+        while (1) {
+                j = (j + 1) & mask;
+                if (!m->keys[j])
+                        break;
+                size_t home = pt_map_hash(m->keys[j]) & mask;
+                bool movable = hole <= j ? (home <= hole || home > j)
+                                         : (home <= hole && home > j);
+                if (movable) {
+                        m->keys[hole] = m->keys[j];
+                        m->values[hole] = m->values[j];
+                        hole = j;
+                }
+        }
+        m->keys[hole] = NULL;
+        return true;
+}
+
 #ifdef PT_TEST
 
 #include <assert.h>
@@ -321,6 +611,230 @@ static void test_independence(void) {
         putchar('.');
 }
 
+static void test_inline(void) {
+        size_t allocs = pt_str_alloc_count();
+        pt_str s;
+        pt_str_init(&s);
+        assert(s.data == s.small);
+        pt_str_append(&s, "fifteen bytes!!");
+        assert(s.len == 15 && s.data == s.small);
+        assert(pt_str_alloc_count() == allocs);
+
+        pt_str_append_char(&s, '?');
+        assert(s.data != s.small && s.cap == 32);
+        assert(strcmp(s.data, "fifteen bytes!!?") == 0);
+        assert(pt_str_alloc_count() == allocs + 1);
+        pt_str_free(&s);
+        putchar('.');
+}
+
+static void test_append_n(void) {
+        pt_str *s = mk();
+        assert(pt_str_append_n(s, "ab\0cd", 5) == 0);
+        assert(s->len == 5);
+        assert(memcmp(s->data, "ab\0cd", 6) == 0);
+        assert(pt_str_append_n(s, "xyz", 0) == 0);
+        assert(s->len == 5 && s->data[5] == '\0');
+        fk(s);
+        putchar('.');
+}
+
+static void test_reserve_and_shrink(void) {
+        pt_str *s = mk();
+        assert(pt_str_reserve(s, 10) == 0);
+        assert(s->cap == 16 && s->data == s->small);
+        assert(pt_str_reserve(s, 1000) == 0);
+        assert(s->cap == 1001);
+
+        size_t allocs = pt_str_alloc_count();
+        for (int i = 0; i < 1000; i++)
+                pt_str_append_char(s, 'x');
+        assert(pt_str_alloc_count() == allocs);
+
+        while (s->len > 100)
+                pt_str_delete_char(s);
+        pt_str_shrink(s);
+        assert(s->cap == 101);
+        while (s->len > 3)
+                pt_str_delete_char(s);
+        pt_str_shrink(s);
+        assert(s->data == s->small && s->cap == 16);
+        assert(strcmp(s->data, "xxx") == 0);
+        fk(s);
+        putchar('.');
+}
+
+static void test_moved(void) {
+        pt_str *before = calloc(2, sizeof(pt_str));
+        pt_str_init(&before[0]);
+        pt_str_init(&before[1]);
+        pt_str_append(&before[0], "short");
+        pt_str_append(&before[1], "long enough to be on the heap");
+
+        pt_str *after = malloc(2 * sizeof(pt_str));
+        memcpy(after, before, 2 * sizeof(pt_str));
+        free(before);
+        pt_str_moved(&after[0]);
+        pt_str_moved(&after[1]);
+        assert(after[0].data == after[0].small);
+        assert(strcmp(after[0].data, "short") == 0);
+        assert(strcmp(after[1].data, "long enough to be on the heap") == 0);
+        pt_str_append(&after[0], " and now long as well");
+        assert(strcmp(after[0].data, "short and now long as well") == 0);
+        pt_str_free(&after[0]);
+        pt_str_free(&after[1]);
+        free(after);
+        putchar('.');
+}
+
+static void test_view(void) {
+        // Short enough to pass for an inline string if cap were len + 1
+        char text[] = "fifteen bytes!!";
+        pt_str view = pt_str_view(text, 15);
+        assert(view.cap != PT_STR_INLINE);
+        pt_str_moved(&view);
+        assert(view.data == text && view.len == 15);
+        pt_str_free(&view);
+        assert(strcmp(text, "fifteen bytes!!") == 0);
+        putchar('.');
+}
+
+static void test_large_growth(void) {
+        char *piece = malloc(65536);
+        memset(piece, 'y', 65536);
+        pt_str *s = mk();
+        size_t len = 0;
+        while (len < 8 * 1024 * 1024) {
+                pt_str_append_n(s, piece, 65536);
+                len += 65536;
+                if (s->cap > 1024 * 1024) {
+                        // Whole pages, at most a quarter unused
+                        assert(s->cap % 4096 == 0);
+                        assert(s->cap - s->len - 1 <= s->cap / 4 + 65536);
+                }
+        }
+        assert(s->len == len && s->data[len] == '\0');
+        fk(s);
+        free(piece);
+        putchar('.');
+}
+
+static void test_hash_bytes(void) {
+        // Reference values of 64-bit FNV-1a
+        assert(pt_hash_bytes(PT_HASH_SEED, "", 0) == PT_HASH_SEED);
+        assert(pt_hash_bytes(PT_HASH_SEED, "a", 1) == 0xaf63dc4c8601ec8cULL);
+        assert(pt_hash_bytes(PT_HASH_SEED, "foobar", 6) ==
+               0x85944171f73967e8ULL);
+        // Hashing in pieces gives the same result
+        unsigned long long h = pt_hash_bytes(PT_HASH_SEED, "foo", 3);
+        assert(pt_hash_bytes(h, "bar", 3) == 0x85944171f73967e8ULL);
+        putchar('.');
+}
+
+/* A text whose first 15 bytes come in segments of 5 */
+static const char *segmented_at(const pt_text *text, size_t offset,
+                                size_t *start, size_t *seg_len) {
+        *start = offset - offset % 5;
+        *seg_len = 5;
+        return (const char *)text->store + *start;
+}
+
+static void test_text_segments(void) {
+        const char *all = "hello, segmented world";
+        pt_text flat;
+        pt_text_init(&flat, all, strlen(all));
+        pt_text split = flat;
+        split.data = all + 15;
+        split.data_start = 15;
+        split.segment = segmented_at;
+        split.store = (void *)(size_t)all;
+
+        char out[32];
+        for (size_t i = 0; i < flat.len; i++) {
+                assert(pt_text_at(&split, i) == all[i]);
+                memset(out, 0, sizeof(out));
+                assert(pt_text_copy(&split, i, out, 7) ==
+                       (flat.len - i < 7 ? flat.len - i : 7));
+                assert(strncmp(out, all + i, 7) == 0);
+        }
+        assert(pt_text_copy(&split, flat.len, out, 4) == 0);
+        assert(pt_text_hash(&split) == pt_text_hash(&flat));
+        assert(pt_text_hash(&flat) ==
+               pt_hash_bytes(PT_HASH_SEED, all, flat.len));
+        putchar('.');
+}
+
+static void test_map_put_get(void) {
+        pt_map m;
+        assert(pt_map_init(&m) == 0);
+        assert(pt_map_put(&m, "alpha", 1) == 0);
+        assert(pt_map_put(&m, "beta", 2) == 0);
+        size_t v = 0;
+        assert(pt_map_get(&m, "alpha", &v) && v == 1);
+        assert(pt_map_get(&m, "beta", &v) && v == 2);
+        assert(!pt_map_get(&m, "gamma", &v));
+        assert(m.len == 2);
+        pt_map_free(&m);
+        assert(m.keys == NULL);
+        assert(m.len == 0);
+        putchar('.');
+}
+
+static void test_map_overwrite(void) {
+        pt_map m;
+        pt_map_init(&m);
+        pt_map_put(&m, "key", 1);
+        pt_map_put(&m, "key", 7);
+        size_t v = 0;
+        assert(pt_map_get(&m, "key", &v) && v == 7);
+        assert(m.len == 1);
+        pt_map_free(&m);
+        putchar('.');
+}
+
+static void test_map_key_is_copied(void) {
+        pt_map m;
+        pt_map_init(&m);
+        char key[] = "note";
+        pt_map_put(&m, key, 3);
+        key[0] = 'x';
+        assert(pt_map_get(&m, "note", NULL));
+        assert(!pt_map_get(&m, "xote", NULL));
+        pt_map_free(&m);
+        putchar('.');
+}
+
+static void test_map_grow_and_remove(void) {
+        pt_map m;
+        pt_map_init(&m);
+        char key[32];
+        for (size_t i = 0; i < 1000; i++) {
+                snprintf(key, sizeof(key), "k%zu", i);
+                assert(pt_map_put(&m, key, i) == 0);
+        }
+        assert(m.len == 1000);
+        assert(m.cap >= 1000);
+
+        // Remove every other key, the rest must stay reachable
+        for (size_t i = 0; i < 1000; i += 2) {
+                snprintf(key, sizeof(key), "k%zu", i);
+                assert(pt_map_remove(&m, key));
+        }
+        assert(m.len == 500);
+        for (size_t i = 0; i < 1000; i++) {
+                snprintf(key, sizeof(key), "k%zu", i);
+                size_t v = 0;
+                if (i % 2 == 0) {
+                        assert(!pt_map_get(&m, key, &v));
+                } else {
+                        assert(pt_map_get(&m, key, &v) && v == i);
+                }
+        }
+        assert(!pt_map_remove(&m, "k0"));
+        pt_map_free(&m);
+        putchar('.');
+}
+
 int main(void) {
         printf("Running pt_str tests...\n");
         test_new();
@@ -343,9 +857,26 @@ int main(void) {
         test_nul_termination_mid_append();
         test_many_empty_appends();
         test_independence();
+        test_inline();
+        test_append_n();
+        test_reserve_and_shrink();
+        test_moved();
+        test_view();
+        test_large_growth();
+        test_text_segments();
 
         putchar('\n');
         printf("All pt_str tests passed.\n");
+
+        printf("Running pt_map tests...\n");
+        test_hash_bytes();
+        test_map_put_get();
+        test_map_overwrite();
+        test_map_key_is_copied();
+        test_map_grow_and_remove();
+
+        putchar('\n');
+        printf("All pt_map tests passed.\n");
         return 0;
 }
 
@@ -1,11 +1,22 @@
 #ifndef DS_H
 #define DS_H
 
+#include <stdbool.h>
 #include <stddef.h>
+
+// Strings of up to PT_STR_INLINE - 1 bytes need no allocation
+#define PT_STR_INLINE 16
+
+/**
+ * Growable string, always NUL-terminated. A short one is kept in `small`
+ * and `data` points there, so a pt_str that is moved to another address,
+ * e.g. by realloc, must be passed to pt_str_moved before it is used.
+ */
 typedef struct {
         char *data;
         size_t len;
-        size_t cap;
+        size_t cap; // PT_STR_INLINE while `data` is `small`, 0 for a view
+        char small[PT_STR_INLINE];
 } pt_str;
 
 pt_str *pt_str_new(void);
@@ -16,4 +27,78 @@ int pt_str_append(pt_str *s, const char *suffix);
 void pt_str_append_char(pt_str *s, char c);
 void pt_str_delete_char(pt_str *s);
 
+/** Appends `len` bytes, which may include NULs. Returns 0 on success */
+int pt_str_append_n(pt_str *s, const char *data, size_t len);
+
+/** Makes room for `len` bytes of text. Returns 0 on success */
+int pt_str_reserve(pt_str *s, size_t len);
+
+/** Gives back the room that the text does not use */
+void pt_str_shrink(pt_str *s);
+
+/** Fixes `data` of a string that was copied bytewise to where `s` is */
+void pt_str_moved(pt_str *s);
+
+/**
+ * Returns a read-only view of the `len` bytes at `data`, which must be
+ * followed by a NUL. It must not be changed, and freeing it does nothing.
+ */
+pt_str pt_str_view(char *data, size_t len);
+
+#define PT_HASH_SEED 14695981039346656037ULL
+
+/** FNV-1a over `len` bytes, continuing from `hash` (start with the seed) */
+unsigned long long pt_hash_bytes(unsigned long long hash, const char *data,
+                                 size_t len);
+
+/**
+ * Read-only view of a text that need not be contiguous, like a document
+ * whose older part is kept compressed. The bytes from `data_start` on are
+ * at `data`; the ones before it are reached through `segment`.
+ */
+typedef struct pt_text {
+        size_t len;
+        const char *data;
+        size_t data_start;
+        /** Returns the segment holding `offset`, or NULL if it is lost */
+        const char *(*segment)(const struct pt_text *text, size_t offset,
+                               size_t *start, size_t *seg_len);
+        void *store; // for `segment`
+} pt_text;
+
+/** Makes `text` a view of `len` contiguous bytes */
+void pt_text_init(pt_text *text, const char *data, size_t len);
+
+/**
+ * Returns the segment holding `offset`, which must be below `text->len`,
+ * and sets where it starts and how long it is.
+ */
+const char *pt_text_segment(const pt_text *text, size_t offset, size_t *start,
+                            size_t *seg_len);
+
+char pt_text_at(const pt_text *text, size_t offset);
+
+/** Copies up to `n` bytes from `offset` to `out`. Returns how many it did */
+size_t pt_text_copy(const pt_text *text, size_t offset, char *out, size_t n);
+
+/** pt_hash_bytes over the whole text */
+unsigned long long pt_text_hash(const pt_text *text);
+
+/** Number of heap allocations made for pt_str data so far */
+size_t pt_str_alloc_count(void);
+
+/** Hash map from NUL-terminated strings to indices. Keys are copied. */
+typedef struct {
+        char **keys;
+        size_t *values;
+        size_t len;
+        size_t cap;
+} pt_map;
+
+int pt_map_init(pt_map *m);
+void pt_map_free(pt_map *m);
+int pt_map_put(pt_map *m, const char *key, size_t value);
+bool pt_map_get(const pt_map *m, const char *key, size_t *value);
+bool pt_map_remove(pt_map *m, const char *key);
+
 #endif
@@ -1,8 +1,15 @@
 #define _POSIX_C_SOURCE 200112L
 #include "editor.h"
+#include "cache.h"
 #include "ds.h"
+#include "history.h"
+#include "prof.h"
 #include "render.h"
+#include "search.h"
+#include "stats.h"
 #include "term.h"
+#include "trace.h"
+#include "vault.h"
 #include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -10,89 +17,682 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #define INITIAL_CAPACITY 128
 #define PT_MAX_HEADER_SIZE 4
+#define PT_MAX_BACKLINKS 64
+#define PT_DEFAULT_LAYOUT_BUDGET_MB 64
+// Documents from this size on keep their start in the cold store, and
+// their hot tail between PT_HOT_MIN and PT_HOT_MAX bytes
+#define PT_COLD_MIN (4 * 1024 * 1024)
+#define PT_HOT_MIN (256 * 1024)
+#define PT_HOT_MAX (512 * 1024)
+
+static size_t pt_add_buffer(PTState *state, pt_str *filename) {
+        PTBuffer *buffers = realloc(state->buffers, (state->buffer_count + 1) *
+                                                            sizeof(PTBuffer));
+        if (!buffers)
+                pt_die("realloc");
+        state->buffers = buffers;
+
+        PTBuffer *buffer = &state->buffers[state->buffer_count];
+        memset(buffer, 0, sizeof(PTBuffer));
+        buffer->content = pt_str_new();
+        buffer->filename = filename;
+        return state->buffer_count++;
+}
 
 PTState *pt_new_glob_state(pt_str *filename) {
         PTState *state = calloc(1, sizeof(PTState));
 
-        pt_str *content = pt_str_new();
+        // The layout budget can be set in MiB with $PORTA_LAYOUT_BUDGET_MB
+        unsigned long budget_mb = PT_DEFAULT_LAYOUT_BUDGET_MB;
+        const char *budget_env = getenv("PORTA_LAYOUT_BUDGET_MB");
+        if (budget_env && *budget_env)
+                budget_mb = strtoul(budget_env, NULL, 10);
+        state->layout_budget = (size_t)budget_mb * 1024 * 1024;
 
-        state->content = content;
-        state->filename = filename;
+        pt_switch_buffer(state, pt_add_buffer(state, filename));
         state->is_censored = false;
         pt_refresh_terminal_state(state);
 
         return state;
 }
 
+void pt_switch_buffer(PTState *state, size_t index) {
+        if (index >= state->buffer_count)
+                return;
+        state->active = index;
+        state->content = state->buffers[index].content;
+        state->filename = state->buffers[index].filename;
+        state->buffers[index].last_used = ++state->clock;
+}
+
+void pt_open_buffer(PTState *state, pt_str *filename) {
+        for (size_t i = 0; i < state->buffer_count; i++) {
+                if (strcmp(state->buffers[i].filename->data,
+                           filename->data) == 0) {
+                        pt_str_free(filename);
+                        free(filename);
+                        pt_switch_buffer(state, i);
+                        return;
+                }
+        }
+
+        pt_switch_buffer(state, pt_add_buffer(state, filename));
+        if (access(filename->data, F_OK) == 0)
+                pt_load_from_file(state, filename);
+}
+
+void pt_drop_layout(PTBuffer *buffer) {
+        for (int i = 0; i < buffer->line_count; i++) {
+                pt_str_free(&buffer->lines[i]);
+        }
+        free(buffer->lines);
+        buffer->lines = NULL;
+        buffer->line_count = 0;
+        buffer->layout_bytes = 0;
+}
+
+void pt_set_layout(PTState *state, PTBuffer *buffer, pt_str *lines,
+                   int line_count, bool is_censored) {
+        pt_drop_layout(buffer);
+        buffer->lines = lines;
+        buffer->line_count = line_count;
+        buffer->is_layout_censored = is_censored;
+        buffer->layout_bytes = (size_t)line_count * sizeof(pt_str);
+        for (int i = 0; i < line_count; i++) {
+                if (lines[i].cap > PT_STR_INLINE)
+                        buffer->layout_bytes += lines[i].cap;
+        }
+
+        pt_enforce_layout_budget(state);
+}
+
+void pt_enforce_layout_budget(PTState *state) {
+        size_t total = 0;
+        for (size_t i = 0; i < state->buffer_count; i++)
+                total += state->buffers[i].layout_bytes;
+
+        while (total > state->layout_budget) {
+                PTBuffer *oldest = NULL;
+                for (size_t i = 0; i < state->buffer_count; i++) {
+                        PTBuffer *buffer = &state->buffers[i];
+                        if (i == state->active || !buffer->lines)
+                                continue;
+                        if (!oldest || buffer->last_used < oldest->last_used)
+                                oldest = buffer;
+                }
+                if (!oldest)
+                        break;
+                total -= oldest->layout_bytes;
+                pt_drop_layout(oldest);
+        }
+}
+
+void pt_buffer_text(PTBuffer *buffer, pt_text *text) {
+        pt_cold_text(&buffer->cold, buffer->content, text);
+}
+
+static void pt_show_message(const PTState *state, const char *message) {
+        pt_move_cursor(1, 1);
+        pt_puts(message);
+        pt_move_cursor(2, 1);
+        pt_flush_all();
+        if (!state->is_headless)
+                sleep(1);
+}
+
+/**
+ * Moves the start of a long hot tail to the cold store, a block at a time,
+ * until it is no longer than PT_HOT_MAX.
+ */
+static void pt_freeze(PTBuffer *buffer) {
+        pt_str *tail = buffer->content;
+        size_t frozen = 0;
+        while (tail->len - frozen > PT_HOT_MAX) {
+                size_t n = pt_cold_cut(tail->data + frozen, PT_COLD_BLOCK_SIZE);
+                if (pt_cold_push(&buffer->cold, tail->data + frozen, n) != 0)
+                        break;
+                frozen += n;
+        }
+        if (frozen == 0)
+                return;
+        char last = tail->data[frozen - 1];
+        memmove(tail->data, tail->data + frozen, tail->len - frozen + 1);
+        tail->len -= frozen;
+        // Only a single word longer than a block is cut in the middle
+        if (last == '\n' || last == ' ' || last == '\t' || last == '\r')
+                pt_spell_drop_front(&buffer->spell, frozen);
+        else
+                pt_spell_rebuild(&buffer->spell, tail->data, tail->len);
+}
+
+/**
+ * Brings blocks back from the cold store while the hot tail is short.
+ * Returns -1 if a block could not be read back, which then stays cold.
+ */
+static int pt_thaw(PTBuffer *buffer) {
+        pt_str *tail = buffer->content;
+        if (tail->len >= PT_HOT_MIN || buffer->cold.block_count == 0)
+                return 0;
+        char *block = malloc(PT_COLD_BLOCK_SIZE);
+        if (!block)
+                return 0;
+        int rc = 0;
+        while (tail->len < PT_HOT_MIN && buffer->cold.block_count > 0 &&
+               pt_str_reserve(tail, tail->len + PT_COLD_BLOCK_SIZE) == 0) {
+                size_t len = pt_cold_pop(&buffer->cold, block);
+                if (len == 0) {
+                        rc = -1;
+                        break;
+                }
+                memmove(tail->data + len, tail->data, tail->len + 1);
+                memcpy(tail->data, block, len);
+                tail->len += len;
+        }
+        free(block);
+        pt_spell_rebuild(&buffer->spell, tail->data, tail->len);
+        return rc;
+}
+
 void pt_refresh_terminal_state(PTState *state) {
         // Get the rows and columns
         struct winsize w;
-        ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == -1 || w.ws_row == 0) {
+                // Not a terminal: keep the last size, or assume a VT100
+                if (state->rows == 0) {
+                        state->rows = 24;
+                        state->cols = 80;
+                }
+                return;
+        }
         state->rows = w.ws_row;
         state->cols = w.ws_col;
+        pt_trace_set_size(state->rows, state->cols);
 }
 
 static void pt_add_char(PTState *state, char c) {
+        PTBuffer *buffer = &state->buffers[state->active];
+        pt_history_record(&buffer->history, PT_EDIT_TYPE, c, &buffer->cold,
+                          state->content, &buffer->stats);
         pt_str_append_char(state->content, c);
+        pt_stats_add(&buffer->stats, state->content->data,
+                     state->content->len);
+        pt_spell_update(&buffer->spell, state->content->data,
+                        state->content->len);
+        if (state->content->len > PT_HOT_MAX &&
+            (buffer->cold.block_count > 0 || state->content->len >= PT_COLD_MIN))
+                pt_freeze(buffer);
+        pt_drop_layout(buffer);
 }
 
 static void pt_delete_char(PTState *state) {
+        PTBuffer *buffer = &state->buffers[state->active];
+        if (pt_thaw(buffer) != 0 && !buffer->is_cold_lost) {
+                // Said once, as every later deletion tries again
+                buffer->is_cold_lost = true;
+                pt_show_message(state, "Could not read back the start of "
+                                       "the document from memory");
+        }
+        if (state->content->len == 0)
+                return;
+        char removed = state->content->data[state->content->len - 1];
+        pt_history_record(&buffer->history, PT_EDIT_DELETE, removed,
+                          &buffer->cold, state->content, &buffer->stats);
         pt_str_delete_char(state->content);
+        pt_stats_remove(&buffer->stats, removed, state->content->data,
+                        state->content->len);
+        pt_spell_update(&buffer->spell, state->content->data,
+                        state->content->len);
+        pt_drop_layout(buffer);
+}
+
+/** Takes the active buffer back one undo step, or forward one if `is_redo` */
+static void pt_undo(PTState *state, bool is_redo) {
+        PTBuffer *buffer = &state->buffers[state->active];
+        bool is_done = is_redo ? pt_history_redo(&buffer->history,
+                                                 &buffer->cold, state->content,
+                                                 &buffer->stats)
+                               : pt_history_undo(&buffer->history,
+                                                 &buffer->cold, state->content,
+                                                 &buffer->stats);
+        if (!is_done)
+                return;
+        pt_spell_rebuild(&buffer->spell, state->content->data,
+                         state->content->len);
+        pt_drop_layout(buffer);
 }
 
 static char pt_read_key(void) {
+        if (pt_trace_is_replaying())
+                return pt_trace_next_key();
+
         long nread;
         char c;
         while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
                 if (nread == -1 && errno != EAGAIN)
                         pt_die("read");
         }
+        pt_prof_key_read();
+        pt_trace_record(c);
         return c;
 }
 
-void pt_save_to_file(PTState *state, const pt_str *filename) {
-        FILE *file = fopen(filename->data, "w");
-        if (file) {
-                fwrite(state->content->data, 1, state->content->len, file);
-                fclose(file);
-        } else {
-                perror("Failed to open file for writing");
+void pt_reap_cache_writer(PTState *state) {
+        if (state->cache_writer > 0 &&
+            waitpid(state->cache_writer, NULL, WNOHANG) != 0)
+                state->cache_writer = 0;
+}
+
+/**
+ * Rewrites the sidecar cache of the active buffer as the cache of `path`,
+ * which holds its text and is described by `st`. This happens in a child
+ * so that the editor never waits for it.
+ */
+static void pt_write_cache(PTState *state, const char *path,
+                           const struct stat *st) {
+        PTBuffer *buffer = &state->buffers[state->active];
+        if (state->is_headless || buffer->cold.block_count == 0)
+                return;
+
+        // The old sidecar may be for a save within the same second, which
+        // it cannot be told apart from, so it goes first
+        pt_str sidecar;
+        pt_str_init(&sidecar);
+        pt_cache_path(path, &sidecar);
+        remove(sidecar.data);
+        pt_str_free(&sidecar);
+
+        // One writer at a time, so that the last to finish is the newest.
+        // While one is still busy this save goes without a sidecar, as
+        // waiting would stall the editor.
+        pt_reap_cache_writer(state);
+        if (state->cache_writer > 0)
+                return;
+        fflush(stdout);
+        state->cache_writer = fork();
+        if (state->cache_writer != 0)
+                return;
+
+        PTCache cache;
+        memset(&cache, 0, sizeof(cache));
+        pt_cache_describe(&cache, st);
+        cache.cold = buffer->cold;
+        cache.stats = buffer->stats;
+        cache.tail_hash = pt_hash_bytes(PT_HASH_SEED, state->content->data,
+                                        state->content->len);
+        cache.line_count = pt_plain_layout(state->content, &cache.lines);
+        cache.text_width = TEXT_WIDTH;
+        cache.is_formatted = pt_is_kitty();
+        pt_cache_write(path, &cache);
+        _exit(0);
+}
+
+/**
+ * Writes the text of `snap` to `file`, reading its cold blocks through
+ * `cold`. Returns 0 on success, or -1 with `errno` set.
+ */
+static int pt_write_snapshot(PTColdStore *cold, const PTSnapshot *snap,
+                             FILE *file) {
+        size_t count = 0;
+        for (const PTColdBlock *b = snap->cold; b; b = b->prev)
+                count++;
+        size_t cold_len = snap->cold ? snap->cold->start + snap->cold->len : 0;
+        size_t tail_len = snap->len - cold_len;
+        PTColdBlock **blocks = malloc((count ? count : 1) * sizeof(*blocks));
+        char *block = malloc(PT_COLD_BLOCK_SIZE);
+        char *tail = malloc(tail_len + 1);
+        int rc = blocks && block && tail ? 0 : -1;
+
+        // The chain runs from the last block back to the first
+        size_t i = count;
+        for (PTColdBlock *b = snap->cold; rc == 0 && b; b = b->prev)
+                blocks[--i] = b;
+        for (i = 0; rc == 0 && i < count; i++) {
+                size_t len = pt_cold_read(cold, blocks[i], block);
+                if (len == 0) {
+                        errno = EIO;
+                        rc = -1;
+                } else if (fwrite(block, 1, len, file) != len) {
+                        rc = -1;
+                }
+        }
+        if (rc == 0) {
+                pt_snapshot_tail(snap, tail);
+                if (fwrite(tail, 1, tail_len, file) != tail_len)
+                        rc = -1;
+        }
+        free(blocks);
+        free(block);
+        free(tail);
+        return rc;
+}
+
+int pt_save_to_file(PTState *state, const pt_str *filename) {
+        if (state->is_headless)
+                return 0;
+        PTBuffer *buffer = &state->buffers[state->active];
+        PTSnapshot snap;
+        if (pt_history_snapshot(&buffer->history, &buffer->cold,
+                                state->content, &buffer->stats, &snap) != 0)
+                return -1;
+
+        // The text goes to a file next to the document, which replaces it
+        // only once all of it has been written
+        pt_str tmp;
+        pt_str_init(&tmp);
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+        pt_str_append(&tmp, filename->data);
+        pt_str_append(&tmp, suffix);
+
+        FILE *file = fopen(tmp.data, "w");
+        if (!file) {
+                pt_snapshot_release(&snap);
+                pt_str_free(&tmp);
+                return -1;
+        }
+        bool is_ok = pt_write_snapshot(&buffer->cold, &snap, file) == 0;
+        pt_snapshot_release(&snap);
+
+        // Keep the permissions of the file being replaced
+        struct stat st;
+        if (is_ok && stat(filename->data, &st) == 0)
+                is_ok = fchmod(fileno(file), st.st_mode & 07777) == 0;
+        is_ok = fclose(file) == 0 && is_ok;
+        is_ok = is_ok && rename(tmp.data, filename->data) == 0;
+        int err = errno;
+        if (!is_ok)
+                remove(tmp.data);
+        pt_str_free(&tmp);
+        if (!is_ok) {
+                errno = err;
+                return -1;
+        }
+
+        if (stat(filename->data, &st) == 0)
+                pt_write_cache(state, filename->data, &st);
+        return 0;
+}
+
+/**
+ * Opens the document in `file` of `size` bytes from its sidecar cache, if
+ * it has one for the file as it is now: only the hot tail is read.
+ * Returns false if the file has to be read in full.
+ */
+static bool pt_load_from_cache(PTState *state, const pt_str *filename,
+                               FILE *file, size_t size) {
+        PTCache cache;
+        if (!pt_cache_open(filename->data, &cache))
+                return false;
+        size_t tail_len = size - cache.cold.len;
+        char *tail = malloc(tail_len + 1);
+        bool is_ok = tail &&
+                     fseeko(file, (off_t)cache.cold.len, SEEK_SET) == 0 &&
+                     fread(tail, 1, tail_len, file) == tail_len &&
+                     pt_hash_bytes(PT_HASH_SEED, tail, tail_len) ==
+                             cache.tail_hash;
+        if (!is_ok) {
+                free(tail);
+                pt_cache_free(&cache);
+                return false;
         }
+
+        pt_str_free(state->content);
+        pt_str_init(state->content);
+        pt_str_append_n(state->content, tail, tail_len);
+        free(tail);
+
+        PTBuffer *buffer = &state->buffers[state->active];
+        // Snapshots hold cold blocks, which may point into the mapping
+        pt_history_free(&buffer->history);
+        pt_cold_free(&buffer->cold);
+        buffer->cold = cache.cold;
+        buffer->is_cold_lost = false;
+        memset(&cache.cold, 0, sizeof(cache.cold));
+        buffer->stats = cache.stats;
+        pt_spell_rebuild(&buffer->spell, state->content->data,
+                         state->content->len);
+        pt_drop_layout(buffer);
+
+        // The cached layout is what the renderer would build when nothing
+        // is underlined
+        if (cache.lines && cache.text_width == TEXT_WIDTH &&
+            cache.is_formatted == pt_is_kitty() &&
+            buffer->spell.span_count == 0) {
+                pt_set_layout(state, buffer, cache.lines, cache.line_count,
+                              false);
+                cache.lines = NULL;
+                cache.line_count = 0;
+        }
+        pt_cache_free(&cache);
+        return true;
 }
 
 void pt_load_from_file(PTState *state, const pt_str *filename) {
         FILE *file = fopen(filename->data, "r");
-        if (file) {
-                fseek(file, 0, SEEK_END);
-                size_t size = (size_t)ftell(file);
-                fseek(file, 0, SEEK_SET);
-
-                char *file_data = malloc(size + 1);
-                if (fread(file_data, 1, size, file) != size) {
-                        free(file_data);
-                        fclose(file);
-                        return;
-                }
-                file_data[size] = 0;
+        if (!file) {
+                perror("Failed to open file for reading");
+                return;
+        }
+        fseeko(file, 0, SEEK_END);
+        off_t end = ftello(file);
+        size_t size = end > 0 ? (size_t)end : 0;
+        fseeko(file, 0, SEEK_SET);
+        struct stat st;
+        bool has_stat = fstat(fileno(file), &st) == 0;
+
+        if (size >= PT_COLD_MIN &&
+            pt_load_from_cache(state, filename, file, size)) {
                 fclose(file);
+                return;
+        }
+
+        // The start of a huge file goes to the cold store a block at a
+        // time, so that the file is never in memory as it is
+        PTColdStore cold;
+        PTStats stats;
+        memset(&cold, 0, sizeof(cold));
+        memset(&stats, 0, sizeof(stats));
+        size_t cold_len = size >= PT_COLD_MIN ? size - PT_HOT_MIN : 0;
+        char *chunk = malloc(PT_COLD_BLOCK_SIZE);
+        size_t pending = 0; // read into `chunk` but not stored yet
+        size_t done = 0;
+        char last = '\0';
+        bool is_ok = chunk != NULL;
+        while (is_ok && done < cold_len) {
+                size_t want = PT_COLD_BLOCK_SIZE - pending;
+                if (want > cold_len - done)
+                        want = cold_len - done;
+                is_ok = fread(chunk + pending, 1, want, file) == want;
+                done += want;
+                pending += want;
 
-                // TODO: this is not great
-                pt_str_free(state->content);
-                pt_str_init(state->content);
-                pt_str_append(state->content, file_data);
+                // Cut at a line, so the hot tail starts on one
+                size_t n = pt_cold_cut(chunk, pending);
+                is_ok = is_ok && pt_cold_push(&cold, chunk, n) == 0;
+                pt_stats_extend(&stats, cold.len > n ? &last : NULL, chunk,
+                                n);
+                last = chunk[n - 1];
+                memmove(chunk, chunk + n, pending - n);
+                pending -= n;
+        }
 
+        char *file_data = is_ok ? malloc(pending + size - done + 1) : NULL;
+        if (file_data) {
+                memcpy(file_data, chunk, pending);
+                is_ok = fread(file_data + pending, 1, size - done, file) ==
+                        size - done;
+                file_data[pending + size - done] = 0;
+        }
+        free(chunk);
+        fclose(file);
+        if (!file_data || !is_ok) {
                 free(file_data);
+                pt_cold_free(&cold);
+                return;
+        }
+
+        // TODO: this is not great
+        pt_str_free(state->content);
+        pt_str_init(state->content);
+        pt_str_append(state->content, file_data);
+        free(file_data);
+
+        PTBuffer *buffer = &state->buffers[state->active];
+        // The old history shares blocks with the old store, so it goes first
+        pt_history_free(&buffer->history);
+        pt_cold_free(&buffer->cold);
+        buffer->cold = cold;
+        buffer->is_cold_lost = false;
+        pt_stats_extend(&stats, cold.len > 0 ? &last : NULL,
+                        state->content->data, state->content->len);
+        buffer->stats = stats;
+        pt_spell_rebuild(&buffer->spell, state->content->data,
+                         state->content->len);
+        pt_drop_layout(buffer);
+
+        // Next time the file opens from the cache
+        if (has_stat)
+                pt_write_cache(state, filename->data, &st);
+}
+
+/** Tells why the last save failed, from `errno` */
+static void pt_show_save_error(const PTState *state) {
+        pt_str *message = pt_str_from("Could not save ");
+        pt_str_append(message, state->filename->data);
+        pt_str_append(message, ": ");
+        pt_str_append(message, strerror(errno));
+        pt_show_message(state, message->data);
+        pt_str_free(message);
+        free(message);
+}
+
+void pt_open_vault(PTState *state) {
+        state->vault = pt_vault_find(state->filename->data);
+}
+
+/**
+ * Saves the current note and opens the target of the last wikilink in it
+ * in its own buffer. Targets that do not exist yet become a new note in
+ * the vault root.
+ */
+static void pt_follow_link(PTState *state) {
+        pt_str target;
+        pt_str_init(&target);
+        if (!state->vault || !pt_vault_last_link(state->content, &target)) {
+                pt_show_message(state, "No link to follow");
+                pt_str_free(&target);
+                return;
+        }
+
+        if (pt_save_to_file(state, state->filename) != 0) {
+                pt_show_save_error(state);
+                pt_str_free(&target);
+                return;
+        }
+        const char *rel =
+                pt_vault_relative(state->vault, state->filename->data);
+        if (rel)
+                pt_vault_update(state->vault, rel);
+        pt_vault_poll(state->vault);
+
+        pt_str *path = pt_str_from(state->vault->root.data);
+        pt_str_append_char(path, '/');
+        const char *resolved = pt_vault_resolve(state->vault, target.data);
+        if (resolved) {
+                pt_str_append(path, resolved);
         } else {
-                perror("Failed to open file for reading");
+                char *heading = strchr(target.data, '#');
+                if (heading)
+                        *heading = '\0';
+                pt_str_append(path, target.data);
+                pt_str_append(path, ".md");
+        }
+        pt_str_free(&target);
+
+        pt_open_buffer(state, path);
+}
+
+static void pt_show_backlinks(PTState *state) {
+        const char *rel =
+                state->vault
+                        ? pt_vault_relative(state->vault, state->filename->data)
+                        : NULL;
+        if (!rel) {
+                pt_show_message(state, "Not in a vault");
+                return;
+        }
+        pt_vault_poll(state->vault);
+
+        const char *sources[PT_MAX_BACKLINKS];
+        size_t max = state->rows > 4 ? (size_t)state->rows - 4 : 1;
+        if (max > PT_MAX_BACKLINKS)
+                max = PT_MAX_BACKLINKS;
+        size_t count = pt_vault_backlinks(state->vault, rel, sources, max);
+
+        pt_clear_screen();
+        pt_move_cursor(1, 1);
+        pt_puts("Backlinks to ");
+        pt_puts(rel);
+        pt_puts(":");
+        for (size_t i = 0; i < count; i++) {
+                pt_move_cursor((unsigned short)(i + 3), 3);
+                pt_puts(sources[i]);
+        }
+        if (count == 0) {
+                pt_move_cursor(3, 3);
+                pt_puts("(none)");
+        }
+        pt_flush_all();
+        pt_read_key();
+}
+
+bool pt_count_matches(PTState *state, size_t budget) {
+        pt_text text;
+        pt_buffer_text(&state->buffers[state->active], &text);
+        return pt_search_count(&state->search, &text, budget);
+}
+
+/** While searching, keys edit the query instead of the document */
+static void pt_handle_search_key(PTState *state, char c) {
+        PTSearch *search = &state->search;
+        pt_text text;
+        pt_buffer_text(&state->buffers[state->active], &text);
+        switch (c) {
+        case '\r':
+        case '\x1b':
+        case CTRL_KEY('f'):
+                search->is_active = false;
+                pt_search_clear(search);
+                break;
+        case '\x7f':
+                pt_search_pop(search, &text);
+                break;
+        case CTRL_KEY('q'):
+                exit(0);
+                break;
+        default:
+                if ((unsigned char)c >= ' ')
+                        pt_search_push(search, c, &text);
+                break;
         }
 }
 
 void pt_handle_key_press(PTState *state) {
-        char c = pt_read_key();
+        pt_process_key(state, pt_read_key());
+}
+
+void pt_process_key(PTState *state, char c) {
+        if (state->search.is_active) {
+                pt_handle_search_key(state, c);
+                return;
+        }
+
         switch (c) {
         case '\r': // Enter key
                 pt_add_char(state, '\n');
@@ -104,17 +704,56 @@ void pt_handle_key_press(PTState *state) {
                 exit(0);
                 break;
         case CTRL_KEY('s'): // Ctrl-S
-                pt_save_to_file(state, state->filename);
+        {
+                if (pt_save_to_file(state, state->filename) != 0) {
+                        pt_show_save_error(state);
+                        break;
+                }
+                const char *rel = state->vault ? pt_vault_relative(
+                                                         state->vault,
+                                                         state->filename->data)
+                                               : NULL;
+                if (rel)
+                        pt_vault_update(state->vault, rel);
 
-                pt_move_cursor(1, 1);
-                printf("Saved to %s", state->filename->data);
-                pt_move_cursor(2, 1);
-                fflush(stdout);
-                sleep(1);
+                pt_str *message = pt_str_from("Saved to ");
+                pt_str_append(message, state->filename->data);
+                pt_show_message(state, message->data);
+                pt_str_free(message);
+                free(message);
                 break;
+        }
         case CTRL_KEY('c'):
                 state->is_censored = !state->is_censored;
                 break;
+        case CTRL_KEY('g'): // Ctrl-G
+                pt_follow_link(state);
+                break;
+        case CTRL_KEY('b'): // Ctrl-B
+                pt_show_backlinks(state);
+                break;
+        case CTRL_KEY('t'): // Ctrl-T
+                pt_prof_toggle_overlay();
+                break;
+        case CTRL_KEY('f'): // Ctrl-F
+                pt_search_clear(&state->search);
+                state->search.is_active = true;
+                break;
+        case CTRL_KEY('z'): // Ctrl-Z
+                pt_undo(state, false);
+                break;
+        case CTRL_KEY('y'): // Ctrl-Y
+                pt_undo(state, true);
+                break;
+        case CTRL_KEY('n'): // Ctrl-N
+                pt_switch_buffer(state,
+                                 (state->active + 1) % state->buffer_count);
+                break;
+        case CTRL_KEY('p'): // Ctrl-P
+                pt_switch_buffer(state,
+                                 (state->active + state->buffer_count - 1) %
+                                         state->buffer_count);
+                break;
         default:
                 pt_add_char(state, c);
                 break;
@@ -143,6 +782,10 @@ void pt_splash_screen(PTState *state) {
       	"    ║                      ║    \r\n",
       	"    ║  ctrl + c to censor  ║    \r\n",
       	"    ║                      ║    \r\n",
+      	"    ║  ctrl + g go to link ║    \r\n",
+      	"    ║                      ║    \r\n",
+      	"    ║  ctrl + b backlinks  ║    \r\n",
+      	"    ║                      ║    \r\n",
       	"    ╚══════════════════════╝    \r\n",
       	"                                \r\n",
       	"                                \r\n"};
@@ -157,11 +800,13 @@ void pt_splash_screen(PTState *state) {
         unsigned short col = (unsigned short)((state->cols - len) / 2);
         for (unsigned short i = 0; i < lines_size; i++) {
                 pt_move_cursor(middle_row + i, col);
-                printf("%s", lines[i]);
+                pt_puts(lines[i]);
         }
         pt_move_cursor(2, 1);
-        fflush(stdout);
-        // Wait for a key press
+        pt_flush();
+        // Wait for a key press, with the splash fully written
+        while (!pt_wait_for_input(false))
+                ;
         pt_handle_key_press(state);
 }
 
@@ -1,16 +1,53 @@
 #ifndef PT_EDITOR_H
 #define PT_EDITOR_H
+#include "cold.h"
 #include "ds.h"
+#include "history.h"
+#include "search.h"
+#include "spell.h"
+#include "stats.h"
+#include "vault.h"
 #include <stdbool.h>
+#include <sys/types.h>
 
 #define CTRL_KEY(k) ((k) & 0x1F)
 
 typedef struct {
-        unsigned short rows;
-        unsigned short cols;
+        // Huge documents keep all but their last few hundred KiB compressed
+        // in `cold`; `content` is the rest, where editing happens
+        PTColdStore cold;
         pt_str *content;
         pt_str *filename;
+        PTStats stats;
+        PTSpell spell;
+        PTHistory history;
+        bool is_cold_lost; // a cold block could not be read back
+
+        // Wrapped lines derived from `content` by the renderer. They can be
+        // dropped at any time and are rebuilt on the next render.
+        pt_str *lines;
+        int line_count;
+        bool is_layout_censored;
+        size_t layout_bytes;
+        unsigned long last_used;
+} PTBuffer;
+
+typedef struct {
+        unsigned short rows;
+        unsigned short cols;
+        pt_str *content;  // of the active buffer, its hot tail
+        pt_str *filename; // of the active buffer
         bool is_censored;
+        bool is_headless; // replaying: no saving, no pauses
+        PTVault *vault;
+        PTSearch search;
+
+        PTBuffer *buffers;
+        size_t buffer_count;
+        size_t active;
+        size_t layout_budget; // bytes all cached layouts may use together
+        unsigned long clock;
+        pid_t cache_writer; // writing a sidecar cache, 0 if none
 } PTState;
 
 PTState *pt_new_glob_state(pt_str *filename);
@@ -18,9 +55,54 @@ void pt_refresh_terminal_state(PTState *state);
 
 void pt_handle_key_press(PTState *state);
 
+/** Collects the sidecar cache writer if it is done, without waiting */
+void pt_reap_cache_writer(PTState *state);
+
+/**
+ * Counts the search matches in up to `budget` more bytes of the active
+ * buffer. Returns true once all of them are counted.
+ */
+bool pt_count_matches(PTState *state, size_t budget);
+
+/** Applies one key as if it had been typed */
+void pt_process_key(PTState *state, char c);
+
 void pt_splash_screen(PTState *state);
 
-void pt_save_to_file(PTState *state, const pt_str *filename);
+/**
+ * Writes the active buffer to `filename`, replacing the file only once all
+ * of the text is written. Returns 0 on success, or -1 with `errno` set.
+ */
+int pt_save_to_file(PTState *state, const pt_str *filename);
 void pt_load_from_file(PTState *state, const pt_str *filename);
 
+/**
+ * Opens `filename` in a new buffer, or switches to it if it is already
+ * open, and makes it the active buffer. Takes ownership of `filename`.
+ */
+void pt_open_buffer(PTState *state, pt_str *filename);
+void pt_switch_buffer(PTState *state, size_t index);
+
+/** Makes `text` a view of the whole document of `buffer` */
+void pt_buffer_text(PTBuffer *buffer, pt_text *text);
+
+/**
+ * Makes `lines` the layout of `buffer`, taking ownership of them, then makes
+ * room for it within the layout budget.
+ */
+void pt_set_layout(PTState *state, PTBuffer *buffer, pt_str *lines,
+                   int line_count, bool is_censored);
+
+/** Frees the derived layout of `buffer`, keeping its text */
+void pt_drop_layout(PTBuffer *buffer);
+
+/**
+ * Drops the layouts of the least recently used buffers until all layouts
+ * fit in the budget. The active buffer's layout is never dropped.
+ */
+void pt_enforce_layout_budget(PTState *state);
+
+/** Opens the vault of the current file, if it is in one */
+void pt_open_vault(PTState *state);
+
 #endif
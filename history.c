@@ -0,0 +1,588 @@
+#define _POSIX_C_SOURCE 200112L
+#include "history.h"
+#include "cold.h"
+#include "ds.h"
+#include "stats.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The chunks start over from the hot tail when the cold store has grown
+// this far past where they begin
+#define PT_CHUNK_MAX_BEHIND (512 * 1024)
+// Chunks are merged once this many are in a chain, but only those no
+// snapshot holds and no larger than PT_CHUNK_MERGE_MAX, so that merging
+// never copies the hot tail again
+#define PT_CHUNK_MAX_DEPTH 64
+#define PT_CHUNK_MERGE_MAX (64 * 1024)
+// Room left in a new chunk for the text typed before the next snapshot
+#define PT_CHUNK_ROOM 4096
+
+static bool pt_is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\n';
+}
+
+/** A chunk holding `len` bytes at `start`, after the text of `prev` */
+static PTChunk *pt_chunk_new(PTChunk *prev, size_t start, const char *data,
+                             size_t len) {
+        PTChunk *chunk = malloc(sizeof(PTChunk) + len + PT_CHUNK_ROOM);
+        if (!chunk)
+                return NULL;
+        if (prev)
+                prev->refs++;
+        chunk->refs = 1;
+        chunk->prev = prev;
+        chunk->start = start;
+        chunk->len = len;
+        chunk->cap = len + PT_CHUNK_ROOM;
+        chunk->base = prev ? prev->base : start;
+        chunk->depth = prev ? prev->depth + 1 : 1;
+        memcpy(chunk->data, data, len);
+        return chunk;
+}
+
+static void pt_chunk_release(PTChunk *chunk) {
+        while (chunk && --chunk->refs == 0) {
+                PTChunk *prev = chunk->prev;
+                free(chunk);
+                chunk = prev;
+        }
+}
+
+/**
+ * Merges the chunks below `above` that only the chunk above each holds into
+ * one, if there are several. Returns the chunk below them.
+ */
+static PTChunk *pt_chunk_merge(PTChunk *above) {
+        size_t count = 0;
+        size_t from = above->start;
+        PTChunk *below = above->prev;
+        while (below && below->refs == 1 && below->len <= PT_CHUNK_MERGE_MAX) {
+                if (below->start < from)
+                        from = below->start;
+                count++;
+                below = below->prev;
+        }
+        if (count < 2)
+                return above->prev;
+
+        size_t len = above->start - from;
+        PTChunk *merged = malloc(sizeof(PTChunk) + len);
+        if (!merged)
+                return below;
+        merged->refs = 1;
+        merged->prev = below; // the reference of the last chunk merged
+        merged->start = from;
+        merged->len = len;
+        merged->cap = len;
+        merged->base = above->prev->base;
+        merged->depth = 0;
+
+        // Each byte comes from the latest chunk that has it, as when reading
+        // a snapshot, so text deleted since is left out
+        size_t to = above->start;
+        PTChunk *chunk = above->prev;
+        while (chunk != below) {
+                PTChunk *prev = chunk->prev;
+                if (chunk->start < to) {
+                        memcpy(merged->data + (chunk->start - from),
+                               chunk->data, to - chunk->start);
+                        to = chunk->start;
+                }
+                free(chunk);
+                chunk = prev;
+        }
+        above->prev = merged;
+        return below;
+}
+
+/**
+ * Makes the chain of the head shorter by merging what no snapshot reads on
+ * its own. What the snapshots hold is kept, so the chain may stay deep; it
+ * is then merged again once it is twice as deep.
+ */
+static void pt_history_compact(PTHistory *history) {
+        for (PTChunk *above = history->head; above && above->prev;)
+                above = pt_chunk_merge(above);
+
+        size_t depth = 0;
+        for (PTChunk *chunk = history->head; chunk; chunk = chunk->prev)
+                depth++;
+        history->compact_depth = depth * 2 > PT_CHUNK_MAX_DEPTH
+                                         ? depth * 2
+                                         : PT_CHUNK_MAX_DEPTH;
+        for (PTChunk *chunk = history->head; chunk; chunk = chunk->prev)
+                chunk->depth = depth--;
+}
+
+/** Copies the text written since the last snapshot to the chunks */
+static int pt_history_write(PTHistory *history, const PTColdStore *cold,
+                            const pt_str *tail) {
+        PTChunk *head = history->head;
+        size_t len = cold->len + tail->len;
+        if (!head || cold->len < head->base ||
+            cold->len - head->base > PT_CHUNK_MAX_BEHIND ||
+            history->written < cold->len) {
+                // Start over with a copy of the hot tail
+                PTChunk *fresh =
+                        pt_chunk_new(NULL, cold->len, tail->data, tail->len);
+                if (!fresh)
+                        return -1;
+                pt_chunk_release(head);
+                history->head = fresh;
+                history->written = len;
+                history->compact_depth = PT_CHUNK_MAX_DEPTH;
+                return 0;
+        }
+
+        size_t n = len - history->written;
+        if (n == 0)
+                return 0;
+        const char *data = tail->data + (history->written - cold->len);
+        if (head->start + head->len == history->written &&
+            head->cap - head->len >= n) {
+                // No snapshot reads past `written`, so this is not shared
+                memcpy(head->data + head->len, data, n);
+                head->len += n;
+        } else {
+                // Snapshots may still read what was deleted after `written`
+                PTChunk *next = pt_chunk_new(head, history->written, data, n);
+                if (!next)
+                        return -1;
+                pt_chunk_release(head);
+                history->head = next;
+                if (next->depth >= history->compact_depth)
+                        pt_history_compact(history);
+        }
+        history->written = len;
+        return 0;
+}
+
+int pt_history_snapshot(PTHistory *history, PTColdStore *cold,
+                        const pt_str *tail, const PTStats *stats,
+                        PTSnapshot *snap) {
+        if (pt_history_write(history, cold, tail) != 0)
+                return -1;
+        snap->cold = pt_cold_share(cold);
+        snap->tail = history->head;
+        snap->tail->refs++;
+        snap->len = cold->len + tail->len;
+        snap->stats = *stats;
+        return 0;
+}
+
+void pt_snapshot_release(PTSnapshot *snap) {
+        pt_cold_release(snap->cold);
+        pt_chunk_release(snap->tail);
+        snap->cold = NULL;
+        snap->tail = NULL;
+}
+
+void pt_snapshot_tail(const PTSnapshot *snap, char *out) {
+        size_t from = snap->cold ? snap->cold->start + snap->cold->len : 0;
+        size_t to = snap->len;
+        for (const PTChunk *chunk = snap->tail; to > from;
+             chunk = chunk->prev) {
+                // Chunks that begin later hold text deleted before `snap`
+                if (chunk->start >= to)
+                        continue;
+                size_t start = chunk->start > from ? chunk->start : from;
+                memcpy(out + (start - from),
+                       chunk->data + (start - chunk->start), to - start);
+                to = start;
+        }
+}
+
+/** Makes the document what it was at `snap` */
+static int pt_history_restore(PTHistory *history, const PTSnapshot *snap,
+                              PTColdStore *cold, pt_str *tail,
+                              PTStats *stats) {
+        size_t start = snap->cold ? snap->cold->start + snap->cold->len : 0;
+        if (pt_str_reserve(tail, snap->len - start) != 0)
+                return -1;
+        if (snap->cold)
+                snap->cold->refs++;
+        if (pt_cold_restore(cold, snap->cold) != 0) {
+                pt_cold_release(snap->cold);
+                return -1;
+        }
+        pt_snapshot_tail(snap, tail->data);
+        tail->len = snap->len - start;
+        tail->data[tail->len] = '\0';
+        *stats = snap->stats;
+
+        // Writing goes on from the chunks of the snapshot
+        snap->tail->refs++;
+        pt_chunk_release(history->head);
+        history->head = snap->tail;
+        history->written = snap->len;
+        return 0;
+}
+
+/** Adds `snap` to the end of `list`, dropping the oldest one if it is full */
+static int pt_snapshot_push(PTSnapshotList *list, const PTSnapshot *snap) {
+        if (list->count == PT_HISTORY_DEPTH) {
+                pt_snapshot_release(&list->items[0]);
+                memmove(list->items, list->items + 1,
+                        (list->count - 1) * sizeof(PTSnapshot));
+                list->count--;
+        }
+        if (list->count == list->cap) {
+                size_t new_cap = list->cap ? list->cap * 2 : 16;
+                PTSnapshot *items =
+                        realloc(list->items, new_cap * sizeof(PTSnapshot));
+                if (!items)
+                        return -1;
+                list->items = items;
+                list->cap = new_cap;
+        }
+        list->items[list->count++] = *snap;
+        return 0;
+}
+
+static void pt_snapshot_clear(PTSnapshotList *list) {
+        while (list->count > 0)
+                pt_snapshot_release(&list->items[--list->count]);
+}
+
+void pt_history_record(PTHistory *history, PTEditKind kind, char c,
+                       PTColdStore *cold, const pt_str *tail,
+                       const PTStats *stats) {
+        bool is_new_word = kind == PT_EDIT_TYPE &&
+                           pt_is_space(history->last_char) && !pt_is_space(c);
+        if (kind != history->last_edit || is_new_word) {
+                PTSnapshot snap;
+                if (pt_history_snapshot(history, cold, tail, stats, &snap) ==
+                            0 &&
+                    pt_snapshot_push(&history->undo, &snap) != 0)
+                        pt_snapshot_release(&snap);
+        }
+        pt_snapshot_clear(&history->redo);
+        history->last_edit = kind;
+        history->last_char = c;
+
+        // What is deleted is no longer in the chunks as far as new snapshots
+        // are concerned
+        size_t len = cold->len + tail->len;
+        if (kind == PT_EDIT_DELETE && len > 0 && history->written >= len)
+                history->written = len - 1;
+}
+
+/** Moves the document to the last snapshot of `from`, saving it in `to` */
+static bool pt_history_step(PTHistory *history, PTSnapshotList *from,
+                            PTSnapshotList *to, PTColdStore *cold,
+                            pt_str *tail, PTStats *stats) {
+        if (from->count == 0)
+                return false;
+        PTSnapshot now;
+        if (pt_history_snapshot(history, cold, tail, stats, &now) != 0)
+                return false;
+        if (pt_snapshot_push(to, &now) != 0) {
+                pt_snapshot_release(&now);
+                return false;
+        }
+        if (pt_history_restore(history, &from->items[from->count - 1], cold,
+                               tail, stats) != 0) {
+                pt_snapshot_release(&to->items[--to->count]);
+                return false;
+        }
+        pt_snapshot_release(&from->items[--from->count]);
+        // The next edit is a step of its own
+        history->last_edit = PT_EDIT_NONE;
+        return true;
+}
+
+bool pt_history_undo(PTHistory *history, PTColdStore *cold, pt_str *tail,
+                     PTStats *stats) {
+        return pt_history_step(history, &history->undo, &history->redo, cold,
+                               tail, stats);
+}
+
+bool pt_history_redo(PTHistory *history, PTColdStore *cold, pt_str *tail,
+                     PTStats *stats) {
+        return pt_history_step(history, &history->redo, &history->undo, cold,
+                               tail, stats);
+}
+
+void pt_history_free(PTHistory *history) {
+        pt_snapshot_clear(&history->undo);
+        pt_snapshot_clear(&history->redo);
+        free(history->undo.items);
+        free(history->redo.items);
+        pt_chunk_release(history->head);
+        memset(history, 0, sizeof(PTHistory));
+}
+
+#ifdef PT_TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+typedef struct {
+        PTHistory history;
+        PTColdStore cold;
+        pt_str tail;
+        PTStats stats;
+} TestDoc;
+
+static void test_doc_init(TestDoc *doc) {
+        memset(doc, 0, sizeof(TestDoc));
+        pt_str_init(&doc->tail);
+}
+
+static void test_doc_free(TestDoc *doc) {
+        pt_history_free(&doc->history);
+        pt_cold_free(&doc->cold);
+        pt_str_free(&doc->tail);
+}
+
+static void test_type(TestDoc *doc, const char *text) {
+        for (; *text; text++) {
+                pt_history_record(&doc->history, PT_EDIT_TYPE, *text,
+                                  &doc->cold, &doc->tail, &doc->stats);
+                pt_str_append_char(&doc->tail, *text);
+                pt_stats_add(&doc->stats, doc->tail.data, doc->tail.len);
+        }
+}
+
+static void test_delete(TestDoc *doc, size_t n) {
+        for (; n > 0; n--) {
+                char removed = doc->tail.data[doc->tail.len - 1];
+                pt_history_record(&doc->history, PT_EDIT_DELETE, removed,
+                                  &doc->cold, &doc->tail, &doc->stats);
+                pt_str_delete_char(&doc->tail);
+                pt_stats_remove(&doc->stats, removed, doc->tail.data,
+                                doc->tail.len);
+        }
+}
+
+static bool test_undo(TestDoc *doc) {
+        return pt_history_undo(&doc->history, &doc->cold, &doc->tail,
+                               &doc->stats);
+}
+
+static bool test_redo(TestDoc *doc) {
+        return pt_history_redo(&doc->history, &doc->cold, &doc->tail,
+                               &doc->stats);
+}
+
+/** Checks the whole document and its stats against `expected` */
+static void assert_doc(TestDoc *doc, const char *expected) {
+        size_t len = strlen(expected);
+        pt_text text;
+        pt_cold_text(&doc->cold, &doc->tail, &text);
+        assert(text.len == len);
+        char *out = malloc(len + 1);
+        assert(pt_text_copy(&text, 0, out, len) == len);
+        assert(memcmp(out, expected, len) == 0);
+        free(out);
+
+        PTStats fresh;
+        pt_stats_rebuild(&fresh, expected, len);
+        assert(memcmp(&fresh, &doc->stats, sizeof(PTStats)) == 0);
+}
+
+static void test_undo_redo(void) {
+        TestDoc doc;
+        test_doc_init(&doc);
+        assert(!test_undo(&doc));
+
+        // A word and the space after it are one step
+        test_type(&doc, "one two three");
+        test_delete(&doc, 2);
+        assert_doc(&doc, "one two thr");
+        assert(test_undo(&doc));
+        assert_doc(&doc, "one two three");
+        assert(test_undo(&doc));
+        assert_doc(&doc, "one two ");
+        assert(test_undo(&doc));
+        assert_doc(&doc, "one ");
+
+        assert(test_redo(&doc));
+        assert_doc(&doc, "one two ");
+        assert(test_redo(&doc));
+        assert(test_redo(&doc));
+        assert_doc(&doc, "one two thr");
+        assert(!test_redo(&doc));
+
+        // Editing after undoing forgets what could be redone
+        assert(test_undo(&doc));
+        test_type(&doc, "ee!");
+        assert(!test_redo(&doc));
+        assert_doc(&doc, "one two threeee!");
+        assert(test_undo(&doc));
+        assert_doc(&doc, "one two three");
+        while (test_undo(&doc))
+                ;
+        assert_doc(&doc, "");
+        test_doc_free(&doc);
+        putchar('.');
+}
+
+static void test_retype(void) {
+        TestDoc doc;
+        test_doc_init(&doc);
+
+        // Text typed over deleted text does not change older snapshots
+        test_type(&doc, "alpha beta");
+        PTSnapshot before;
+        assert(pt_history_snapshot(&doc.history, &doc.cold, &doc.tail,
+                                   &doc.stats, &before) == 0);
+        test_delete(&doc, 4);
+        test_type(&doc, "gamma");
+        PTSnapshot after;
+        assert(pt_history_snapshot(&doc.history, &doc.cold, &doc.tail,
+                                   &doc.stats, &after) == 0);
+        assert(after.tail != before.tail);
+
+        char out[32];
+        pt_snapshot_tail(&before, out);
+        assert(memcmp(out, "alpha beta", 10) == 0);
+        pt_snapshot_tail(&after, out);
+        assert(memcmp(out, "alpha gamma", 11) == 0);
+
+        // Without deletes, snapshots write to the same chunk
+        test_type(&doc, " delta");
+        PTSnapshot more;
+        assert(pt_history_snapshot(&doc.history, &doc.cold, &doc.tail,
+                                   &doc.stats, &more) == 0);
+        assert(more.tail == after.tail);
+        pt_snapshot_tail(&after, out);
+        assert(memcmp(out, "alpha gamma", 11) == 0);
+
+        pt_snapshot_release(&before);
+        pt_snapshot_release(&after);
+        pt_snapshot_release(&more);
+        test_doc_free(&doc);
+        putchar('.');
+}
+
+static void test_cold_shared(void) {
+        TestDoc doc;
+        test_doc_init(&doc);
+        size_t len = 3 * PT_COLD_BLOCK_SIZE;
+        char *text = malloc(len + 4);
+        for (size_t i = 0; i < len; i++)
+                text[i] = i % 61 == 60 ? '\n' : (char)('a' + i % 26);
+        text[len] = '\0';
+        for (size_t i = 0; i < 2; i++)
+                assert(pt_cold_push(&doc.cold, text + i * PT_COLD_BLOCK_SIZE,
+                                    PT_COLD_BLOCK_SIZE) == 0);
+        pt_str_append(&doc.tail, text + 2 * PT_COLD_BLOCK_SIZE);
+        pt_stats_rebuild(&doc.stats, text, len);
+        test_type(&doc, "end");
+
+        // Thaw the last block as the editor does, then delete through it:
+        // the block is kept by the snapshot alone
+        PTColdBlock *top = doc.cold.blocks[1];
+        char *block = malloc(PT_COLD_BLOCK_SIZE);
+        size_t n = pt_cold_pop(&doc.cold, block);
+        assert(n == PT_COLD_BLOCK_SIZE && top->refs == 1);
+        pt_str thawed;
+        pt_str_init(&thawed);
+        pt_str_append_n(&thawed, block, n);
+        pt_str_append_n(&thawed, doc.tail.data, doc.tail.len);
+        pt_str_free(&doc.tail);
+        doc.tail = thawed;
+        pt_str_moved(&doc.tail);
+        test_delete(&doc, PT_COLD_BLOCK_SIZE + 3);
+
+        assert(test_undo(&doc));
+        assert(doc.cold.block_count == 1);
+        strcpy(text + len, "end");
+        assert_doc(&doc, text);
+        assert(test_undo(&doc));
+        assert(doc.cold.block_count == 2 && doc.cold.blocks[1] == top);
+        text[len] = '\0';
+        assert_doc(&doc, text);
+        assert(test_redo(&doc));
+        assert(test_redo(&doc));
+        text[2 * PT_COLD_BLOCK_SIZE] = '\0';
+        assert_doc(&doc, text);
+
+        free(block);
+        free(text);
+        test_doc_free(&doc);
+        putchar('.');
+}
+
+static void test_depth(void) {
+        TestDoc doc;
+        test_doc_init(&doc);
+        for (int i = 0; i < PT_HISTORY_DEPTH + 10; i++)
+                test_type(&doc, "w ");
+        assert(doc.history.undo.count == PT_HISTORY_DEPTH);
+        size_t undone = 0;
+        while (test_undo(&doc))
+                undone++;
+        assert(undone == PT_HISTORY_DEPTH);
+        assert(doc.tail.len == 2 * 10);
+        test_doc_free(&doc);
+        putchar('.');
+}
+
+static void test_corrections(void) {
+        TestDoc doc;
+        test_doc_init(&doc);
+        size_t len = 1024 * 1024;
+        char *text = malloc(len + 1);
+        for (size_t i = 0; i < len; i++)
+                text[i] = i % 8 == 7 ? ' ' : 'x';
+        text[len] = '\0';
+        pt_str_append(&doc.tail, text);
+        pt_stats_rebuild(&doc.stats, text, len);
+        test_type(&doc, "a");
+        PTChunk *bottom = doc.history.head;
+
+        // Every correction starts a chunk, but merging keeps the chain
+        // short without copying the text under it again
+        for (int i = 0; i < 2000; i++) {
+                test_delete(&doc, 1);
+                test_type(&doc, "b");
+        }
+        size_t depth = 0;
+        size_t bytes = 0;
+        const PTChunk *last = NULL;
+        for (const PTChunk *c = doc.history.head; c; c = c->prev) {
+                depth++;
+                bytes += c->len;
+                last = c;
+        }
+        assert(last == bottom);
+        assert(depth <= 4 * PT_HISTORY_DEPTH);
+        assert(bytes < len + 64 * 1024);
+
+        // Snapshots still read what they did
+        char *expected = malloc(len + 2);
+        memcpy(expected, text, len);
+        expected[len] = 'b';
+        expected[len + 1] = '\0';
+        assert_doc(&doc, expected);
+        assert(test_undo(&doc));
+        expected[len] = '\0';
+        assert_doc(&doc, expected);
+        for (int i = 0; i < 21; i++)
+                assert(test_undo(&doc));
+        expected[len] = 'b';
+        assert_doc(&doc, expected);
+        free(expected);
+        free(text);
+        test_doc_free(&doc);
+        putchar('.');
+}
+
+int main(void) {
+        printf("Running history tests...\n");
+        test_undo_redo();
+        test_retype();
+        test_cold_shared();
+        test_depth();
+        test_corrections();
+
+        putchar('\n');
+        printf("All history tests passed.\n");
+        return 0;
+}
+
+#endif /* PT_TEST */
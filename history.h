@@ -0,0 +1,97 @@
+#ifndef PT_HISTORY_H
+#define PT_HISTORY_H
+#include "cold.h"
+#include "ds.h"
+#include "stats.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Snapshots of a document for undo and redo. A snapshot shares its text
+ * with the document and with the other snapshots: the cold blocks are held
+ * by reference (see cold.h), and the hot tail is mirrored into append-only
+ * chunks, each holding the one before it. Taking a snapshot only copies the
+ * text typed since the last one, and small chunks no snapshot holds are
+ * merged as the chain grows, so the history costs memory in proportion to
+ * the edits rather than to the document.
+ */
+
+#define PT_HISTORY_DEPTH 256
+
+typedef struct PTChunk {
+        unsigned long refs;
+        struct PTChunk *prev; // held by this chunk
+        size_t start; // offset of `data` in the document
+        size_t len;
+        size_t cap;
+        size_t base;  // where the text of the chain begins
+        size_t depth; // chunks in the chain
+        char data[];
+} PTChunk;
+
+/**
+ * The document at some point: the text of the cold blocks up to `cold`,
+ * followed by the chunks up to `tail` read up to `len`. Later edits never
+ * change it.
+ */
+typedef struct {
+        PTColdBlock *cold; // NULL if there were no cold blocks
+        PTChunk *tail;
+        size_t len;
+        PTStats stats;
+} PTSnapshot;
+
+typedef struct {
+        PTSnapshot *items;
+        size_t count;
+        size_t cap;
+} PTSnapshotList;
+
+typedef enum { PT_EDIT_NONE, PT_EDIT_TYPE, PT_EDIT_DELETE } PTEditKind;
+
+typedef struct {
+        PTChunk *head;  // chunk last written to, NULL if none yet
+        size_t written; // the document is in the chunks up to here
+        size_t compact_depth; // depth at which the chain is merged
+        PTSnapshotList undo;
+        PTSnapshotList redo;
+        PTEditKind last_edit;
+        char last_char;
+} PTHistory;
+
+/**
+ * Takes a snapshot of the document made of `cold` and `tail` into `snap`.
+ * Returns 0 on success.
+ */
+int pt_history_snapshot(PTHistory *history, PTColdStore *cold,
+                        const pt_str *tail, const PTStats *stats,
+                        PTSnapshot *snap);
+
+/** Drops the text `snap` holds */
+void pt_snapshot_release(PTSnapshot *snap);
+
+/** Copies the text of `snap` after its cold blocks to `out` */
+void pt_snapshot_tail(const PTSnapshot *snap, char *out);
+
+/**
+ * Called before each edit, of which `c` is the typed character. Starts a
+ * new undo step when the kind of edit changes or a new word begins, and
+ * forgets what could be redone.
+ */
+void pt_history_record(PTHistory *history, PTEditKind kind, char c,
+                       PTColdStore *cold, const pt_str *tail,
+                       const PTStats *stats);
+
+/**
+ * Takes the document back to before the last undo step, or forward again
+ * past the last undone one. Returns false if there is nothing to do.
+ */
+bool pt_history_undo(PTHistory *history, PTColdStore *cold, pt_str *tail,
+                     PTStats *stats);
+bool pt_history_redo(PTHistory *history, PTColdStore *cold, pt_str *tail,
+                     PTStats *stats);
+
+/** Forgets all snapshots, as when another document is loaded */
+void pt_history_free(PTHistory *history);
+
+#endif
@@ -1,32 +1,130 @@
 #define _POSIX_C_SOURCE 200112L
+#include "batch.h"
 #include "ds.h"
 #include "editor.h"
+#include "prof.h"
 #include "render.h"
+#include "spell.h"
 #include "term.h"
+#include "trace.h"
+#include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 // Good resources
 // https://gist.github.com/delameter/b9772a0bf19032f977b985091f0eb5c1
 // https://vt100.net/annarbor/aaa-ug/section6.html
 
+static void pt_usage(const char *name) {
+        fprintf(stderr,
+                "Usage: %s <filename>...\n"
+                "       %s --render [--plain] <filename>...\n"
+                "       %s --replay <trace> [--paced] [--output <file>] "
+                "[--report <file>] <filename>\n"
+                "       %s --build-dict <words.txt> <out.dict>\n",
+                name, name, name, name);
+}
+
+/**
+ * Parses `<trace> [options]` in [`arg`, `last`) and replays the trace on
+ * the file named by `*last`.
+ */
+static int pt_replay_main(char **arg, char **last, const char *name) {
+        PTReplayOptions options = {0};
+        options.trace_path = *arg++;
+        while (arg < last) {
+                if (strcmp(*arg, "--paced") == 0) {
+                        options.is_paced = true;
+                        arg++;
+                } else if (strcmp(*arg, "--output") == 0 && arg + 1 < last) {
+                        options.output_path = arg[1];
+                        arg += 2;
+                } else if (strcmp(*arg, "--report") == 0 && arg + 1 < last) {
+                        options.report_path = arg[1];
+                        arg += 2;
+                } else {
+                        pt_usage(name);
+                        return 1;
+                }
+        }
+        return pt_replay(&options, *last);
+}
+
 int main(int argc, char *argv[]) {
         if (argc < 2) {
-                fprintf(stderr, "Usage: %s <filename>\n", argv[0]);
+                pt_usage(argv[0]);
                 return 1;
         }
+
+        if (strcmp(argv[1], "--render") == 0) {
+                int first = 2;
+                bool formatted = true;
+                if (first < argc && strcmp(argv[first], "--plain") == 0) {
+                        formatted = false;
+                        first++;
+                }
+                if (first >= argc) {
+                        pt_usage(argv[0]);
+                        return 1;
+                }
+                return pt_batch_render(argv + first, argc - first, formatted);
+        }
+
+        if (strcmp(argv[1], "--replay") == 0) {
+                if (argc < 4) {
+                        pt_usage(argv[0]);
+                        return 1;
+                }
+                return pt_replay_main(argv + 2, argv + argc - 1, argv[0]);
+        }
+        if (strcmp(argv[1], "--build-dict") == 0) {
+                if (argc != 4) {
+                        pt_usage(argv[0]);
+                        return 1;
+                }
+                return pt_spell_build_dict(argv[2], argv[3]) == 0 ? 0 : 1;
+        }
+
         pt_str *filename = pt_str_from(argv[1]);
+        pt_prof_init();
+        pt_spell_init();
         pt_init_term();
         PTState *state = pt_new_glob_state(filename);
         pt_load_from_file(state, filename);
+        for (int i = 2; i < argc; i++)
+                pt_open_buffer(state, pt_str_from(argv[i]));
+        pt_switch_buffer(state, 0);
+        pt_open_vault(state);
+        pt_trace_init(state);
 
         pt_render_state(state);
         pt_splash_screen(state);
 
+        // On a slow terminal, frames are drawn only once it has caught up,
+        // so keys typed meanwhile skip the intermediate frames
+        bool is_drawn = false;
         while (1) {
                 pt_refresh_terminal_state(state);
-                pt_render_state(state);
+                pt_reap_cache_writer(state);
+                if (state->vault)
+                        pt_vault_poll(state->vault);
+                if (!is_drawn && !pt_output_is_behind()) {
+                        pt_render_state(state);
+                        is_drawn = true;
+                }
+                // Search matches before the window are counted a step at
+                // a time while no key is waiting
+                if (is_drawn && pt_search_is_counting(&state->search) &&
+                    !pt_output_is_behind() && !pt_input_is_ready()) {
+                        if (pt_count_matches(state, PT_SEARCH_COUNT_STEP))
+                                is_drawn = false;
+                        continue;
+                }
+                if (!pt_wait_for_input(!is_drawn))
+                        continue;
                 pt_handle_key_press(state);
+                is_drawn = false;
         }
 
         return 0;
@@ -0,0 +1,206 @@
+#define _POSIX_C_SOURCE 200112L
+#include "prof.h"
+#include "ds.h"
+#include "term.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Histograms are log-linear like HdrHistogram: values are bucketed by
+ * their highest set bit, and each power of two is split into
+ * PT_PROF_SUB_BUCKETS linear buckets, so every bucket is within 1/16 of
+ * the values it holds.
+ */
+#define PT_PROF_SUB_BITS 4
+#define PT_PROF_SUB_BUCKETS (1 << PT_PROF_SUB_BITS)
+#define PT_PROF_BUCKETS (64 * PT_PROF_SUB_BUCKETS)
+#define PT_PROF_OVERLAY_WIDTH 44
+
+typedef struct {
+        unsigned long long counts[PT_PROF_BUCKETS];
+        unsigned long long total;
+        unsigned long long min;
+        unsigned long long max;
+        unsigned long long last;
+} PTHistogram;
+
+static const char *const metric_names[PT_PROF_METRIC_COUNT] = {
+        "copy", "censor", "format", "split", "output", "latency"};
+
+static bool is_enabled;
+static bool is_overlay_shown;
+static const char *dump_path;
+static PTHistogram histograms[PT_PROF_METRIC_COUNT];
+
+// Per frame counters, `last_*` hold the values of the finished frame
+static unsigned long long frame_ns[PT_PROF_METRIC_COUNT];
+static unsigned long long last_frame_ns[PT_PROF_METRIC_COUNT];
+static size_t frame_allocs_start, last_frame_allocs;
+static size_t frame_bytes_start, last_frame_bytes;
+static unsigned long long key_read_at;
+
+static size_t pt_prof_bucket(unsigned long long value) {
+        if (value < PT_PROF_SUB_BUCKETS)
+                return (size_t)value;
+        size_t bits = 0;
+        for (unsigned long long v = value; v > 1; v >>= 1)
+                bits++;
+        size_t shift = bits - PT_PROF_SUB_BITS;
+        size_t sub = (size_t)(value >> shift) & (PT_PROF_SUB_BUCKETS - 1);
+        return (shift + 1) * PT_PROF_SUB_BUCKETS + sub;
+}
+
+/** Smallest value that falls into `bucket` */
+static unsigned long long pt_prof_bucket_value(size_t bucket) {
+        if (bucket < PT_PROF_SUB_BUCKETS)
+                return bucket;
+        size_t shift = bucket / PT_PROF_SUB_BUCKETS - 1;
+        unsigned long long sub = bucket % PT_PROF_SUB_BUCKETS;
+        return (PT_PROF_SUB_BUCKETS + sub) << shift;
+}
+
+static void pt_histogram_add(PTHistogram *h, unsigned long long value) {
+        h->counts[pt_prof_bucket(value)]++;
+        if (h->total == 0 || value < h->min)
+                h->min = value;
+        if (value > h->max)
+                h->max = value;
+        h->total++;
+        h->last = value;
+}
+
+static unsigned long long pt_histogram_percentile(const PTHistogram *h,
+                                                  double percentile) {
+        if (h->total == 0)
+                return 0;
+        unsigned long long rank =
+                (unsigned long long)(percentile / 100.0 * (double)h->total);
+        if (rank >= h->total)
+                rank = h->total - 1;
+        unsigned long long seen = 0;
+        for (size_t i = 0; i < PT_PROF_BUCKETS; i++) {
+                seen += h->counts[i];
+                if (seen > rank)
+                        return pt_prof_bucket_value(i);
+        }
+        return h->max;
+}
+
+static void pt_prof_dump(void) {
+        FILE *file = fopen(dump_path, "w");
+        if (!file)
+                return;
+
+        static const double percentiles[] = {50, 90, 99, 99.9};
+        for (int m = 0; m < PT_PROF_METRIC_COUNT; m++) {
+                const PTHistogram *h = &histograms[m];
+                fprintf(file, "# %s: count=%llu min=%llu max=%llu", metric_names[m],
+                        h->total, h->min, h->max);
+                for (size_t p = 0; p < sizeof(percentiles) / sizeof(double);
+                     p++)
+                        fprintf(file, " p%g=%llu", percentiles[p],
+                                pt_histogram_percentile(h, percentiles[p]));
+                fputc('\n', file);
+
+                // Percentile distribution: bucket start in ns, count, and
+                // the fraction of values at or below the bucket
+                unsigned long long seen = 0;
+                for (size_t i = 0; i < PT_PROF_BUCKETS; i++) {
+                        if (h->counts[i] == 0)
+                                continue;
+                        seen += h->counts[i];
+                        fprintf(file, "%s %llu %llu %.6f\n", metric_names[m],
+                                pt_prof_bucket_value(i), h->counts[i],
+                                (double)seen / (double)h->total);
+                }
+        }
+        fclose(file);
+}
+
+void pt_prof_init(void) {
+        dump_path = getenv("PORTA_PROFILE");
+        if (!dump_path || !*dump_path)
+                return;
+        is_enabled = true;
+        atexit(pt_prof_dump);
+}
+
+bool pt_prof_is_enabled(void) { return is_enabled; }
+
+unsigned long long pt_prof_now(void) {
+        if (!is_enabled)
+                return 0;
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long long)ts.tv_sec * 1000000000ULL +
+               (unsigned long long)ts.tv_nsec;
+}
+
+void pt_prof_record(PTProfMetric metric, unsigned long long start) {
+        if (!is_enabled)
+                return;
+        unsigned long long elapsed = pt_prof_now() - start;
+        frame_ns[metric] += elapsed;
+        pt_histogram_add(&histograms[metric], elapsed);
+}
+
+void pt_prof_frame_begin(void) {
+        if (!is_enabled)
+                return;
+        memset(frame_ns, 0, sizeof(frame_ns));
+        frame_allocs_start = pt_str_alloc_count();
+        frame_bytes_start = pt_bytes_written();
+}
+
+void pt_prof_frame_end(void) {
+        if (!is_enabled)
+                return;
+        memcpy(last_frame_ns, frame_ns, sizeof(frame_ns));
+        last_frame_allocs = pt_str_alloc_count() - frame_allocs_start;
+        last_frame_bytes = pt_bytes_written() - frame_bytes_start;
+}
+
+void pt_prof_key_read(void) {
+        if (is_enabled && key_read_at == 0)
+                key_read_at = pt_prof_now();
+}
+
+void pt_prof_flushed(void) {
+        if (!is_enabled || key_read_at == 0)
+                return;
+        pt_prof_record(PT_PROF_LATENCY, key_read_at);
+        last_frame_ns[PT_PROF_LATENCY] = histograms[PT_PROF_LATENCY].last;
+        key_read_at = 0;
+}
+
+void pt_prof_toggle_overlay(void) {
+        if (is_enabled)
+                is_overlay_shown = !is_overlay_shown;
+}
+
+bool pt_prof_draw_overlay(unsigned short cols) {
+        if (!is_enabled || !is_overlay_shown || cols < PT_PROF_OVERLAY_WIDTH)
+                return false;
+
+        unsigned short col = (unsigned short)(cols - PT_PROF_OVERLAY_WIDTH + 1);
+        unsigned short row = 1;
+        char line[PT_PROF_OVERLAY_WIDTH + 32];
+        for (int m = 0; m < PT_PROF_METRIC_COUNT; m++) {
+                unsigned long long p99 =
+                        pt_histogram_percentile(&histograms[m], 99);
+                snprintf(line, sizeof(line),
+                         "\033[7m %-8s%9.3f ms  p99 %9.3f ms \033[27m",
+                         metric_names[m], (double)last_frame_ns[m] / 1e6,
+                         (double)p99 / 1e6);
+                pt_move_cursor(row++, col);
+                pt_puts(line);
+        }
+        snprintf(line, sizeof(line), "\033[7m %-8s%9zu      bytes %10zu \033[27m",
+                 "allocs", last_frame_allocs, last_frame_bytes);
+        pt_move_cursor(row, col);
+        pt_puts(line);
+        return true;
+}
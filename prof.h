@@ -0,0 +1,45 @@
+#ifndef PT_PROF_H
+#define PT_PROF_H
+#include <stdbool.h>
+
+/*
+ * Optional instrumentation, enabled by setting $PORTA_PROFILE to the file
+ * the latency histograms are written to on exit. When disabled every call
+ * returns right away.
+ */
+
+typedef enum {
+        PT_PROF_COPY,
+        PT_PROF_CENSOR,
+        PT_PROF_FORMAT,
+        PT_PROF_SPLIT,
+        PT_PROF_OUTPUT,
+        PT_PROF_LATENCY, // key read until the frame showing it is flushed
+        PT_PROF_METRIC_COUNT
+} PTProfMetric;
+
+void pt_prof_init(void);
+bool pt_prof_is_enabled(void);
+
+/** Monotonic time in nanoseconds, or 0 when profiling is disabled */
+unsigned long long pt_prof_now(void);
+
+/** Records the time spent since `start`, a value from `pt_prof_now` */
+void pt_prof_record(PTProfMetric metric, unsigned long long start);
+
+void pt_prof_frame_begin(void);
+void pt_prof_frame_end(void);
+
+/** Marks the arrival of a key, ended by the next `pt_prof_flushed` */
+void pt_prof_key_read(void);
+void pt_prof_flushed(void);
+
+void pt_prof_toggle_overlay(void);
+
+/**
+ * Draws the stats of the last frame in the top right corner if shown.
+ * Returns true if it did, which leaves the cursor there.
+ */
+bool pt_prof_draw_overlay(unsigned short cols);
+
+#endif
@@ -2,6 +2,7 @@
 #define _POSIX_C_SOURCE 200112L
 #include "ds.h"
 #include "editor.h"
+#include "prof.h"
 #include "render.h"
 #include "term.h"
 #include <stdbool.h>
@@ -10,7 +11,6 @@
 #include <string.h>
 
 #define PT_MAX_HEADER_SIZE 4
-#define TEXT_WIDTH 80
 
 void censor_text(pt_str *text) {
         size_t len = text->len;
@@ -134,9 +134,18 @@ static const char *pt_format_wikilink(const char *input, pt_str *out) {
 
 pt_str *pt_format_string(const pt_str *input) {
         pt_str *out = pt_str_new();
+        pt_str_reserve(out, input->len);
 
         const char *p = input->data;
         while (*p) {
+                // Copy up to the next character that may start markup
+                size_t run = strcspn(p, "#*[");
+                if (run > 0) {
+                        pt_str_append_n(out, p, run);
+                        p += run;
+                        continue;
+                }
+
                 // Either first character in the input is a pound or pound has
                 // been preceeded by a newline
                 if (p[0] == '#' && (p == input->data || *(p - 1) == '\n')) {
@@ -190,7 +199,7 @@ static const char *pt_skip_escape_sequence(const char *input) {
  * Allocates and fills an array of `pt_str`, returned via `lines_out`.
  * Returns the number of lines, or 0 on failure.
  */
-static int pt_split_lines(const pt_str *input, pt_str **lines_out) {
+int pt_split_lines(const pt_str *input, pt_str **lines_out) {
         if (!input || !lines_out)
                 return -1;
 
@@ -201,8 +210,9 @@ static int pt_split_lines(const pt_str *input, pt_str **lines_out) {
                         const char *after_escape = pt_skip_escape_sequence(c);
                         c = after_escape - 1;
                 } else if (char_count >= TEXT_WIDTH || *c == '\n') {
+                        // A wrapped character starts the next line, as below
                         lines_count++;
-                        char_count = 0;
+                        char_count = *c == '\n' ? 0 : 1;
                 } else {
                         char_count++;
                 }
@@ -217,64 +227,241 @@ static int pt_split_lines(const pt_str *input, pt_str **lines_out) {
                 pt_str_init(&lines[i]);
         }
 
-        // Second pass: fill the lines
+        // Second pass: fill the lines. Each is a run of the input, which
+        // is copied at once when the line ends
         size_t line_index = 0;
         size_t visible_char_count = 0; // Track visible characters separately
-        for (const char *c = input->data; *c; ++c) {
-                pt_str *line = &lines[line_index];
-
+        const char *run = input->data;
+        const char *c = input->data;
+        for (; *c; ++c) {
                 if (*c == '\033') {
-                        const char *after_escape = pt_skip_escape_sequence(c);
                         // Copy entire escape sequence
-                        while (c < after_escape) {
-                                pt_str_append_char(line, *c);
-                                c++;
-                        }
-                        c--; // Adjust for loop increment
+                        c = pt_skip_escape_sequence(c) - 1;
                 } else if (visible_char_count >= TEXT_WIDTH || *c == '\n') {
+                        pt_str_append_n(&lines[line_index], run,
+                                        (size_t)(c - run));
+                        run = *c == '\n' ? c + 1 : c;
                         line_index++;
                         if (line_index >= lines_count)
                                 break;          // Prevent overflow
-                        visible_char_count = 0; // Reset visible char count
-                        if (*c == '\n')
-                                continue;
-                        line = &lines[line_index]; // Update line pointer
-                        pt_str_append_char(line, *c);
-                        visible_char_count++;
+                        visible_char_count = *c == '\n' ? 0 : 1;
                 } else {
-                        pt_str_append_char(line, *c);
                         visible_char_count++;
                 }
         }
+        if (line_index < lines_count)
+                pt_str_append_n(&lines[line_index], run, (size_t)(c - run));
 
         *lines_out = lines;
         return (int)lines_count;
 }
 
-/**
- * Render the current state: clear screen, wrap text,
- * then print it centered like a typewriter effect.
- */
-void pt_render_state(PTState *state) {
-        pt_clear_screen();
-        pt_str *content = pt_str_from(state->content->data);
+int pt_render_to_stream(const pt_str *content, bool formatted, FILE *out) {
+        pt_str *formatted_content = NULL;
+        if (formatted) {
+                formatted_content = pt_format_string(content);
+                if (!formatted_content)
+                        return -1;
+                content = formatted_content;
+        }
 
-        if (state->is_censored)
-                censor_text(content);
+        pt_str *lines = NULL;
+        int line_count = pt_split_lines(content, &lines);
+        int rc = line_count < 0 ? -1 : 0;
+
+        // Lines are joined rather than terminated so that a chunk ending in
+        // a newline does not gain an extra empty line
+        for (int i = 0; i < line_count && rc == 0; i++) {
+                if (i > 0 && fputc('\n', out) == EOF)
+                        rc = -1;
+                if (fwrite(lines[i].data, 1, lines[i].len, out) !=
+                    lines[i].len)
+                        rc = -1;
+        }
+
+        for (int j = 0; j < line_count; j++) {
+                pt_str_free(&lines[j]);
+        }
+        free(lines);
+        if (formatted_content) {
+                pt_str_free(formatted_content);
+                free(formatted_content);
+        }
+        return rc;
+}
 
+bool pt_is_kitty(void) {
         const char *term = getenv("TERM");
-        if (term && strcmp(term, "xterm-kitty") == 0) {
+        return term && strcmp(term, "xterm-kitty") == 0;
+}
+
+/**
+ * Formats `content` for the terminal and wraps it into `lines_out`.
+ * Takes ownership of `content`. Returns the number of lines.
+ */
+static int pt_layout(pt_str *content, pt_str **lines_out) {
+        if (pt_is_kitty()) {
+                unsigned long long start = pt_prof_now();
                 pt_str *formatted = pt_format_string(content);
                 pt_str_free(content);
                 free(content);
                 content = formatted;
+                pt_prof_record(PT_PROF_FORMAT, start);
         }
 
-        pt_str *lines = {0};
-        int line_count = pt_split_lines(content, &lines);
+        unsigned long long start = pt_prof_now();
+        int line_count = pt_split_lines(content, lines_out);
+        pt_prof_record(PT_PROF_SPLIT, start);
         if (line_count < 0)
                 pt_die("split lines");
+        pt_str_free(content);
+        free(content);
+        return line_count;
+}
+
+int pt_plain_layout(const pt_str *text, pt_str **lines_out) {
+        return pt_layout(pt_str_from(text->data), lines_out);
+}
 
+/**
+ * Copies the text of `buffer` with its misspelled words underlined, curly
+ * on kitty. Headings, wikilinks and bold text are left alone since the
+ * formatter wraps them in sequences of its own.
+ */
+static pt_str *pt_mark_misspelled(const PTBuffer *buffer) {
+        const pt_str *text = buffer->content;
+        const PTSpell *spell = &buffer->spell;
+        const char *underline = pt_is_kitty() ? "\033[4:3m" : "\033[4m";
+
+        pt_str *marked = pt_str_new();
+        size_t s = 0;
+        bool in_heading = false;
+        bool in_link = false;
+        bool in_bold = false;
+        bool is_marked = false;
+        for (size_t i = 0; i < text->len; i++) {
+                const char *p = text->data + i;
+                if (i == 0 || p[-1] == '\n')
+                        in_heading = *p == '#';
+                if (p[0] == '*' && p[1] == '*')
+                        in_bold = !in_bold;
+                else if (p[0] == '[' && p[1] == '[')
+                        in_link = true;
+                else if (i > 0 && p[-1] == ']' && p[0] == ']')
+                        in_link = false;
+
+                while (s < spell->span_count && spell->spans[s].end <= i)
+                        s++;
+                bool want = s < spell->span_count && spell->spans[s].start <= i &&
+                            !in_heading && !in_link && !in_bold;
+                if (want != is_marked) {
+                        pt_str_append(marked, want ? underline : "\033[24m");
+                        is_marked = want;
+                }
+                pt_str_append_char(marked, *p);
+        }
+        if (is_marked)
+                pt_str_append(marked, "\033[24m");
+        return marked;
+}
+
+/**
+ * Formats and wraps the text of `buffer` into its layout cache, then makes
+ * room for it within the layout budget.
+ */
+static void pt_build_layout(PTState *state, PTBuffer *buffer) {
+        unsigned long long start = pt_prof_now();
+        pt_str *content = buffer->spell.span_count > 0 && !state->is_censored
+                                  ? pt_mark_misspelled(buffer)
+                                  : pt_str_from(buffer->content->data);
+        pt_prof_record(PT_PROF_COPY, start);
+
+        if (state->is_censored) {
+                start = pt_prof_now();
+                censor_text(content);
+                pt_prof_record(PT_PROF_CENSOR, start);
+        }
+
+        pt_str *lines = NULL;
+        int line_count = pt_layout(content, &lines);
+        pt_set_layout(state, buffer, lines, line_count, state->is_censored);
+}
+
+/**
+ * Lays out the tail of the text that can be on screen with the search
+ * matches in reverse video. Heading lines are left alone since their text
+ * ends up inside an OSC sequence, and censored text is left alone so as not
+ * to give away where the matches are. This changes with every query, so it
+ * is not cached.
+ */
+static int pt_search_layout(const PTState *state, pt_str **lines_out) {
+        const pt_str *text = state->content;
+        const PTSearch *search = &state->search;
+        // Matches are counted from the start of the document, cold part
+        // included
+        size_t base = state->buffers[state->active].cold.len;
+
+        // Formatting can hide markup, so take more than fits on screen and
+        // start on a line boundary so that wrapping matches the full layout
+        size_t window = (size_t)state->rows * TEXT_WIDTH * 4;
+        size_t start = text->len > window ? text->len - window : 0;
+        size_t limit = start > window ? start - window : 0;
+        size_t line_start = start;
+        while (line_start > limit && text->data[line_start - 1] != '\n')
+                line_start--;
+        if (line_start > 0 && text->data[line_start - 1] == '\n')
+                start = line_start;
+
+        unsigned long long timer = pt_prof_now();
+        pt_str *visible = pt_str_from(text->data + start);
+        pt_prof_record(PT_PROF_COPY, timer);
+        if (state->is_censored) {
+                timer = pt_prof_now();
+                censor_text(visible);
+                pt_prof_record(PT_PROF_CENSOR, timer);
+        }
+
+        pt_str *marked = pt_str_new();
+        size_t m = pt_search_first_from(search, base + start);
+        size_t lit_end = 0;
+        bool lit = false;
+        bool in_heading = false;
+        for (size_t i = start; i < text->len; i++) {
+                char c = visible->data[i - start];
+                if (i == start || text->data[i - 1] == '\n')
+                        in_heading = text->data[i] == '#';
+                while (m < search->match_count &&
+                       search->matches[m] <= base + i) {
+                        size_t end =
+                                search->matches[m] - base + search->query_len;
+                        if (end > lit_end)
+                                lit_end = end;
+                        m++;
+                }
+
+                bool want = i < lit_end && !in_heading && c != '\n' &&
+                            !state->is_censored;
+                if (want != lit) {
+                        pt_str_append(marked, want ? "\033[7m" : "\033[27m");
+                        lit = want;
+                }
+                pt_str_append_char(marked, c);
+        }
+        if (lit)
+                pt_str_append(marked, "\033[27m");
+
+        pt_str_free(visible);
+        free(visible);
+        return pt_layout(marked, lines_out);
+}
+
+/**
+ * Prints `lines` centered like a typewriter: the last line sits in the
+ * middle of the screen and earlier lines go above it. See also
+ * `pt_place_cursor`.
+ */
+static void pt_draw_lines(const PTState *state, const pt_str *lines,
+                          int line_count) {
         const unsigned short center_row = (unsigned short)(state->rows - 1) / 2;
         const unsigned short start_col =
                 (unsigned short)(state->cols - TEXT_WIDTH) / 2;
@@ -286,23 +473,91 @@ void pt_render_state(PTState *state) {
         while (i < line_count && i < max_rows) {
                 unsigned short row_idx = center_row - i;
 
-                unsigned short line_idx = (unsigned short)(line_count - 1 - i);
+                int line_idx = line_count - 1 - i;
                 pt_move_cursor(row_idx, start_col);
-                printf("%s", lines[line_idx].data);
+                pt_write(lines[line_idx].data, lines[line_idx].len);
                 i++;
         }
-        // Print the center line again to get the cursor right
+}
+
+/**
+ * Prints the center line again to leave the cursor after it, once
+ * everything else is drawn.
+ */
+static void pt_place_cursor(const PTState *state, const pt_str *lines,
+                            int line_count) {
+        const unsigned short center_row = (unsigned short)(state->rows - 1) / 2;
+        const unsigned short start_col =
+                (unsigned short)(state->cols - TEXT_WIDTH) / 2;
         pt_move_cursor(center_row, start_col);
-        printf("%s", lines[line_count - 1].data);
+        pt_write(lines[line_count - 1].data, lines[line_count - 1].len);
+}
 
-        // Cleanup
-        for (int j = 0; j < line_count; j++) {
-                pt_str_free(&lines[j]);
+/** Prints the statistics of the active buffer on the bottom row */
+static void pt_draw_status(const PTState *state) {
+        const PTStats *stats = &state->buffers[state->active].stats;
+        char status[160];
+        snprintf(status, sizeof(status),
+                 "%zu words  %zu chars  %zu lines  %zu paragraphs  "
+                 "~%zu min read",
+                 stats->words, stats->chars, stats->lines, stats->paragraphs,
+                 pt_stats_reading_minutes(stats));
+        pt_move_cursor(state->rows, 1);
+        pt_puts(status);
+}
+
+/**
+ * Render the current state: clear screen, wrap text,
+ * then print it centered like a typewriter effect.
+ */
+void pt_render_state(PTState *state) {
+        pt_prof_frame_begin();
+        pt_clear_screen();
+
+        if (state->search.is_active) {
+                pt_str *lines = NULL;
+                int line_count = pt_search_layout(state, &lines);
+
+                unsigned long long start = pt_prof_now();
+                pt_draw_lines(state, lines, line_count);
+                for (int j = 0; j < line_count; j++) {
+                        pt_str_free(&lines[j]);
+                }
+                free(lines);
+
+                // Matches before the window may still be being counted
+                char prompt[PT_SEARCH_MAX_QUERY + 64];
+                snprintf(prompt, sizeof(prompt), "Search: %s [%zu%s matches]",
+                         state->search.query, pt_search_total(&state->search),
+                         pt_search_is_counting(&state->search) ? "+" : "");
+                pt_move_cursor(state->rows, 1);
+                pt_puts(prompt);
+                // The overlay goes over everything, then the cursor goes
+                // back to the end of the prompt
+                if (pt_prof_draw_overlay(state->cols)) {
+                        pt_move_cursor(state->rows, 1);
+                        pt_puts(prompt);
+                }
+                pt_flush();
+                pt_prof_record(PT_PROF_OUTPUT, start);
+                pt_prof_frame_end();
+                return;
         }
-        free(lines);
-        pt_str_free(content);
-        free(content);
 
-        fflush(stdout);
+        PTBuffer *buffer = &state->buffers[state->active];
+        if (buffer->lines && buffer->is_layout_censored != state->is_censored)
+                pt_drop_layout(buffer);
+        if (!buffer->lines)
+                pt_build_layout(state, buffer);
+        buffer->last_used = ++state->clock;
+
+        unsigned long long start = pt_prof_now();
+        pt_draw_lines(state, buffer->lines, buffer->line_count);
+        pt_draw_status(state);
+        pt_prof_draw_overlay(state->cols);
+        pt_place_cursor(state, buffer->lines, buffer->line_count);
+
+        pt_flush();
+        pt_prof_record(PT_PROF_OUTPUT, start);
+        pt_prof_frame_end();
 }
-
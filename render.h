@@ -1,6 +1,11 @@
 #define _POSIX_C_SOURCE 200112L
 #include "ds.h"
 #include "editor.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+// Columns the text is wrapped at
+#define TEXT_WIDTH 80
 
 /**
  * Takes a markdown text and return a new heap allocated string with kitty
@@ -11,4 +16,27 @@ pt_str *pt_format_string(const pt_str *input);
 /** Replaces all the alpha-num characters up to the last one with an asterisk */
 void censor_text(pt_str *text);
 
+/**
+ * Splits `input` into lines wrapped at the text width. The array of lines is
+ * returned via `lines_out` and must be freed by the caller.
+ * Returns the number of lines, or -1 on failure.
+ */
+int pt_split_lines(const pt_str *input, pt_str **lines_out);
+
+/**
+ * Writes `content` wrapped at the text width to `out`, without any cursor
+ * movement. Markdown is formatted first when `formatted` is set.
+ * Returns 0 on success, -1 on failure.
+ */
+int pt_render_to_stream(const pt_str *content, bool formatted, FILE *out);
+
+/** Whether the layout is formatted for kitty */
+bool pt_is_kitty(void);
+
+/**
+ * Lays out `text` as it is drawn with nothing underlined or censored.
+ * Returns the number of lines.
+ */
+int pt_plain_layout(const pt_str *text, pt_str **lines_out);
+
 void pt_render_state(PTState *state);
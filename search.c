@@ -0,0 +1,581 @@
+#define _POSIX_C_SOURCE 200112L
+#include "search.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Needles shorter than this are verified with memcmp after a memchr skip
+#define PT_SEARCH_HORSPOOL_MIN 4
+
+static const char *pt_search_memchr(const char *haystack, size_t haystack_len,
+                                    const char *needle, size_t needle_len) {
+        const char *p = haystack;
+        const char *last = haystack + haystack_len - needle_len;
+        while (p <= last) {
+                p = memchr(p, needle[0], (size_t)(last - p) + 1);
+                if (!p)
+                        return NULL;
+                if (memcmp(p + 1, needle + 1, needle_len - 1) == 0)
+                        return p;
+                p++;
+        }
+        return NULL;
+}
+
+static void pt_search_horspool_table(const char *needle, size_t needle_len,
+                                     size_t skip[256]) {
+        for (size_t i = 0; i < 256; i++)
+                skip[i] = needle_len;
+        for (size_t i = 0; i + 1 < needle_len; i++)
+                skip[(unsigned char)needle[i]] = needle_len - 1 - i;
+}
+
+static const char *pt_search_horspool(const char *haystack,
+                                      size_t haystack_len, const char *needle,
+                                      size_t needle_len,
+                                      const size_t skip[256]) {
+        const unsigned char last_char = (unsigned char)needle[needle_len - 1];
+        size_t i = 0;
+        while (i + needle_len <= haystack_len) {
+                unsigned char c = (unsigned char)haystack[i + needle_len - 1];
+                if (c == last_char &&
+                    memcmp(haystack + i, needle, needle_len - 1) == 0)
+                        return haystack + i;
+                i += skip[c];
+        }
+        return NULL;
+}
+
+const char *pt_search_find(const char *haystack, size_t haystack_len,
+                           const char *needle, size_t needle_len) {
+        if (needle_len == 0 || needle_len > haystack_len)
+                return NULL;
+        if (needle_len < PT_SEARCH_HORSPOOL_MIN)
+                return pt_search_memchr(haystack, haystack_len, needle,
+                                        needle_len);
+
+        size_t skip[256];
+        pt_search_horspool_table(needle, needle_len, skip);
+        return pt_search_horspool(haystack, haystack_len, needle, needle_len,
+                                  skip);
+}
+
+/** Makes room for `extra` more matches on the stack */
+static bool pt_search_reserve(PTSearch *search, size_t extra) {
+        size_t need = search->stack_len + extra;
+        if (need <= search->stack_cap)
+                return true;
+        size_t new_cap = search->stack_cap ? search->stack_cap * 2 : 64;
+        while (new_cap < need)
+                new_cap *= 2;
+        size_t *stack = realloc(search->stack, new_cap * sizeof(size_t));
+        if (!stack)
+                return false;
+        search->stack = stack;
+        search->stack_cap = new_cap;
+        return true;
+}
+
+/** Points `matches` at the last level after the stack has changed */
+static void pt_search_top(PTSearch *search, size_t start) {
+        search->matches = search->stack ? search->stack + start : NULL;
+        search->match_count = search->stack_len - start;
+}
+
+static void pt_search_add_match(PTSearch *search, size_t offset) {
+        if (!pt_search_reserve(search, 1))
+                return;
+        search->stack[search->stack_len++] = offset;
+}
+
+/**
+ * Finds the matches in the `len` bytes at `run`, which sit at `base` in the
+ * text, that start before `to`. With `keep` they go on the stack, otherwise
+ * they are only counted.
+ */
+static void pt_search_scan_run(PTSearch *search, const char *run, size_t len,
+                               size_t base, size_t to, bool keep,
+                               const size_t skip[256]) {
+        size_t n = search->query_len;
+        size_t offset = 0;
+        while (offset + n <= len) {
+                const char *hit =
+                        n < PT_SEARCH_HORSPOOL_MIN
+                                ? pt_search_memchr(run + offset, len - offset,
+                                                   search->query, n)
+                                : pt_search_horspool(run + offset,
+                                                     len - offset,
+                                                     search->query, n, skip);
+                if (!hit)
+                        break;
+                size_t found = (size_t)(hit - run);
+                if (base + found >= to)
+                        break;
+                if (keep)
+                        pt_search_add_match(search, base + found);
+                else
+                        search->counted++;
+                offset = found + 1;
+        }
+}
+
+/**
+ * Finds the matches that start in [`from`, `to`) of `text`. The text is
+ * read one segment at a time, in order, so each compressed block is only
+ * decompressed once.
+ */
+static void pt_search_scan_range(PTSearch *search, const pt_text *text,
+                                 size_t from, size_t to, bool keep) {
+        size_t n = search->query_len;
+        if (n > text->len)
+                return;
+        if (to > text->len - n + 1)
+                to = text->len - n + 1;
+
+        size_t skip[256];
+        if (n >= PT_SEARCH_HORSPOOL_MIN)
+                pt_search_horspool_table(search->query, n, skip);
+
+        size_t offset = from;
+        while (offset < to) {
+                size_t start;
+                size_t seg_len;
+                const char *seg =
+                        pt_text_segment(text, offset, &start, &seg_len);
+                if (!seg)
+                        break;
+                size_t end = start + seg_len;
+                size_t stop = end < to + n - 1 ? end : to + n - 1;
+                pt_search_scan_run(search, seg + (offset - start),
+                                   stop - offset, offset, to, keep, skip);
+
+                // Matches that run into the next segment start in the last
+                // n - 1 bytes of this one
+                if (n > 1 && end < to + n - 1) {
+                        char window[2 * PT_SEARCH_MAX_QUERY];
+                        size_t before =
+                                end - offset < n - 1 ? end - offset : n - 1;
+                        size_t got = pt_text_copy(text, end - before, window,
+                                                  before + n - 1);
+                        pt_search_scan_run(search, window, got, end - before,
+                                           end < to ? end : to, keep, skip);
+                }
+                offset = end;
+        }
+}
+
+/** Finds the occurrences of the query in the window as a new level */
+static void pt_search_scan(PTSearch *search, const pt_text *text) {
+        size_t level = search->stack_len;
+        search->level[search->query_len - 1] = level;
+        pt_search_scan_range(search, text, search->window_start, text->len,
+                             true);
+        pt_search_top(search, level);
+}
+
+/**
+ * Goes back to the count of the query if it is known. Otherwise counting
+ * starts over, or is done right away when the shorter query had no match
+ * before the window.
+ */
+static void pt_search_start_count(PTSearch *search) {
+        size_t n = search->query_len;
+        search->counted = 0;
+        search->counted_to = 0;
+        if (search->level_counted[n - 1] != PT_SEARCH_LOST)
+                search->counted = search->level_counted[n - 1];
+        else if (n == 1 || search->level_counted[n - 2] != 0)
+                return;
+        search->counted_to = search->window_start;
+        search->level_counted[n - 1] = search->counted;
+}
+
+void pt_search_push(PTSearch *search, char c, const pt_text *text) {
+        if (search->query_len + 1 >= PT_SEARCH_MAX_QUERY)
+                return;
+        search->query[search->query_len++] = c;
+        search->query[search->query_len] = '\0';
+        search->level_counted[search->query_len - 1] = PT_SEARCH_LOST;
+
+        if (search->query_len == 1) {
+                search->window_start = text->len > PT_SEARCH_WINDOW
+                                               ? text->len - PT_SEARCH_WINDOW
+                                               : 0;
+                search->stack_len = 0;
+                pt_search_scan(search, text);
+                pt_search_start_count(search);
+                return;
+        }
+
+        // The new level goes after the shorter query's, or over it if
+        // there is no room
+        size_t last = search->query_len - 1;
+        size_t from = search->level[last - 1];
+        size_t count = search->match_count;
+        size_t to = search->stack_len;
+        if (!pt_search_reserve(search, count)) {
+                to = from;
+                search->level[last - 1] = PT_SEARCH_LOST;
+        }
+        search->level[last] = to;
+
+        // Every match of the longer query starts at a match of the shorter
+        // one, so only the new last character has to be checked
+        size_t kept = 0;
+        const char *seg = NULL;
+        size_t seg_start = 0;
+        size_t seg_len = 0;
+        for (size_t i = 0; i < count; i++) {
+                size_t offset = search->stack[from + i];
+                size_t at = offset + last;
+                if (at >= text->len)
+                        continue;
+                // Matches are in order, so the segment rarely changes
+                if (!seg || at < seg_start || at - seg_start >= seg_len)
+                        seg = pt_text_segment(text, at, &seg_start, &seg_len);
+                if (seg && seg[at - seg_start] == c)
+                        search->stack[to + kept++] = offset;
+        }
+        search->stack_len = to + kept;
+        pt_search_top(search, to);
+        pt_search_start_count(search);
+}
+
+void pt_search_pop(PTSearch *search, const pt_text *text) {
+        if (search->query_len == 0)
+                return;
+        size_t popped = search->level[search->query_len - 1];
+        search->query[--search->query_len] = '\0';
+        search->stack_len = popped;
+        if (search->query_len == 0) {
+                pt_search_top(search, 0);
+                search->counted = 0;
+                search->counted_to = 0;
+                return;
+        }
+
+        size_t level = search->level[search->query_len - 1];
+        if (level == PT_SEARCH_LOST)
+                pt_search_scan(search, text);
+        else
+                pt_search_top(search, level);
+        pt_search_start_count(search);
+}
+
+bool pt_search_count(PTSearch *search, const pt_text *text, size_t budget) {
+        if (!pt_search_is_counting(search))
+                return true;
+        size_t to = search->window_start - search->counted_to > budget
+                            ? search->counted_to + budget
+                            : search->window_start;
+        pt_search_scan_range(search, text, search->counted_to, to, false);
+        search->counted_to = to;
+        if (to < search->window_start)
+                return false;
+        search->level_counted[search->query_len - 1] = search->counted;
+        return true;
+}
+
+bool pt_search_is_counting(const PTSearch *search) {
+        return search->query_len > 0 &&
+               search->counted_to < search->window_start;
+}
+
+size_t pt_search_total(const PTSearch *search) {
+        return search->counted + search->match_count;
+}
+
+void pt_search_clear(PTSearch *search) {
+        search->query_len = 0;
+        search->query[0] = '\0';
+        search->stack_len = 0;
+        search->counted = 0;
+        search->counted_to = 0;
+        pt_search_top(search, 0);
+}
+
+void pt_search_free(PTSearch *search) {
+        free(search->stack);
+        search->stack = NULL;
+        search->stack_cap = 0;
+        pt_search_clear(search);
+}
+
+size_t pt_search_first_from(const PTSearch *search, size_t offset) {
+        size_t lo = 0;
+        size_t hi = search->match_count;
+        while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (search->matches[mid] < offset)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return lo;
+}
+
+#ifdef PT_TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+static const char *naive_find(const char *h, size_t hn, const char *n,
+                              size_t nn) {
+        if (nn == 0 || nn > hn)
+                return NULL;
+        for (size_t i = 0; i + nn <= hn; i++)
+                if (memcmp(h + i, n, nn) == 0)
+                        return h + i;
+        return NULL;
+}
+
+static void test_find_basic(void) {
+        const char *text = "the quick brown fox jumps over the lazy dog";
+        size_t len = strlen(text);
+        assert(pt_search_find(text, len, "the", 3) == text);
+        assert(pt_search_find(text, len, "lazy", 4) == text + 35);
+        assert(pt_search_find(text, len, "dog", 3) == text + 40);
+        assert(pt_search_find(text, len, "cat", 3) == NULL);
+        assert(pt_search_find(text, len, "", 0) == NULL);
+        assert(pt_search_find("ab", 2, "abc", 3) == NULL);
+        putchar('.');
+}
+
+static void test_find_matches_naive(void) {
+        char text[2048];
+        srand(42);
+        for (size_t i = 0; i < sizeof(text); i++)
+                text[i] = (char)('a' + rand() % 3);
+
+        for (int round = 0; round < 2000; round++) {
+                char needle[12];
+                size_t n = 1 + (size_t)(rand() % 10);
+                for (size_t i = 0; i < n; i++)
+                        needle[i] = (char)('a' + rand() % 3);
+                size_t start = (size_t)(rand() % 1024);
+                assert(pt_search_find(text + start, sizeof(text) - start,
+                                      needle, n) ==
+                       naive_find(text + start, sizeof(text) - start, needle,
+                                  n));
+        }
+        putchar('.');
+}
+
+static void test_push_refines(void) {
+        const char *data = "banana bandana";
+        pt_text text;
+        pt_text_init(&text, data, strlen(data));
+        PTSearch search = {0};
+
+        pt_search_push(&search, 'a', &text);
+        assert(search.match_count == 6);
+        pt_search_push(&search, 'n', &text);
+        assert(search.match_count == 4);
+        pt_search_push(&search, 'a', &text);
+        assert(search.match_count == 3);
+        assert(search.matches[0] == 1);
+        assert(search.matches[1] == 3);
+        assert(search.matches[2] == 11);
+        assert(strcmp(search.query, "ana") == 0);
+
+        // Going back restores the set of the shorter query
+        pt_search_pop(&search, &text);
+        assert(search.match_count == 4);
+        assert(strcmp(search.query, "an") == 0);
+        const size_t an[] = {1, 3, 8, 11};
+        assert(memcmp(search.matches, an, sizeof(an)) == 0);
+        pt_search_pop(&search, &text);
+        assert(search.match_count == 6);
+        pt_search_pop(&search, &text);
+        assert(search.match_count == 0);
+        assert(search.query_len == 0);
+        pt_search_push(&search, 'n', &text);
+        assert(search.match_count == 4);
+
+        pt_search_free(&search);
+        assert(search.matches == NULL);
+        assert(search.query_len == 0);
+        putchar('.');
+}
+
+static void test_push_matches_scan(void) {
+        char text[4096];
+        srand(7);
+        for (size_t i = 0; i < sizeof(text); i++)
+                text[i] = (char)('a' + rand() % 2);
+
+        pt_text view;
+        pt_text_init(&view, text, sizeof(text));
+        PTSearch search = {0};
+        const char *query = "abbabaab";
+        for (size_t q = 0; q < strlen(query); q++) {
+                pt_search_push(&search, query[q], &view);
+
+                // The refined set must equal a search from scratch
+                size_t expected = 0;
+                for (size_t i = 0; i + q + 1 <= sizeof(text); i++) {
+                        if (memcmp(text + i, query, q + 1) == 0) {
+                                assert(expected < search.match_count);
+                                assert(search.matches[expected] == i);
+                                expected++;
+                        }
+                }
+                assert(expected == search.match_count);
+        }
+        pt_search_free(&search);
+        putchar('.');
+}
+
+static void test_first_from(void) {
+        pt_text text;
+        pt_text_init(&text, "xx.xx.xx", 8);
+        PTSearch search = {0};
+        pt_search_push(&search, 'x', &text);
+        assert(search.match_count == 6);
+        assert(pt_search_first_from(&search, 0) == 0);
+        assert(pt_search_first_from(&search, 2) == 2);
+        assert(search.matches[pt_search_first_from(&search, 2)] == 3);
+        assert(pt_search_first_from(&search, 100) == 6);
+        pt_search_free(&search);
+        putchar('.');
+}
+
+/* A text whose first `data_start` bytes come in segments of 7 */
+static const char *segmented_at(const pt_text *text, size_t offset,
+                                size_t *start, size_t *seg_len) {
+        *start = offset - offset % 7;
+        *seg_len = 7;
+        return (const char *)text->store + *start;
+}
+
+static void test_segmented(void) {
+        static char data[4096];
+        srand(11);
+        for (size_t i = 0; i < sizeof(data); i++)
+                data[i] = (char)('a' + rand() % 2);
+
+        pt_text flat;
+        pt_text_init(&flat, data, sizeof(data));
+        pt_text split = flat;
+        split.data_start = 7 * 500;
+        split.data = data + split.data_start;
+        split.segment = segmented_at;
+        split.store = data;
+
+        // Queries longer than a segment span several of them. Each one is
+        // narrowed down, then searched again from scratch as if the
+        // shorter query's matches had been given up for lack of memory.
+        PTSearch a = {0};
+        PTSearch b = {0};
+        const char *query = "abbabaabbaab";
+        for (size_t q = 0; q < strlen(query); q++) {
+                pt_search_push(&a, query[q], &flat);
+                for (int round = 0; round < 2; round++) {
+                        if (round == 1) {
+                                if (q > 0)
+                                        b.level[q - 1] = PT_SEARCH_LOST;
+                                pt_search_pop(&b, &split);
+                        }
+                        pt_search_push(&b, query[q], &split);
+                        assert(a.match_count > 0);
+                        assert(a.match_count == b.match_count);
+                        assert(memcmp(a.matches, b.matches,
+                                      a.match_count * sizeof(size_t)) == 0);
+                }
+        }
+        pt_search_free(&a);
+        pt_search_free(&b);
+        putchar('.');
+}
+
+/* A text whose first `data_start` bytes come in segments of 4096 */
+static const char *blocks_at(const pt_text *text, size_t offset,
+                             size_t *start, size_t *seg_len) {
+        *start = offset - offset % 4096;
+        *seg_len = 4096;
+        return (const char *)text->store + *start;
+}
+
+static size_t naive_count(const char *data, size_t from, size_t to,
+                          const char *query, size_t n) {
+        size_t count = 0;
+        for (size_t i = from; i < to && i + n <= to; i++)
+                count += memcmp(data + i, query, n) == 0;
+        return count;
+}
+
+static void test_window_count(void) {
+        static char data[PT_SEARCH_WINDOW + 40 * 4096];
+        srand(5);
+        for (size_t i = 0; i < sizeof(data); i++)
+                data[i] = (char)('a' + rand() % 4);
+        // A query that only matches in the window
+        memcpy(data + sizeof(data) - 100, "zzq", 3);
+
+        pt_text text;
+        pt_text_init(&text, data, sizeof(data));
+        text.data_start = 30 * 4096;
+        text.data = data + text.data_start;
+        text.segment = blocks_at;
+        text.store = data;
+
+        PTSearch search = {0};
+        const char *query = "abcab";
+        size_t window = sizeof(data) - PT_SEARCH_WINDOW;
+        for (size_t q = 0; q < strlen(query); q++) {
+                pt_search_push(&search, query[q], &text);
+                size_t n = q + 1;
+                assert(search.window_start == window);
+                assert(search.match_count ==
+                       naive_count(data, window, sizeof(data), query, n));
+                assert(search.matches[0] >= window);
+
+                // Counted a step at a time, across segment boundaries
+                size_t steps = 0;
+                while (!pt_search_count(&search, &text, 10000))
+                        steps++;
+                assert(steps > 1);
+                assert(!pt_search_is_counting(&search));
+                assert(pt_search_total(&search) ==
+                       naive_count(data, 0, sizeof(data), query, n));
+        }
+
+        // Going back reuses the count of the shorter query
+        size_t total = pt_search_total(&search);
+        pt_search_pop(&search, &text);
+        assert(!pt_search_is_counting(&search));
+        assert(pt_search_total(&search) ==
+               naive_count(data, 0, sizeof(data), query, 4));
+        pt_search_push(&search, 'b', &text);
+        assert(pt_search_is_counting(&search));
+        pt_search_count(&search, &text, (size_t)-1);
+        assert(pt_search_total(&search) == total);
+
+        // Nothing before the window: longer queries need no counting
+        pt_search_clear(&search);
+        pt_search_push(&search, 'z', &text);
+        pt_search_count(&search, &text, (size_t)-1);
+        assert(search.counted == 0);
+        pt_search_push(&search, 'z', &text);
+        assert(!pt_search_is_counting(&search));
+        assert(pt_search_total(&search) == 1);
+        pt_search_free(&search);
+        putchar('.');
+}
+
+int main(void) {
+        printf("Running search tests...\n");
+        test_find_basic();
+        test_find_matches_naive();
+        test_push_refines();
+        test_push_matches_scan();
+        test_first_from();
+        test_segmented();
+        test_window_count();
+
+        putchar('\n');
+        printf("All search tests passed.\n");
+        return 0;
+}
+
+#endif /* PT_TEST */
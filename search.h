@@ -0,0 +1,85 @@
+#ifndef PT_SEARCH_H
+#define PT_SEARCH_H
+#include "ds.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PT_SEARCH_MAX_QUERY 256
+// Matches are only kept in this many bytes at the end of the text, which
+// is more than can be on screen and never reaches the compressed part
+#define PT_SEARCH_WINDOW (256 * 1024)
+// Bytes of text before the window counted by each `pt_search_count` step
+#define PT_SEARCH_COUNT_STEP (1024 * 1024)
+
+// Marks a level whose matches were narrowed down in place, or a count
+// that is not known
+#define PT_SEARCH_LOST ((size_t)-1)
+
+/**
+ * Incremental search state. `matches` holds the offset of every occurrence
+ * of the query, overlapping ones included, in ascending order, from
+ * `window_start` on. Those before it are only counted, a step at a time,
+ * so that a key never waits for the whole document to be searched.
+ *
+ * The matches of every prefix of the query are kept one after the other in
+ * `stack`, those of the prefix of length n from `level[n - 1]`, so that
+ * removing a character goes back to the set before it. Finished counts are
+ * kept alike in `level_counted`.
+ */
+typedef struct {
+        char query[PT_SEARCH_MAX_QUERY];
+        size_t query_len;
+        size_t *matches; // the last level of `stack`
+        size_t match_count;
+        size_t *stack;
+        size_t stack_len;
+        size_t stack_cap;
+        size_t level[PT_SEARCH_MAX_QUERY];
+        size_t window_start;
+        size_t counted;    // matches found before `counted_to`
+        size_t counted_to; // how far the text before the window is counted
+        size_t level_counted[PT_SEARCH_MAX_QUERY];
+        bool is_active;
+} PTSearch;
+
+/**
+ * Returns the first occurrence of `needle` in `haystack`, or NULL. Short
+ * needles skip to candidates with memchr, longer ones use Horspool.
+ */
+const char *pt_search_find(const char *haystack, size_t haystack_len,
+                           const char *needle, size_t needle_len);
+
+/**
+ * Appends `c` to the query. The existing matches are narrowed down into a
+ * new level instead of searching `text` again, and counting starts over
+ * unless the shorter query had no match before the window.
+ */
+void pt_search_push(PTSearch *search, char c, const pt_text *text);
+
+/**
+ * Removes the last character of the query and goes back to the matches of
+ * the shorter one. `text` is only searched again, one segment at a time, if
+ * those had to be given up for lack of memory.
+ */
+void pt_search_pop(PTSearch *search, const pt_text *text);
+
+/**
+ * Counts the matches in up to `budget` more bytes of `text` before the
+ * window. Returns true once all of them are counted.
+ */
+bool pt_search_count(PTSearch *search, const pt_text *text, size_t budget);
+
+/** Whether matches before the window are still being counted */
+bool pt_search_is_counting(const PTSearch *search);
+
+/** Returns the number of matches counted so far, window included */
+size_t pt_search_total(const PTSearch *search);
+
+/** Empties the query and the matches */
+void pt_search_clear(PTSearch *search);
+void pt_search_free(PTSearch *search);
+
+/** Returns the index of the first match at or after `offset` */
+size_t pt_search_first_from(const PTSearch *search, size_t offset);
+
+#endif
@@ -0,0 +1,810 @@
+#define _POSIX_C_SOURCE 200112L
+#include "spell.h"
+#include "ds.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Longer words are never flagged
+#define PT_SPELL_MAX_WORD 64
+// The word cache is emptied when it grows past this
+#define PT_SPELL_CACHE_MAX 65536
+
+/*
+ * Dictionary file: a header followed by the edges of the automaton, one
+ * 32-bit word each in the byte order of the machine that built it. The
+ * edges leaving a node are stored together, sorted by label, and a node is
+ * referred to by the index of its first edge. Index 0 is a dummy edge, so
+ * a target of 0 means a node without edges.
+ */
+#define PT_DICT_MAGIC "porta-dict 1"
+#define PT_DICT_BYTE_ORDER 0x01020304u
+
+#define PT_EDGE_LABEL(edge) ((unsigned char)((edge)&0xFFu))
+#define PT_EDGE_LAST 0x100u  // last edge of its node
+#define PT_EDGE_FINAL 0x200u // a word ends after this edge
+#define PT_EDGE_TARGET_SHIFT 10
+#define PT_DICT_MAX_EDGES (1u << (32 - PT_EDGE_TARGET_SHIFT))
+
+typedef struct {
+        char magic[12];
+        uint32_t byte_order;
+        uint32_t edge_count;
+        uint32_t root;
+} PTDictHeader;
+
+typedef struct {
+        void *map;
+        size_t map_len;
+        const uint32_t *edges;
+        uint32_t edge_count;
+        uint32_t root;
+} PTDict;
+
+static PTDict dict;
+static pt_map word_cache; // word -> 1 if correct, 0 if not
+
+/* ---- dictionary ---- */
+
+static void pt_dict_close(PTDict *d) {
+        if (d->map)
+                munmap(d->map, d->map_len);
+        memset(d, 0, sizeof(PTDict));
+}
+
+/** Maps the dictionary at `path` and checks that lookups stay inside it */
+static int pt_dict_open(PTDict *d, const char *path) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return -1;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(PTDictHeader)) {
+                close(fd);
+                return -1;
+        }
+        size_t size = (size_t)st.st_size;
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+                return -1;
+
+        const PTDictHeader *header = map;
+        const uint32_t *edges =
+                (const uint32_t *)(const void *)((const char *)map +
+                                                 sizeof(PTDictHeader));
+        bool is_valid = memcmp(header->magic, PT_DICT_MAGIC,
+                               sizeof(header->magic)) == 0 &&
+                        header->byte_order == PT_DICT_BYTE_ORDER &&
+                        header->edge_count > 0 &&
+                        size == sizeof(PTDictHeader) +
+                                        (size_t)header->edge_count *
+                                                sizeof(uint32_t) &&
+                        header->root < header->edge_count &&
+                        (edges[header->edge_count - 1] & PT_EDGE_LAST);
+        for (uint32_t i = 0; is_valid && i < header->edge_count; i++)
+                is_valid = edges[i] >> PT_EDGE_TARGET_SHIFT <
+                           header->edge_count;
+        if (!is_valid) {
+                munmap(map, size);
+                return -1;
+        }
+
+        d->map = map;
+        d->map_len = size;
+        d->edges = edges;
+        d->edge_count = header->edge_count;
+        d->root = header->root;
+        return 0;
+}
+
+static bool pt_dict_contains(const PTDict *d, const char *word, size_t len) {
+        if (!d->edges || len == 0)
+                return false;
+        uint32_t node = d->root;
+        uint32_t edge = 0;
+        for (size_t i = 0; i < len; i++) {
+                unsigned char c = (unsigned char)word[i];
+                if (node == 0)
+                        return false;
+                for (uint32_t e = node;; e++) {
+                        edge = d->edges[e];
+                        if (PT_EDGE_LABEL(edge) == c)
+                                break;
+                        if (PT_EDGE_LABEL(edge) > c || (edge & PT_EDGE_LAST))
+                                return false;
+                }
+                node = edge >> PT_EDGE_TARGET_SHIFT;
+        }
+        return (edge & PT_EDGE_FINAL) != 0;
+}
+
+/* ---- building ---- */
+
+typedef struct {
+        unsigned char label;
+        size_t target;
+} PTBuildEdge;
+
+typedef struct {
+        PTBuildEdge *edges;
+        size_t edge_count;
+        size_t edge_cap;
+        bool is_final;
+} PTBuildNode;
+
+/**
+ * Minimal automaton built incrementally from sorted words (Daciuk et al.).
+ * Nodes that can no longer change are merged with an equivalent one from
+ * the registry, keyed by their signature.
+ */
+typedef struct {
+        PTBuildNode *nodes;
+        size_t node_count;
+        size_t node_cap;
+        pt_map registry;
+        size_t path[PT_SPELL_MAX_WORD + 1]; // nodes along the last word
+        size_t path_len;                    // characters of the last word
+} PTBuilder;
+
+static int pt_builder_new_node(PTBuilder *b, size_t *index) {
+        if (b->node_count == b->node_cap) {
+                size_t new_cap = b->node_cap ? b->node_cap * 2 : 1024;
+                PTBuildNode *nodes =
+                        realloc(b->nodes, new_cap * sizeof(PTBuildNode));
+                if (!nodes)
+                        return -1;
+                b->nodes = nodes;
+                b->node_cap = new_cap;
+        }
+        memset(&b->nodes[b->node_count], 0, sizeof(PTBuildNode));
+        *index = b->node_count++;
+        return 0;
+}
+
+static int pt_builder_add_edge(PTBuilder *b, size_t from, unsigned char label,
+                               size_t to) {
+        PTBuildNode *node = &b->nodes[from];
+        if (node->edge_count == node->edge_cap) {
+                size_t new_cap = node->edge_cap ? node->edge_cap * 2 : 2;
+                PTBuildEdge *edges =
+                        realloc(node->edges, new_cap * sizeof(PTBuildEdge));
+                if (!edges)
+                        return -1;
+                node->edges = edges;
+                node->edge_cap = new_cap;
+        }
+        node->edges[node->edge_count].label = label;
+        node->edges[node->edge_count].target = to;
+        node->edge_count++;
+        return 0;
+}
+
+/** Replaces the nodes of the last word below `depth` by registered ones */
+static int pt_builder_minimize(PTBuilder *b, size_t depth) {
+        pt_str signature;
+        if (pt_str_init(&signature) != 0)
+                return -1;
+        for (size_t k = b->path_len; k > depth; k--) {
+                size_t child = b->path[k];
+                PTBuildNode *node = &b->nodes[child];
+
+                signature.len = 0;
+                signature.data[0] = '\0';
+                pt_str_append(&signature, node->is_final ? "F" : "N");
+                for (size_t e = 0; e < node->edge_count; e++) {
+                        char part[48];
+                        snprintf(part, sizeof(part), ",%u:%zu",
+                                 (unsigned)node->edges[e].label,
+                                 node->edges[e].target);
+                        pt_str_append(&signature, part);
+                }
+
+                size_t existing;
+                if (pt_map_get(&b->registry, signature.data, &existing)) {
+                        PTBuildNode *parent = &b->nodes[b->path[k - 1]];
+                        parent->edges[parent->edge_count - 1].target = existing;
+                        free(node->edges);
+                        memset(node, 0, sizeof(PTBuildNode));
+                } else if (pt_map_put(&b->registry, signature.data, child) !=
+                           0) {
+                        pt_str_free(&signature);
+                        return -1;
+                }
+        }
+        b->path_len = depth;
+        pt_str_free(&signature);
+        return 0;
+}
+
+static int pt_builder_add_word(PTBuilder *b, const char *word, size_t len) {
+        size_t prefix = 0;
+        while (prefix < len && prefix < b->path_len) {
+                const PTBuildNode *node = &b->nodes[b->path[prefix]];
+                if (node->edges[node->edge_count - 1].label !=
+                    (unsigned char)word[prefix])
+                        break;
+                prefix++;
+        }
+        if (pt_builder_minimize(b, prefix) != 0)
+                return -1;
+
+        for (size_t i = prefix; i < len; i++) {
+                size_t next;
+                if (pt_builder_new_node(b, &next) != 0 ||
+                    pt_builder_add_edge(b, b->path[i], (unsigned char)word[i],
+                                        next) != 0)
+                        return -1;
+                b->path[i + 1] = next;
+        }
+        b->path_len = len;
+        b->nodes[b->path[len]].is_final = true;
+        return 0;
+}
+
+/** Lays the nodes reachable from the root out as edge runs and writes them */
+static int pt_builder_write(const PTBuilder *b, FILE *out) {
+        size_t *offsets = calloc(b->node_count, sizeof(size_t));
+        size_t *order = malloc(b->node_count * sizeof(size_t));
+        uint32_t *edges = NULL;
+        int rc = -1;
+        if (!offsets || !order)
+                goto done;
+
+        // offsets[n] is 1 + the index of the first edge of n once placed
+        size_t edge_count = 1; // the dummy edge
+        size_t order_len = 0;
+        order[order_len++] = 0;
+        offsets[0] = edge_count + 1;
+        edge_count += b->nodes[0].edge_count;
+        for (size_t i = 0; i < order_len; i++) {
+                const PTBuildNode *node = &b->nodes[order[i]];
+                for (size_t e = 0; e < node->edge_count; e++) {
+                        size_t target = node->edges[e].target;
+                        if (offsets[target] || b->nodes[target].edge_count == 0)
+                                continue;
+                        offsets[target] = edge_count + 1;
+                        edge_count += b->nodes[target].edge_count;
+                        order[order_len++] = target;
+                }
+        }
+        if (edge_count > PT_DICT_MAX_EDGES) {
+                fprintf(stderr, "dictionary too large: %zu edges\n",
+                        edge_count);
+                goto done;
+        }
+
+        edges = calloc(edge_count, sizeof(uint32_t));
+        if (!edges)
+                goto done;
+        edges[0] = PT_EDGE_LAST;
+        for (size_t i = 0; i < order_len; i++) {
+                const PTBuildNode *node = &b->nodes[order[i]];
+                size_t first = offsets[order[i]] - 1;
+                for (size_t e = 0; e < node->edge_count; e++) {
+                        const PTBuildNode *target =
+                                &b->nodes[node->edges[e].target];
+                        size_t target_offset =
+                                target->edge_count
+                                        ? offsets[node->edges[e].target] - 1
+                                        : 0;
+                        uint32_t edge =
+                                (uint32_t)node->edges[e].label |
+                                (uint32_t)target_offset << PT_EDGE_TARGET_SHIFT;
+                        if (e + 1 == node->edge_count)
+                                edge |= PT_EDGE_LAST;
+                        if (target->is_final)
+                                edge |= PT_EDGE_FINAL;
+                        edges[first + e] = edge;
+                }
+        }
+
+        PTDictHeader header;
+        memcpy(header.magic, PT_DICT_MAGIC, sizeof(header.magic));
+        header.byte_order = PT_DICT_BYTE_ORDER;
+        header.edge_count = (uint32_t)edge_count;
+        header.root = b->nodes[0].edge_count ? (uint32_t)(offsets[0] - 1) : 0;
+        if (fwrite(&header, sizeof(header), 1, out) == 1 &&
+            fwrite(edges, sizeof(uint32_t), edge_count, out) == edge_count)
+                rc = 0;
+
+done:
+        free(offsets);
+        free(order);
+        free(edges);
+        return rc;
+}
+
+static int pt_compare_words(const void *a, const void *b) {
+        return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/** Reads `path` and splits it into lines, which end up sorted and unique */
+static char *pt_read_words(const char *path, char ***words_out,
+                           size_t *count_out) {
+        FILE *file = fopen(path, "r");
+        if (!file)
+                return NULL;
+        pt_str *text = pt_str_new();
+        char chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk) - 1, file)) > 0) {
+                chunk[n] = '\0';
+                // A NUL in the list would end the chunk early, like a line
+                pt_str_append(text, chunk);
+        }
+        fclose(file);
+
+        size_t count = 0, cap = 0;
+        char **words = NULL;
+        char *p = text->data;
+        while (*p) {
+                char *end = strchr(p, '\n');
+                char *next = end ? end + 1 : p + strlen(p);
+                if (!end)
+                        end = next;
+                while (end > p && (end[-1] == '\r' || end[-1] == ' ' ||
+                                   end[-1] == '\t'))
+                        end--;
+                *end = '\0';
+                size_t len = (size_t)(end - p);
+                if (len > 0 && len <= PT_SPELL_MAX_WORD && *p != '#') {
+                        if (count == cap) {
+                                cap = cap ? cap * 2 : 1024;
+                                char **grown = realloc(words, cap * sizeof(char *));
+                                if (!grown)
+                                        break;
+                                words = grown;
+                        }
+                        words[count++] = p;
+                }
+                p = next;
+        }
+
+        if (count > 0)
+                qsort(words, count, sizeof(char *), pt_compare_words);
+        size_t unique = 0;
+        for (size_t i = 0; i < count; i++)
+                if (unique == 0 || strcmp(words[unique - 1], words[i]) != 0)
+                        words[unique++] = words[i];
+
+        // The caller frees the text through its data
+        char *data = text->data;
+        free(text);
+        *words_out = words;
+        *count_out = unique;
+        return data;
+}
+
+int pt_spell_build_dict(const char *words_path, const char *dict_path) {
+        char **words;
+        size_t count;
+        char *text = pt_read_words(words_path, &words, &count);
+        if (!text) {
+                perror(words_path);
+                return -1;
+        }
+
+        PTBuilder builder;
+        memset(&builder, 0, sizeof(PTBuilder));
+        int rc = pt_map_init(&builder.registry);
+        if (rc == 0)
+                rc = pt_builder_new_node(&builder, &builder.path[0]);
+        for (size_t i = 0; rc == 0 && i < count; i++)
+                rc = pt_builder_add_word(&builder, words[i], strlen(words[i]));
+        if (rc == 0)
+                rc = pt_builder_minimize(&builder, 0);
+
+        if (rc == 0) {
+                FILE *out = fopen(dict_path, "wb");
+                if (!out) {
+                        perror(dict_path);
+                        rc = -1;
+                } else {
+                        rc = pt_builder_write(&builder, out);
+                        if (fclose(out) != 0)
+                                rc = -1;
+                }
+        }
+
+        for (size_t i = 0; i < builder.node_count; i++)
+                free(builder.nodes[i].edges);
+        free(builder.nodes);
+        pt_map_free(&builder.registry);
+        free(words);
+        free(text);
+        return rc;
+}
+
+/* ---- words ---- */
+
+bool pt_spell_init(void) {
+        const char *path = getenv("PORTA_DICT");
+        if (!path || !*path)
+                return false;
+        pt_dict_close(&dict);
+        if (pt_dict_open(&dict, path) != 0) {
+                fprintf(stderr, "%s: not a porta dictionary\n", path);
+                return false;
+        }
+        pt_map_free(&word_cache);
+        pt_map_init(&word_cache);
+        return true;
+}
+
+bool pt_spell_is_enabled(void) { return dict.edges != NULL; }
+
+/** Looks `word` up as is, in lower case and without 's. Clobbers `word` */
+static bool pt_spell_lookup(char *word, size_t len) {
+        if (pt_dict_contains(&dict, word, len))
+                return true;
+
+        bool has_upper = false;
+        for (size_t i = 0; i < len; i++) {
+                if (word[i] >= 'A' && word[i] <= 'Z') {
+                        word[i] = (char)(word[i] - 'A' + 'a');
+                        has_upper = true;
+                }
+        }
+        if (has_upper && pt_dict_contains(&dict, word, len))
+                return true;
+
+        if (len > 2 && word[len - 2] == '\'' && word[len - 1] == 's')
+                return pt_dict_contains(&dict, word, len - 2);
+        if (len > 4 && memcmp(word + len - 4, "\xe2\x80\x99s", 4) == 0)
+                return pt_dict_contains(&dict, word, len - 4);
+        return false;
+}
+
+bool pt_spell_is_correct(const char *word, size_t len) {
+        if (!dict.edges || len == 0 || len > PT_SPELL_MAX_WORD)
+                return true;
+
+        char key[PT_SPELL_MAX_WORD + 1];
+        memcpy(key, word, len);
+        key[len] = '\0';
+        size_t cached;
+        if (pt_map_get(&word_cache, key, &cached))
+                return cached != 0;
+
+        char scratch[PT_SPELL_MAX_WORD + 1];
+        memcpy(scratch, key, len + 1);
+        bool is_correct = pt_spell_lookup(scratch, len);
+        if (word_cache.len >= PT_SPELL_CACHE_MAX) {
+                pt_map_free(&word_cache);
+                pt_map_init(&word_cache);
+        }
+        pt_map_put(&word_cache, key, is_correct ? 1 : 0);
+        return is_correct;
+}
+
+static bool pt_spell_is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool pt_spell_is_letter(char c) {
+        unsigned char u = (unsigned char)c;
+        return (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || u >= 0x80;
+}
+
+/** Punctuation and markup around a word, but not digits */
+static bool pt_spell_is_trimmed(char c) {
+        return !pt_spell_is_letter(c) && !(c >= '0' && c <= '9');
+}
+
+/** Length of the typographic quote, dash or ellipsis at `p`, or 0 */
+static size_t pt_spell_punct_len(const char *p, const char *end) {
+        if (end - p < 3 || (unsigned char)p[0] != 0xE2 ||
+            (unsigned char)p[1] != 0x80)
+                return 0;
+        switch ((unsigned char)p[2]) {
+        case 0x93: // en dash
+        case 0x94: // em dash
+        case 0x98: // quotes
+        case 0x99:
+        case 0x9C:
+        case 0x9D:
+        case 0xA6: // ellipsis
+                return 3;
+        default:
+                return 0;
+        }
+}
+
+static bool pt_spell_is_dash(const char *p, const char *end, size_t *len) {
+        if (*p == '-') {
+                *len = 1;
+                return true;
+        }
+        *len = pt_spell_punct_len(p, end);
+        return *len > 0 && (unsigned char)p[2] <= 0x94;
+}
+
+static void pt_spell_add_span(PTSpell *spell, size_t start, size_t end) {
+        if (spell->span_count == spell->span_cap) {
+                size_t new_cap = spell->span_cap ? spell->span_cap * 2 : 16;
+                PTSpellSpan *spans =
+                        realloc(spell->spans, new_cap * sizeof(PTSpellSpan));
+                if (!spans)
+                        return;
+                spell->spans = spans;
+                spell->span_cap = new_cap;
+        }
+        spell->spans[spell->span_count].start = start;
+        spell->spans[spell->span_count].end = end;
+        spell->span_count++;
+}
+
+/**
+ * Checks the run of non-whitespace `text[start, end)`. Surrounding
+ * punctuation and markup are ignored, dashes separate words, and runs with
+ * digits or other symbols inside (numbers, links, paths) are skipped.
+ */
+static void pt_spell_check_run(PTSpell *spell, const char *text, size_t start,
+                               size_t end) {
+        const char *p = text + start;
+        const char *q = text + end;
+        while (p < q) {
+                size_t n = pt_spell_punct_len(p, q);
+                if (n == 0 && !pt_spell_is_trimmed(*p))
+                        break;
+                p += n ? n : 1;
+        }
+        while (q > p) {
+                if (q - p >= 3 && pt_spell_punct_len(q - 3, q))
+                        q -= 3;
+                else if (pt_spell_is_trimmed(q[-1]))
+                        q--;
+                else
+                        break;
+        }
+
+        for (const char *c = p; c < q; c++)
+                if (!pt_spell_is_letter(*c) && *c != '\'' && *c != '-')
+                        return;
+
+        const char *word = p;
+        while (p <= q) {
+                size_t dash = 0;
+                if (p == q || pt_spell_is_dash(p, q, &dash)) {
+                        if (p > word &&
+                            !pt_spell_is_correct(word, (size_t)(p - word)))
+                                pt_spell_add_span(spell,
+                                                  (size_t)(word - text),
+                                                  (size_t)(p - text));
+                        if (p == q)
+                                break;
+                        p += dash;
+                        word = p;
+                } else {
+                        p++;
+                }
+        }
+}
+
+void pt_spell_update(PTSpell *spell, const char *text, size_t len) {
+        if (!dict.edges)
+                return;
+        if (spell->checked > len)
+                spell->checked = len;
+
+        // Start over from the run that the edit touched
+        size_t from = spell->checked;
+        while (from > 0 && !pt_spell_is_space(text[from - 1]))
+                from--;
+        while (spell->span_count > 0 &&
+               spell->spans[spell->span_count - 1].start >= from)
+                spell->span_count--;
+
+        size_t i = from;
+        while (i < len) {
+                if (pt_spell_is_space(text[i])) {
+                        i++;
+                        continue;
+                }
+                size_t start = i;
+                while (i < len && !pt_spell_is_space(text[i]))
+                        i++;
+                if (i == len) {
+                        // Still being typed
+                        spell->checked = start;
+                        return;
+                }
+                pt_spell_check_run(spell, text, start, i);
+        }
+        spell->checked = len;
+}
+
+void pt_spell_rebuild(PTSpell *spell, const char *text, size_t len) {
+        spell->span_count = 0;
+        spell->checked = 0;
+        pt_spell_update(spell, text, len);
+}
+
+void pt_spell_drop_front(PTSpell *spell, size_t len) {
+        size_t kept = 0;
+        for (size_t i = 0; i < spell->span_count; i++) {
+                if (spell->spans[i].start < len)
+                        continue;
+                spell->spans[kept].start = spell->spans[i].start - len;
+                spell->spans[kept].end = spell->spans[i].end - len;
+                kept++;
+        }
+        spell->span_count = kept;
+        spell->checked = spell->checked > len ? spell->checked - len : 0;
+}
+
+void pt_spell_free(PTSpell *spell) {
+        free(spell->spans);
+        memset(spell, 0, sizeof(PTSpell));
+}
+
+#ifdef PT_TEST
+
+#include <assert.h>
+
+static char dict_path[64];
+
+static void write_file(const char *path, const char *data, size_t len) {
+        FILE *file = fopen(path, "wb");
+        assert(file);
+        assert(fwrite(data, 1, len, file) == len);
+        fclose(file);
+}
+
+static void build_test_dict(const char *words) {
+        char words_path[64];
+        snprintf(words_path, sizeof(words_path), "/tmp/porta_words_%ld",
+                 (long)getpid());
+        snprintf(dict_path, sizeof(dict_path), "/tmp/porta_dict_%ld",
+                 (long)getpid());
+        write_file(words_path, words, strlen(words));
+        assert(pt_spell_build_dict(words_path, dict_path) == 0);
+        unlink(words_path);
+        setenv("PORTA_DICT", dict_path, 1);
+        assert(pt_spell_init());
+}
+
+static void test_dict_lookup(void) {
+        // Unsorted, duplicated and with CRLF endings on purpose
+        build_test_dict("walking\nwalk\ntalk\r\ntalking\nwalked\ntalked\n"
+                        "a\nwalk\nzebra\ncafé\nEnglish\n# comment\n\n");
+        const char *present[] = {"walk",   "walking", "walked", "talk",
+                                 "talked", "a",       "zebra",  "café",
+                                 "English"};
+        for (size_t i = 0; i < sizeof(present) / sizeof(present[0]); i++)
+                assert(pt_dict_contains(&dict, present[i],
+                                        strlen(present[i])));
+        const char *absent[] = {"wal", "walks", "talkingg", "b", "zebr",
+                                "cafe", "english", "# comment", ""};
+        for (size_t i = 0; i < sizeof(absent) / sizeof(absent[0]); i++)
+                assert(!pt_dict_contains(&dict, absent[i], strlen(absent[i])));
+
+        // Suffixes are shared: walk/talk with -ed/-ing need few edges
+        assert(dict.edge_count < 40);
+        putchar('.');
+}
+
+static void test_word_forms(void) {
+        assert(pt_spell_is_correct("Walk", 4));
+        assert(pt_spell_is_correct("WALKING", 7));
+        assert(pt_spell_is_correct("zebra's", 7));
+        assert(pt_spell_is_correct("zebra\xe2\x80\x99s", 9));
+        assert(pt_spell_is_correct("English", 7));
+        assert(!pt_spell_is_correct("walkk", 5));
+        // Cached answers stay the same
+        assert(!pt_spell_is_correct("walkk", 5));
+        assert(pt_spell_is_correct("walk", 4));
+        putchar('.');
+}
+
+static bool has_span(const PTSpell *spell, const char *text,
+                     const char *word) {
+        for (size_t i = 0; i < spell->span_count; i++) {
+                size_t len = spell->spans[i].end - spell->spans[i].start;
+                if (len == strlen(word) &&
+                    memcmp(text + spell->spans[i].start, word, len) == 0)
+                        return true;
+        }
+        return false;
+}
+
+static void test_runs(void) {
+        PTSpell spell;
+        memset(&spell, 0, sizeof(PTSpell));
+        const char *text = "**walk** (talkd), “zebra” walk-tlak 42nd "
+                           "[[note|alias]] e.g. walk—zebar walkk";
+        pt_spell_rebuild(&spell, text, strlen(text));
+        assert(spell.span_count == 3);
+        assert(has_span(&spell, text, "talkd"));
+        assert(has_span(&spell, text, "tlak"));
+        assert(has_span(&spell, text, "zebar"));
+        // The last word is still being typed
+        assert(!has_span(&spell, text, "walkk"));
+        pt_spell_free(&spell);
+        putchar('.');
+}
+
+static void test_incremental(void) {
+        PTSpell spell, fresh;
+        memset(&spell, 0, sizeof(PTSpell));
+        memset(&fresh, 0, sizeof(PTSpell));
+        const char *typed = "walk tlak\nzebra walkd  a talking wlk \n";
+        char text[64];
+        size_t len = 0;
+
+        // Type everything, then delete it again, comparing with a rebuild
+        size_t total = strlen(typed);
+        for (size_t step = 0; step < 2 * total; step++) {
+                if (step < total)
+                        text[len++] = typed[step];
+                else
+                        len--;
+                pt_spell_update(&spell, text, len);
+                pt_spell_rebuild(&fresh, text, len);
+                assert(spell.span_count == fresh.span_count);
+                for (size_t i = 0; i < spell.span_count; i++) {
+                        assert(spell.spans[i].start == fresh.spans[i].start);
+                        assert(spell.spans[i].end == fresh.spans[i].end);
+                }
+                if (step == total - 1)
+                        assert(spell.span_count == 3);
+        }
+        assert(spell.span_count == 0);
+
+        // Dropping whole lines from the front shifts what is left
+        strcpy(text, typed);
+        len = total;
+        pt_spell_rebuild(&spell, text, len);
+        pt_spell_drop_front(&spell, 10);
+        pt_spell_rebuild(&fresh, text + 10, len - 10);
+        assert(spell.span_count == 2 && fresh.span_count == 2);
+        assert(spell.checked == fresh.checked);
+        for (size_t i = 0; i < spell.span_count; i++) {
+                assert(spell.spans[i].start == fresh.spans[i].start);
+                assert(spell.spans[i].end == fresh.spans[i].end);
+        }
+        pt_spell_free(&spell);
+        pt_spell_free(&fresh);
+        putchar('.');
+}
+
+static void test_bad_files(void) {
+        PTDict bad;
+        assert(pt_dict_open(&bad, "/nonexistent/porta.dict") != 0);
+
+        // A truncated dictionary is rejected
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/porta_bad_dict_%ld",
+                 (long)getpid());
+        FILE *in = fopen(dict_path, "rb");
+        char buf[64];
+        size_t n = fread(buf, 1, sizeof(buf), in);
+        fclose(in);
+        assert(n > 30);
+        write_file(path, buf, n - 4);
+        assert(pt_dict_open(&bad, path) != 0);
+        unlink(path);
+        putchar('.');
+}
+
+int main(void) {
+        printf("Running spell tests...\n");
+        test_dict_lookup();
+        test_word_forms();
+        test_runs();
+        test_incremental();
+        test_bad_files();
+        unlink(dict_path);
+
+        putchar('\n');
+        printf("All spell tests passed.\n");
+        return 0;
+}
+
+#endif /* PT_TEST */
@@ -0,0 +1,57 @@
+#ifndef PT_SPELL_H
+#define PT_SPELL_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Spell checking against a dictionary built from a plain word list with
+ * `porta --build-dict` (see `make dict`). The dictionary is a minimal
+ * acyclic automaton (DAWG) that is mmapped as is, and is picked with
+ * $PORTA_DICT. Without one, nothing is flagged.
+ */
+
+typedef struct {
+        size_t start;
+        size_t end;
+} PTSpellSpan;
+
+/**
+ * Misspelled words of a document. A word is checked once it is followed by
+ * whitespace, so editing the end of the document only rechecks the last
+ * word.
+ */
+typedef struct {
+        PTSpellSpan *spans; // in document order
+        size_t span_count;
+        size_t span_cap;
+        size_t checked; // words before this offset are done
+} PTSpell;
+
+/** Loads the dictionary named by $PORTA_DICT. Returns false if there is none */
+bool pt_spell_init(void);
+bool pt_spell_is_enabled(void);
+
+/** Checks every word of `text` */
+void pt_spell_rebuild(PTSpell *spell, const char *text, size_t len);
+
+/** Catches up with `text` after characters were added or removed at its end */
+void pt_spell_update(PTSpell *spell, const char *text, size_t len);
+
+/**
+ * Accounts for the first `len` bytes of the text having been taken away.
+ * They must end with whitespace.
+ */
+void pt_spell_drop_front(PTSpell *spell, size_t len);
+
+void pt_spell_free(PTSpell *spell);
+
+/** Looks up a single word, trying lower case and without a possessive 's */
+bool pt_spell_is_correct(const char *word, size_t len);
+
+/**
+ * Builds a dictionary at `dict_path` from `words_path`, one word per line.
+ * Returns 0 on success.
+ */
+int pt_spell_build_dict(const char *words_path, const char *dict_path);
+
+#endif
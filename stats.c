@@ -0,0 +1,217 @@
+#define _POSIX_C_SOURCE 200112L
+#include "stats.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define PT_WORDS_PER_MINUTE 200
+
+static bool pt_is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+               c == '\f';
+}
+
+static bool pt_is_continuation(char c) {
+        return ((unsigned char)c & 0xC0) == 0x80;
+}
+
+/** Accounts for `c`, appended after whitespace or to an empty document */
+static void pt_stats_count(PTStats *stats, char c, bool after_space,
+                           bool is_first) {
+        if (!pt_is_continuation(c))
+                stats->chars++;
+        if (is_first)
+                stats->lines = 1;
+        if (c == '\n')
+                stats->lines++;
+
+        if (pt_is_space(c)) {
+                if (!after_space)
+                        stats->tail_newlines = 0;
+                if (c == '\n')
+                        stats->tail_newlines++;
+                return;
+        }
+
+        if (after_space) {
+                // A word after a blank line, or the first word, starts a
+                // paragraph
+                if (stats->words == 0 || stats->tail_newlines >= 2)
+                        stats->paragraphs++;
+                stats->words++;
+        }
+        stats->tail_newlines = 0;
+}
+
+void pt_stats_add(PTStats *stats, const char *text, size_t len) {
+        if (len == 0)
+                return;
+        pt_stats_count(stats, text[len - 1],
+                       len == 1 || pt_is_space(text[len - 2]), len == 1);
+}
+
+void pt_stats_extend(PTStats *stats, const char *prev, const char *text,
+                     size_t len) {
+        for (size_t i = 0; i < len; i++) {
+                pt_stats_count(stats, text[i], !prev || pt_is_space(*prev),
+                               !prev);
+                prev = text + i;
+        }
+}
+
+void pt_stats_remove(PTStats *stats, char removed, const char *text,
+                     size_t len) {
+        if (!pt_is_continuation(removed))
+                stats->chars--;
+        if (removed == '\n')
+                stats->lines--;
+        if (len == 0) {
+                memset(stats, 0, sizeof(PTStats));
+                return;
+        }
+
+        bool after_space = pt_is_space(text[len - 1]);
+        if (pt_is_space(removed)) {
+                if (removed == '\n' && stats->tail_newlines > 0)
+                        stats->tail_newlines--;
+                if (!after_space)
+                        stats->tail_newlines = 0;
+                return;
+        }
+        if (!after_space)
+                return;
+
+        // The removed character started a word: find out whether it also
+        // started a paragraph by looking at the whitespace before it
+        size_t newlines = 0;
+        size_t i = len;
+        while (i > 0 && pt_is_space(text[i - 1])) {
+                if (text[i - 1] == '\n')
+                        newlines++;
+                i--;
+        }
+        stats->tail_newlines = newlines;
+        stats->words--;
+        if (stats->words == 0 || newlines >= 2)
+                stats->paragraphs--;
+}
+
+void pt_stats_rebuild(PTStats *stats, const char *text, size_t len) {
+        memset(stats, 0, sizeof(PTStats));
+        pt_stats_extend(stats, NULL, text, len);
+}
+
+size_t pt_stats_reading_minutes(const PTStats *stats) {
+        return (stats->words + PT_WORDS_PER_MINUTE - 1) / PT_WORDS_PER_MINUTE;
+}
+
+#ifdef PT_TEST
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void assert_same(const PTStats *a, const PTStats *b) {
+        assert(a->words == b->words);
+        assert(a->chars == b->chars);
+        assert(a->lines == b->lines);
+        assert(a->paragraphs == b->paragraphs);
+        assert(a->tail_newlines == b->tail_newlines);
+}
+
+static void test_rebuild(void) {
+        const char *text = "# Title\n\nOne two  three.\nfour\n\n\n  five six";
+        PTStats stats;
+        pt_stats_rebuild(&stats, text, strlen(text));
+        assert(stats.words == 8);
+        assert(stats.chars == strlen(text));
+        assert(stats.lines == 7);
+        assert(stats.paragraphs == 3);
+        putchar('.');
+}
+
+static void test_extend_in_pieces(void) {
+        const char *text = "# Title\n\nOne two  three.\nfour\n\n\n  five six";
+        size_t len = strlen(text);
+        PTStats whole;
+        pt_stats_rebuild(&whole, text, len);
+        for (size_t cut = 0; cut <= len; cut++) {
+                PTStats pieces;
+                memset(&pieces, 0, sizeof(pieces));
+                pt_stats_extend(&pieces, NULL, text, cut);
+                pt_stats_extend(&pieces, cut ? text + cut - 1 : NULL,
+                                text + cut, len - cut);
+                assert_same(&pieces, &whole);
+        }
+        putchar('.');
+}
+
+static void test_empty(void) {
+        PTStats stats;
+        pt_stats_rebuild(&stats, "", 0);
+        assert(stats.words == 0);
+        assert(stats.chars == 0);
+        assert(stats.lines == 0);
+        assert(stats.paragraphs == 0);
+        assert(pt_stats_reading_minutes(&stats) == 0);
+        putchar('.');
+}
+
+static void test_utf8_chars(void) {
+        const char *text = "h\xc3\xa9llo w\xc3\xb6rld \xe2\x9c\x93";
+        PTStats stats;
+        pt_stats_rebuild(&stats, text, strlen(text));
+        assert(stats.chars == 13);
+        assert(stats.words == 3);
+        putchar('.');
+}
+
+static void test_reading_minutes(void) {
+        PTStats stats = {0};
+        stats.words = 1;
+        assert(pt_stats_reading_minutes(&stats) == 1);
+        stats.words = PT_WORDS_PER_MINUTE;
+        assert(pt_stats_reading_minutes(&stats) == 1);
+        stats.words = PT_WORDS_PER_MINUTE + 1;
+        assert(pt_stats_reading_minutes(&stats) == 2);
+        putchar('.');
+}
+
+static void test_random_edits_match_rebuild(void) {
+        const char alphabet[] = "ab \n\t\xc3\xa9";
+        char text[4096];
+        size_t len = 0;
+        PTStats live = {0};
+        PTStats fresh;
+        srand(3);
+
+        for (int step = 0; step < 20000; step++) {
+                if (len > 0 && (rand() % 3 == 0 || len == sizeof(text))) {
+                        char removed = text[--len];
+                        pt_stats_remove(&live, removed, text, len);
+                } else {
+                        text[len++] =
+                                alphabet[rand() % (int)(sizeof(alphabet) - 1)];
+                        pt_stats_add(&live, text, len);
+                }
+                pt_stats_rebuild(&fresh, text, len);
+                assert_same(&live, &fresh);
+        }
+        putchar('.');
+}
+
+int main(void) {
+        printf("Running stats tests...\n");
+        test_rebuild();
+        test_extend_in_pieces();
+        test_empty();
+        test_utf8_chars();
+        test_reading_minutes();
+        test_random_edits_match_rebuild();
+
+        putchar('\n');
+        printf("All stats tests passed.\n");
+        return 0;
+}
+
+#endif /* PT_TEST */
@@ -0,0 +1,43 @@
+#ifndef PT_STATS_H
+#define PT_STATS_H
+#include <stddef.h>
+
+/**
+ * Document statistics, kept up to date one character at a time so that
+ * showing them costs nothing per frame.
+ */
+typedef struct {
+        size_t words;      // runs of non-whitespace
+        size_t chars;      // UTF-8 code points
+        size_t lines;      // newlines + 1, or 0 for an empty document
+        size_t paragraphs; // words preceded by a blank line or nothing
+        size_t tail_newlines; // newlines in the trailing whitespace run
+} PTStats;
+
+/** Recounts everything in `text` */
+void pt_stats_rebuild(PTStats *stats, const char *text, size_t len);
+
+/** Accounts for the last character of `text`, which was just appended */
+void pt_stats_add(PTStats *stats, const char *text, size_t len);
+
+/**
+ * Accounts for `len` bytes appended at once to a document whose last
+ * character is at `prev`, or which was empty if `prev` is NULL. This lets
+ * a document be counted in pieces.
+ */
+void pt_stats_extend(PTStats *stats, const char *prev, const char *text,
+                     size_t len);
+
+/**
+ * Accounts for `removed` having been deleted from the end of `text`, which
+ * is now `len` bytes long. O(1), except that removing the first character
+ * of a word rescans the whitespace before it back to the previous word,
+ * which costs as much as that whitespace is long.
+ */
+void pt_stats_remove(PTStats *stats, char removed, const char *text,
+                     size_t len);
+
+/** Estimated reading time in whole minutes, rounded up */
+size_t pt_stats_reading_minutes(const PTStats *stats);
+
+#endif
@@ -1,13 +1,61 @@
 #define _POSIX_C_SOURCE 200112L
 #include "term.h"
+#include "ds.h"
+#include "prof.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <locale.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <wchar.h>
 
+// A terminal holding more than a frame budget of output is behind
+#define PT_FRAME_BUDGET_MS 16
+#define PT_MIN_BACKLOG 512
+#define PT_MAX_DRAIN_WAIT_MS 50
+#define PT_INPUT_WAIT_MS 100
+
 static struct termios orig_termios;
+static int orig_flags = -1; // of the file description of stdin and stdout
+static PTSink *sink;
+static size_t bytes_written;
+
+/*
+ * Screen output is collected here and written with write(2). On a terminal
+ * it is written without blocking, so a slow link never stalls the editor.
+ */
+static char *out_buf;
+static size_t out_len;
+static size_t out_sent;
+static size_t out_cap;
+static bool is_paced;
+
+/*
+ * Ptys report no output queue, so the queue is also modelled: it fills with
+ * every byte written and drains at the rate the terminal took bytes while
+ * it was full, measured again each time it empties. While the terminal
+ * keeps up, the rate recovers toward the default.
+ */
+#define PT_DEFAULT_DRAIN_BYTES_PER_MS 1000.0
+#define PT_MIN_DRAIN_BYTES_PER_MS 0.5
+#define PT_RATE_WINDOW_MS 100.0
+static double drain_bytes_per_ms = PT_DEFAULT_DRAIN_BYTES_PER_MS;
+static double rate_ms; // when the drain rate last changed
+static double queue_model;
+static double model_ms;
+static bool is_full;
+static double full_ms;
+static size_t full_sent;
+static size_t sent_total;
+static bool is_hashing_output;
+static unsigned long long output_hash = PT_HASH_SEED;
 
 void pt_die(const char *s) {
         perror(s);
@@ -15,19 +63,33 @@ void pt_die(const char *s) {
 }
 
 static void pt_switch_to_alt_buffer(void) {
-        printf("\033[?1049h\033[H");
-        fflush(stdout);
+        pt_puts("\033[?1049h\033[H");
+        pt_flush();
 }
 
+static void pt_send(bool is_blocking);
+
 static void pt_switch_from_alt_buffer(void) {
-        printf("\033[?1049l");
-        fflush(stdout);
+        pt_puts("\033[?1049l");
+        pt_send(true);
 }
 
 static void pt_disable_raw_mode(void) {
         if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios) == -1)
                 pt_die("tcsetattr");
         pt_switch_from_alt_buffer();
+        // The shell shares the file description, which may have been left
+        // non-blocking by an exit during a write
+        if (orig_flags != -1)
+                fcntl(fileno(stdout), F_SETFL, orig_flags);
+}
+
+/** Gives the terminal back as it was when killed, then dies as asked */
+static void pt_restore_on_signal(int sig) {
+        fcntl(fileno(stdout), F_SETFL, orig_flags);
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
+        signal(sig, SIG_DFL);
+        raise(sig);
 }
 
 static void pt_enable_raw_mode(void) {
@@ -37,6 +99,11 @@ static void pt_enable_raw_mode(void) {
                 pt_die("tcgetattr");
 
         atexit(pt_disable_raw_mode); // Auto cleanup on exit
+        orig_flags = fcntl(fileno(stdout), F_GETFL);
+        if (orig_flags != -1) {
+                signal(SIGTERM, pt_restore_on_signal);
+                signal(SIGHUP, pt_restore_on_signal);
+        }
 
         struct termios raw = orig_termios;
         raw.c_lflag &= (tcflag_t) ~(ECHO | ICANON | ISIG | IEXTEN);
@@ -52,7 +119,7 @@ static void pt_enable_raw_mode(void) {
 }
 
 void pt_init_term(void) {
-        printf("\n");
+        pt_puts("\n");
 
         if (!setlocale(LC_CTYPE, "")) { // Empty string for all locales
                 pt_die("setlocale");
@@ -60,11 +127,245 @@ void pt_init_term(void) {
         fwide(stdout, 1); // Set the wide character orientation for stdout
 
         pt_enable_raw_mode();
+        is_paced = isatty(fileno(stdout)) == 1;
 }
 
 void pt_move_cursor(unsigned short row, unsigned short col) {
         if (row >= 1 && col >= 1) {
-                printf("\x1b[%d;%dH", row, col);
+                char seq[32];
+                int n = snprintf(seq, sizeof(seq), "\x1b[%d;%dH", row, col);
+                pt_write(seq, (size_t)n);
+        }
+}
+
+/** Whether output is written without waiting and paced to the terminal */
+static bool pt_is_paced(void) {
+        return sink ? sink->try_write != NULL : is_paced;
+}
+
+void pt_set_sink(PTSink *new_sink) {
+        sink = new_sink;
+        out_sent = out_len = 0;
+        drain_bytes_per_ms = PT_DEFAULT_DRAIN_BYTES_PER_MS;
+        queue_model = 0;
+        is_full = false;
+}
+
+void pt_write(const char *data, size_t len) {
+        if (sink && !sink->try_write) {
+                sink->write(sink, data, len);
+                bytes_written += len;
+        } else {
+                if (out_len + len > out_cap) {
+                        size_t cap = out_cap ? out_cap : 4096;
+                        while (cap < out_len + len)
+                                cap *= 2;
+                        char *buf = realloc(out_buf, cap);
+                        if (!buf)
+                                pt_die("realloc");
+                        out_buf = buf;
+                        out_cap = cap;
+                }
+                memcpy(out_buf + out_len, data, len);
+                out_len += len;
+                bytes_written += len;
         }
+        if (is_hashing_output)
+                output_hash = pt_hash_bytes(output_hash, data, len);
 }
 
+void pt_puts(const char *s) { pt_write(s, strlen(s)); }
+
+void pt_flush(void) {
+        if (sink && !sink->try_write)
+                sink->flush(sink);
+        else
+                pt_send(!pt_is_paced());
+        pt_prof_flushed();
+}
+
+void pt_flush_all(void) {
+        if (sink && !sink->try_write)
+                sink->flush(sink);
+        else
+                pt_send(true);
+        pt_prof_flushed();
+}
+
+static double pt_now_ms(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void pt_drain_model(double now) {
+        queue_model -= drain_bytes_per_ms * (now - model_ms);
+        if (queue_model < 0)
+                queue_model = 0;
+        model_ms = now;
+}
+
+/** Takes in a measured drain rate, smoothing it while below the default */
+static void pt_update_drain_rate(double rate, double now) {
+        if (rate < PT_MIN_DRAIN_BYTES_PER_MS)
+                rate = PT_MIN_DRAIN_BYTES_PER_MS;
+        drain_bytes_per_ms = drain_bytes_per_ms < PT_DEFAULT_DRAIN_BYTES_PER_MS
+                                     ? 0.5 * drain_bytes_per_ms + 0.5 * rate
+                                     : rate;
+        rate_ms = now;
+}
+
+/**
+ * Learns the drain rate from writes that found the terminal full: while it
+ * stays full, it takes bytes exactly as fast as it drains them, and once
+ * it has emptied it took them at least that fast.
+ */
+static void pt_observe_terminal(bool is_now_full, double now) {
+        double elapsed = now - full_ms;
+        if (!is_now_full) {
+                if (is_full && elapsed >= PT_RATE_WINDOW_MS)
+                        pt_update_drain_rate(
+                                (double)(sent_total - full_sent) / elapsed,
+                                now);
+                else if (drain_bytes_per_ms < PT_DEFAULT_DRAIN_BYTES_PER_MS &&
+                         now - rate_ms >= PT_RATE_WINDOW_MS)
+                        // The terminal keeps up, so the rate may be stale
+                        pt_update_drain_rate(PT_DEFAULT_DRAIN_BYTES_PER_MS,
+                                             now);
+                is_full = false;
+                return;
+        }
+        if (!is_full) {
+                full_ms = now;
+                full_sent = sent_total;
+        } else if (elapsed >= PT_RATE_WINDOW_MS) {
+                pt_update_drain_rate(
+                        (double)(sent_total - full_sent) / elapsed, now);
+                full_ms = now;
+                full_sent = sent_total;
+        }
+        is_full = true;
+}
+
+/** write(2) to the terminal, or to a sink that takes output like one */
+static ssize_t pt_write_out(int fd, const char *data, size_t len) {
+        if (!sink)
+                return write(fd, data, len);
+        size_t n = sink->try_write(sink, data, len);
+        if (n > 0)
+                return (ssize_t)n;
+        errno = EAGAIN;
+        return -1;
+}
+
+/** Writes buffered output, giving up when the terminal is full unless blocking */
+static void pt_send(bool is_blocking) {
+        int fd = fileno(stdout);
+        int flags = is_blocking || sink ? -1 : fcntl(fd, F_GETFL);
+        if (flags != -1)
+                fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+        pt_drain_model(pt_now_ms());
+        bool has_output = out_sent < out_len;
+        bool is_now_full = false;
+        while (out_sent < out_len) {
+                ssize_t n =
+                        pt_write_out(fd, out_buf + out_sent, out_len - out_sent);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        // Nothing can be done about any other error
+                        if (errno != EAGAIN && errno != EWOULDBLOCK)
+                                out_sent = out_len;
+                        else
+                                is_now_full = true;
+                        break;
+                }
+                out_sent += (size_t)n;
+                sent_total += (size_t)n;
+                queue_model += (double)n;
+        }
+        if (!is_blocking && has_output)
+                pt_observe_terminal(is_now_full, pt_now_ms());
+
+        // stdin shares the file description, so it must not stay non-blocking
+        if (flags != -1)
+                fcntl(fd, F_SETFL, flags);
+        if (out_sent == out_len)
+                out_sent = out_len = 0;
+}
+
+/** Bytes written to the terminal that it has not shown yet */
+static double pt_output_queue(void) {
+        pt_drain_model(pt_now_ms());
+#ifdef TIOCOUTQ
+        int queued = 0;
+        if (!sink && ioctl(fileno(stdout), TIOCOUTQ, &queued) == 0 &&
+            queued > 0)
+                return (double)queued;
+#endif
+        return queue_model;
+}
+
+static double pt_backlog_limit(void) {
+        double limit = drain_bytes_per_ms * PT_FRAME_BUDGET_MS;
+        return limit > PT_MIN_BACKLOG ? limit : PT_MIN_BACKLOG;
+}
+
+bool pt_output_is_behind(void) {
+        if (!pt_is_paced())
+                return false;
+        pt_send(false);
+        if (out_sent < out_len)
+                return true;
+        return pt_output_queue() > pt_backlog_limit();
+}
+
+/** How long the queue above the limit takes to drain */
+static int pt_drain_wait_ms(void) {
+        double queue = pt_output_queue() + (double)(out_len - out_sent);
+        double ms = (queue - pt_backlog_limit()) / drain_bytes_per_ms;
+        if (ms < 1.0)
+                return 1;
+        return ms > PT_MAX_DRAIN_WAIT_MS ? PT_MAX_DRAIN_WAIT_MS : (int)ms;
+}
+
+bool pt_wait_for_input(bool wants_output) {
+        for (;;) {
+                struct pollfd fds[2];
+                fds[0].fd = STDIN_FILENO;
+                fds[0].events = POLLIN;
+                fds[1].fd = fileno(stdout);
+                fds[1].events = POLLOUT;
+                nfds_t count = out_sent < out_len ? 2 : 1;
+                int timeout = wants_output ? pt_drain_wait_ms()
+                                           : PT_INPUT_WAIT_MS;
+
+                int ready = poll(fds, count, timeout);
+                if (ready < 0) {
+                        if (errno != EINTR)
+                                pt_die("poll");
+                        continue;
+                }
+                if (count == 2 && fds[1].revents)
+                        pt_send(false);
+                if (ready > 0 && fds[0].revents)
+                        return true;
+                if (wants_output ? !pt_output_is_behind() : ready == 0)
+                        return false;
+        }
+}
+
+bool pt_input_is_ready(void) {
+        struct pollfd fd;
+        fd.fd = STDIN_FILENO;
+        fd.events = POLLIN;
+        return poll(&fd, 1, 0) > 0;
+}
+
+size_t pt_bytes_written(void) { return bytes_written; }
+
+void pt_hash_output(bool enable) { is_hashing_output = enable; }
+
+unsigned long long pt_output_hash(void) { return output_hash; }
+
@@ -1,12 +1,64 @@
 #ifndef TERM_H
 #define TERM_H
+#include <stdbool.h>
 #include <stddef.h>
 
-#define pt_clear_screen() printf("\033[H\033[J")
+#define pt_clear_screen() pt_puts("\033[H\033[J")
 
 void pt_die(const char *s);
 void pt_init_term(void);
 
 void pt_move_cursor(unsigned short row, unsigned short col);
 
+/**
+ * Destination of screen output. `pt_set_sink(NULL)` restores the default,
+ * which writes to stdout. A sink is usually the first member of a larger
+ * struct, which its callbacks get back to by casting.
+ *
+ * A sink with `try_write` is written to like a terminal instead, and
+ * `write` and `flush` are not used: it takes what it can without waiting
+ * and returns how much, and output is paced as on a slow link.
+ */
+typedef struct PTSink {
+        void (*write)(struct PTSink *sink, const char *data, size_t len);
+        void (*flush)(struct PTSink *sink);
+        size_t (*try_write)(struct PTSink *sink, const char *data, size_t len);
+} PTSink;
+
+/** Switches the output to `sink`, dropping what the last one did not take */
+void pt_set_sink(PTSink *sink);
+
+/* All screen output goes through these so that it can be measured */
+void pt_write(const char *data, size_t len);
+void pt_puts(const char *s);
+void pt_flush(void);
+
+/**
+ * Writes out all output, waiting for the terminal if needed, for a screen
+ * that stays up without being redrawn
+ */
+void pt_flush_all(void);
+size_t pt_bytes_written(void);
+
+/**
+ * True while the terminal has not caught up with the output, judged by the
+ * output not written yet, the kernel queue and the observed drain rate.
+ * Drawing a frame then only adds to the lag.
+ */
+bool pt_output_is_behind(void);
+
+/**
+ * Waits for a key while writing out pending output. Returns true when a key
+ * is ready, false on a timeout or, if `wants_output`, as soon as the
+ * terminal has caught up so a skipped frame can be drawn.
+ */
+bool pt_wait_for_input(bool wants_output);
+
+/** Whether a key is ready to be read, without waiting for one */
+bool pt_input_is_ready(void);
+
+/** Hash all output from now on, e.g. to compare two runs byte for byte */
+void pt_hash_output(bool enable);
+unsigned long long pt_output_hash(void);
+
 #endif
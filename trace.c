@@ -0,0 +1,362 @@
+#define _POSIX_C_SOURCE 200112L
+#include "trace.h"
+#include "ds.h"
+#include "editor.h"
+#include "prof.h"
+#include "render.h"
+#include "spell.h"
+#include "term.h"
+#include "vt.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PT_TRACE_HEADER "porta-trace"
+#define PT_TRACE_VERSION 2
+
+typedef struct {
+        unsigned long long at_us; // since the start of the recording
+        unsigned short rows;
+        unsigned short cols;
+        char key;
+} PTTraceEvent;
+
+static FILE *recording;
+static unsigned long long recording_start;
+static unsigned short current_rows, current_cols;
+
+static PTTraceEvent *replay_events;
+static size_t replay_count;
+static size_t replay_next;
+static pt_str **replay_buffers; // paths of the buffers after the first
+static size_t replay_buffer_count;
+
+static unsigned long long pt_trace_now_us(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long long)ts.tv_sec * 1000000ULL +
+               (unsigned long long)ts.tv_nsec / 1000ULL;
+}
+
+static void pt_trace_close(void) {
+        if (recording)
+                fclose(recording);
+        recording = NULL;
+}
+
+void pt_trace_init(PTState *state) {
+        const char *path = getenv("PORTA_TRACE");
+        if (!path || !*path)
+                return;
+
+        recording = fopen(path, "w");
+        if (!recording) {
+                perror(path);
+                return;
+        }
+        // The document is identified so a replay can tell it starts from
+        // different text. The paths of the other buffers follow, each
+        // after its length.
+        pt_text text;
+        pt_buffer_text(&state->buffers[0], &text);
+        fprintf(recording, "%s %d %zu %llu %zu\n", PT_TRACE_HEADER,
+                PT_TRACE_VERSION, text.len, pt_text_hash(&text),
+                state->buffer_count - 1);
+        for (size_t i = 1; i < state->buffer_count; i++) {
+                const pt_str *name = state->buffers[i].filename;
+                fprintf(recording, "%zu %s\n", name->len, name->data);
+        }
+        recording_start = pt_trace_now_us();
+        atexit(pt_trace_close);
+}
+
+void pt_trace_set_size(unsigned short rows, unsigned short cols) {
+        current_rows = rows;
+        current_cols = cols;
+}
+
+void pt_trace_record(char c) {
+        if (!recording)
+                return;
+        fprintf(recording, "%llu %u %u %u\n",
+                pt_trace_now_us() - recording_start, current_rows,
+                current_cols, (unsigned)(unsigned char)c);
+        // Keep the trace usable if porta is killed
+        fflush(recording);
+}
+
+bool pt_trace_is_replaying(void) { return replay_events != NULL; }
+
+char pt_trace_next_key(void) {
+        if (replay_next >= replay_count)
+                return CTRL_KEY('q');
+        return replay_events[replay_next++].key;
+}
+
+/** Forgets the loaded trace and the buffer paths not handed out */
+static void pt_trace_unload(void) {
+        for (size_t i = 0; replay_buffers && i < replay_buffer_count; i++) {
+                if (replay_buffers[i])
+                        pt_str_free(replay_buffers[i]);
+                free(replay_buffers[i]);
+        }
+        free(replay_buffers);
+        replay_buffers = NULL;
+        replay_buffer_count = 0;
+        free(replay_events);
+        replay_events = NULL;
+        replay_count = 0;
+        replay_next = 0;
+}
+
+static int pt_trace_load(FILE *file, size_t *doc_len,
+                         unsigned long long *doc_hash) {
+        int version;
+        if (fscanf(file, PT_TRACE_HEADER " %d %zu %llu", &version, doc_len,
+                   doc_hash) != 3)
+                return -1;
+        // Version 1 traces had no buffer list
+        if (version == PT_TRACE_VERSION) {
+                if (fscanf(file, "%zu", &replay_buffer_count) != 1)
+                        return -1;
+                replay_buffers =
+                        calloc(replay_buffer_count + 1, sizeof(pt_str *));
+                if (!replay_buffers)
+                        return -1;
+                for (size_t i = 0; i < replay_buffer_count; i++) {
+                        size_t len;
+                        if (fscanf(file, "%zu", &len) != 1 ||
+                            fgetc(file) != ' ')
+                                return -1;
+                        pt_str *name = pt_str_new();
+                        replay_buffers[i] = name;
+                        if (!name || pt_str_reserve(name, len) != 0 ||
+                            fread(name->data, 1, len, file) != len)
+                                return -1;
+                        name->len = len;
+                        name->data[len] = '\0';
+                }
+        } else if (version != 1) {
+                return -1;
+        }
+
+        size_t cap = 0;
+        unsigned long long at;
+        unsigned rows, cols, key;
+        while (fscanf(file, "%llu %u %u %u", &at, &rows, &cols, &key) == 4) {
+                if (replay_count == cap) {
+                        cap = cap ? cap * 2 : 256;
+                        PTTraceEvent *events = realloc(
+                                replay_events, cap * sizeof(PTTraceEvent));
+                        if (!events)
+                                return -1;
+                        replay_events = events;
+                }
+                PTTraceEvent *event = &replay_events[replay_count++];
+                event->at_us = at;
+                event->rows = (unsigned short)rows;
+                event->cols = (unsigned short)cols;
+                event->key = (char)key;
+        }
+        return 0;
+}
+
+/** Screen output of a replay, kept on an emulated screen and in a file */
+typedef struct {
+        PTSink sink;
+        PTVT vt;
+} PTReplayTee;
+
+static void pt_tee_write(PTSink *sink, const char *data, size_t len) {
+        pt_vt_feed(&((PTReplayTee *)sink)->vt, data, len);
+        fwrite(data, 1, len, stdout);
+}
+
+static void pt_tee_flush(PTSink *sink) {
+        pt_vt_end_frame(&((PTReplayTee *)sink)->vt);
+        fflush(stdout);
+}
+
+static int pt_compare_ull(const void *a, const void *b) {
+        unsigned long long x = *(const unsigned long long *)a;
+        unsigned long long y = *(const unsigned long long *)b;
+        return x < y ? -1 : x > y;
+}
+
+static void pt_replay_wait_until(unsigned long long start_us,
+                                 unsigned long long at_us) {
+        unsigned long long now = pt_trace_now_us() - start_us;
+        if (now >= at_us)
+                return;
+        unsigned long long wait = at_us - now;
+        struct timespec ts;
+        ts.tv_sec = (time_t)(wait / 1000000ULL);
+        ts.tv_nsec = (long)(wait % 1000000ULL) * 1000L;
+        nanosleep(&ts, NULL);
+}
+
+int pt_replay(const PTReplayOptions *options, const char *filename) {
+        FILE *file = fopen(options->trace_path, "r");
+        if (!file) {
+                perror(options->trace_path);
+                return 1;
+        }
+        size_t doc_len;
+        unsigned long long doc_hash;
+        int rc = pt_trace_load(file, &doc_len, &doc_hash);
+        fclose(file);
+        if (rc != 0 || replay_count == 0) {
+                fprintf(stderr, "%s: not a porta trace\n",
+                        options->trace_path);
+                pt_trace_unload();
+                return 1;
+        }
+        // Following links and listing backlinks need the vault, and
+        // opening one would write its index
+        for (size_t i = 0; i < replay_count; i++) {
+                char key = replay_events[i].key;
+                if (key == CTRL_KEY('q'))
+                        break;
+                if (key == CTRL_KEY('g') || key == CTRL_KEY('b')) {
+                        fprintf(stderr,
+                                "%s: uses the vault, which a replay cannot "
+                                "open\n",
+                                options->trace_path);
+                        pt_trace_unload();
+                        return 1;
+                }
+        }
+
+        const char *output = options->output_path ? options->output_path
+                                                  : "/dev/null";
+        if (!freopen(output, "w", stdout)) {
+                perror(output);
+                pt_trace_unload();
+                return 1;
+        }
+
+        pt_prof_init();
+        pt_spell_init();
+        pt_str *name = pt_str_from(filename);
+        PTState *state = pt_new_glob_state(name);
+        state->is_headless = true;
+        pt_load_from_file(state, name);
+        for (size_t i = 0; i < replay_buffer_count; i++) {
+                pt_open_buffer(state, replay_buffers[i]);
+                replay_buffers[i] = NULL;
+        }
+        pt_switch_buffer(state, 0);
+        pt_text text;
+        pt_buffer_text(&state->buffers[state->active], &text);
+        if (text.len != doc_len || pt_text_hash(&text) != doc_hash)
+                fprintf(stderr, "warning: %s differs from the traced "
+                                "document\n",
+                        filename);
+
+        unsigned long long *costs =
+                calloc(replay_count, sizeof(unsigned long long));
+        size_t *keys = calloc(replay_count, sizeof(size_t));
+        if (!costs || !keys) {
+                perror("calloc");
+                free(costs);
+                free(keys);
+                pt_trace_unload();
+                return 1;
+        }
+
+        PTReplayTee tee;
+        if (pt_vt_init(&tee.vt, replay_events[0].rows, replay_events[0].cols) !=
+            0) {
+                fprintf(stderr, "%s: bad terminal size\n", options->trace_path);
+                free(costs);
+                free(keys);
+                pt_trace_unload();
+                return 1;
+        }
+        tee.sink.write = pt_tee_write;
+        tee.sink.flush = pt_tee_flush;
+        tee.sink.try_write = NULL;
+        pt_set_sink(&tee.sink);
+
+        pt_hash_output(true);
+        size_t measured = 0;
+        unsigned long long start = pt_trace_now_us();
+        while (replay_next < replay_count) {
+                const PTTraceEvent *event = &replay_events[replay_next];
+                if (event->key == CTRL_KEY('q'))
+                        break;
+                if (options->is_paced)
+                        pt_replay_wait_until(start, event->at_us);
+
+                if (event->rows != state->rows || event->cols != state->cols)
+                        pt_vt_resize(&tee.vt, event->rows, event->cols);
+                state->rows = event->rows;
+                state->cols = event->cols;
+                keys[measured] = replay_next;
+
+                unsigned long long before = pt_trace_now_us();
+                pt_handle_key_press(state);
+                unsigned long long cost = pt_trace_now_us() - before;
+                // The editor counts search matches between keys, so that
+                // is not part of the key's cost, but it is done before the
+                // frame for the screen not to depend on timing
+                pt_count_matches(state, (size_t)-1);
+                before = pt_trace_now_us();
+                pt_render_state(state);
+                costs[measured++] = cost + pt_trace_now_us() - before;
+        }
+        pt_set_sink(NULL);
+        fflush(stdout);
+
+        if (options->report_path) {
+                FILE *report = fopen(options->report_path, "w");
+                if (report) {
+                        fprintf(report, "# key_index key_byte cost_us\n");
+                        for (size_t i = 0; i < measured; i++)
+                                fprintf(report, "%zu %u %llu\n", keys[i],
+                                        (unsigned)(unsigned char)
+                                                replay_events[keys[i]]
+                                                        .key,
+                                        costs[i]);
+                        fclose(report);
+                } else {
+                        perror(options->report_path);
+                }
+        }
+
+        unsigned long long total = 0;
+        for (size_t i = 0; i < measured; i++)
+                total += costs[i];
+        qsort(costs, measured, sizeof(unsigned long long), pt_compare_ull);
+        if (measured > 0) {
+                fprintf(stderr,
+                        "keys %zu  total %.3f ms  mean %.1f us  p50 %llu us  "
+                        "p99 %llu us  max %llu us\n",
+                        measured, (double)total / 1e3,
+                        (double)total / (double)measured,
+                        costs[measured / 2], costs[measured * 99 / 100],
+                        costs[measured - 1]);
+        }
+        fprintf(stderr, "output %zu bytes  hash %016llx\n",
+                pt_bytes_written(), pt_output_hash());
+        const PTVTCounters *counters = &tee.vt.total;
+        if (counters->frames > 0) {
+                double frames = (double)counters->frames;
+                fprintf(stderr,
+                        "frames %zu  per frame %.0f bytes  %.1f sequences  "
+                        "%.1f cursor moves\n",
+                        counters->frames, (double)counters->bytes / frames,
+                        (double)counters->sequences / frames,
+                        (double)counters->cursor_moves / frames);
+        }
+        fprintf(stderr, "screen %ux%u  hash %016llx\n", tee.vt.cols,
+                tee.vt.rows, pt_vt_screen_hash(&tee.vt));
+
+        pt_vt_free(&tee.vt);
+        free(costs);
+        free(keys);
+        pt_trace_unload();
+        return 0;
+}
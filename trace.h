@@ -0,0 +1,42 @@
+#ifndef PT_TRACE_H
+#define PT_TRACE_H
+#include "editor.h"
+#include <stdbool.h>
+
+/*
+ * Keystroke traces. With $PORTA_TRACE set, every key read is written to
+ * that file together with its time and the terminal size. A trace can be
+ * replayed headlessly against the file it was recorded on, with the other
+ * buffers that were open reopened from the same paths.
+ */
+
+/** Starts recording if $PORTA_TRACE is set, with the buffers of `state` */
+void pt_trace_init(PTState *state);
+
+/** Remembers the terminal size for the keys that follow */
+void pt_trace_set_size(unsigned short rows, unsigned short cols);
+
+void pt_trace_record(char c);
+
+/** True while a replay is feeding keys */
+bool pt_trace_is_replaying(void);
+
+/** Next key of the replay, or Ctrl-Q once the trace is exhausted */
+char pt_trace_next_key(void);
+
+typedef struct {
+        const char *trace_path;
+        const char *output_path; // screen output, /dev/null if NULL
+        const char *report_path; // per key costs, none if NULL
+        bool is_paced;           // keep the recorded timing
+} PTReplayOptions;
+
+/**
+ * Replays a trace on `filename` without a terminal and prints a summary of
+ * the per-key cost and a hash of the screen output to stderr. Traces that
+ * follow links or list backlinks are refused, since a replay has no vault.
+ * Returns 0 on success.
+ */
+int pt_replay(const PTReplayOptions *options, const char *filename);
+
+#endif
@@ -0,0 +1,922 @@
+#define _POSIX_C_SOURCE 200112L
+#include "vault.h"
+#include "ds.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <errno.h>
+#include <sys/inotify.h>
+#endif
+
+#define PT_VAULT_INDEX_NAME ".porta-index"
+#define PT_VAULT_INDEX_HEADER "porta-index 1\n"
+#define PT_VAULT_LINK_SEP '\x1f'
+// Directories deeper than this below the root are not walked
+#define PT_VAULT_MAX_DEPTH 8
+#define PT_VAULT_REFRESH_SECONDS 60
+// Exit status of a refresher that could not watch every directory
+#define PT_VAULT_UNWATCHED 2
+#ifdef __linux__
+#define PT_VAULT_WATCH_EVENTS                                               \
+        (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |           \
+         IN_MOVED_TO | IN_ONLYDIR)
+#endif
+
+static void pt_str_reset(pt_str *s) {
+        s->len = 0;
+        s->data[0] = '\0';
+}
+
+/**
+ * Turns a link target, file name or title into the key used for lookups:
+ * alias and heading parts are dropped, as is a trailing ".md", and the
+ * result is trimmed and lowercased.
+ */
+static void pt_vault_key(const char *text, size_t len, pt_str *out) {
+        pt_str_reset(out);
+
+        size_t end = 0;
+        while (end < len && text[end] != '|' && text[end] != '#')
+                end++;
+        size_t start = 0;
+        while (start < end && isspace((unsigned char)text[start]))
+                start++;
+        while (end > start && isspace((unsigned char)text[end - 1]))
+                end--;
+        if (end - start >= 3 && strncmp(text + end - 3, ".md", 3) == 0)
+                end -= 3;
+
+        for (size_t i = start; i < end; i++)
+                pt_str_append_char(out,
+                                   (char)tolower((unsigned char)text[i]));
+}
+
+static char *pt_vault_read_all(const char *path, size_t *size_out) {
+        FILE *file = fopen(path, "r");
+        if (!file)
+                return NULL;
+
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        if (size < 0) {
+                fclose(file);
+                return NULL;
+        }
+
+        char *data = malloc((size_t)size + 1);
+        if (!data || fread(data, 1, (size_t)size, file) != (size_t)size) {
+                free(data);
+                fclose(file);
+                return NULL;
+        }
+        data[size] = '\0';
+        fclose(file);
+        *size_out = (size_t)size;
+        return data;
+}
+
+static void pt_vault_full_path(const PTVault *vault, const char *rel_path,
+                               pt_str *out) {
+        pt_str_reset(out);
+        pt_str_append(out, vault->root.data);
+        pt_str_append_char(out, '/');
+        pt_str_append(out, rel_path);
+}
+
+/* ---- note list helpers ---- */
+
+static void pt_list_push(PTNoteList *list, size_t item) {
+        if (list->len == list->cap) {
+                size_t new_cap = list->cap ? list->cap * 2 : 4;
+                size_t *items = realloc(list->items, new_cap * sizeof(size_t));
+                if (!items)
+                        return;
+                list->items = items;
+                list->cap = new_cap;
+        }
+        list->items[list->len++] = item;
+}
+
+static void pt_list_remove(PTNoteList *list, size_t item) {
+        for (size_t i = 0; i < list->len; i++) {
+                if (list->items[i] == item) {
+                        list->items[i] = list->items[--list->len];
+                        return;
+                }
+        }
+}
+
+static void pt_note_free(PTNote *note) {
+        pt_str_free(&note->path);
+        pt_str_free(&note->title);
+        pt_str_free(&note->links);
+}
+
+/* ---- indexing ---- */
+
+static void pt_vault_map_remove_if(pt_map *map, const char *key, size_t idx) {
+        size_t current;
+        if (pt_map_get(map, key, &current) && current == idx)
+                pt_map_remove(map, key);
+}
+
+static void pt_vault_name_keys(const PTNote *note, pt_str *name,
+                               pt_str *path) {
+        const char *base = strrchr(note->path.data, '/');
+        base = base ? base + 1 : note->path.data;
+        pt_vault_key(base, strlen(base), name);
+        pt_vault_key(note->path.data, note->path.len, path);
+}
+
+static void pt_vault_index_note(PTVault *vault, size_t idx) {
+        PTNote *note = &vault->notes[idx];
+        pt_str name, path, key;
+        pt_str_init(&name);
+        pt_str_init(&path);
+        pt_str_init(&key);
+
+        pt_map_put(&vault->files, note->path.data, idx);
+        pt_vault_name_keys(note, &name, &path);
+        pt_map_put(&vault->names, path.data, idx);
+        pt_map_put(&vault->names, name.data, idx);
+
+        pt_vault_key(note->title.data, note->title.len, &key);
+        if (key.len > 0 && !pt_map_get(&vault->titles, key.data, NULL))
+                pt_map_put(&vault->titles, key.data, idx);
+
+        for (const char *p = note->links.data; *p;) {
+                const char *nl = strchr(p, '\n');
+                pt_str_reset(&key);
+                pt_str_append_n(&key, p, (size_t)(nl - p));
+                p = nl + 1;
+
+                size_t list_idx;
+                if (!pt_map_get(&vault->backlinks, key.data, &list_idx)) {
+                        if (vault->list_count == vault->list_cap) {
+                                size_t new_cap = vault->list_cap
+                                                         ? vault->list_cap * 2
+                                                         : 64;
+                                PTNoteList *lists =
+                                        realloc(vault->lists,
+                                                new_cap * sizeof(PTNoteList));
+                                if (!lists)
+                                        continue;
+                                vault->lists = lists;
+                                vault->list_cap = new_cap;
+                        }
+                        list_idx = vault->list_count++;
+                        memset(&vault->lists[list_idx], 0, sizeof(PTNoteList));
+                        pt_map_put(&vault->backlinks, key.data, list_idx);
+                }
+                pt_list_push(&vault->lists[list_idx], idx);
+        }
+
+        pt_str_free(&name);
+        pt_str_free(&path);
+        pt_str_free(&key);
+}
+
+static void pt_vault_unindex_note(PTVault *vault, size_t idx) {
+        PTNote *note = &vault->notes[idx];
+        pt_str name, path, key;
+        pt_str_init(&name);
+        pt_str_init(&path);
+        pt_str_init(&key);
+
+        pt_vault_map_remove_if(&vault->files, note->path.data, idx);
+        pt_vault_name_keys(note, &name, &path);
+        pt_vault_map_remove_if(&vault->names, path.data, idx);
+        pt_vault_map_remove_if(&vault->names, name.data, idx);
+        pt_vault_key(note->title.data, note->title.len, &key);
+        pt_vault_map_remove_if(&vault->titles, key.data, idx);
+
+        for (const char *p = note->links.data; *p;) {
+                const char *nl = strchr(p, '\n');
+                pt_str_reset(&key);
+                pt_str_append_n(&key, p, (size_t)(nl - p));
+                p = nl + 1;
+
+                size_t list_idx;
+                if (pt_map_get(&vault->backlinks, key.data, &list_idx))
+                        pt_list_remove(&vault->lists[list_idx], idx);
+        }
+
+        pt_str_free(&name);
+        pt_str_free(&path);
+        pt_str_free(&key);
+}
+
+static size_t pt_vault_add_note(PTVault *vault, const char *rel_path) {
+        if (vault->note_count == vault->note_cap) {
+                size_t new_cap = vault->note_cap ? vault->note_cap * 2 : 64;
+                PTNote *notes =
+                        realloc(vault->notes, new_cap * sizeof(PTNote));
+                if (!notes)
+                        return (size_t)-1;
+                // Short strings are kept inside the notes
+                for (size_t i = 0; i < vault->note_count; i++) {
+                        pt_str_moved(&notes[i].path);
+                        pt_str_moved(&notes[i].title);
+                        pt_str_moved(&notes[i].links);
+                }
+                vault->notes = notes;
+                vault->note_cap = new_cap;
+        }
+
+        PTNote *note = &vault->notes[vault->note_count];
+        memset(note, 0, sizeof(PTNote));
+        pt_str_init(&note->path);
+        pt_str_init(&note->title);
+        pt_str_init(&note->links);
+        pt_str_append(&note->path, rel_path);
+        return vault->note_count++;
+}
+
+/**
+ * Extracts the title and the link targets of a note from its text. Tabs
+ * and newlines never end up in either, so they can be stored line based.
+ */
+static void pt_vault_parse_note(PTNote *note, const char *text) {
+        pt_str_reset(&note->title);
+        pt_str_reset(&note->links);
+
+        for (const char *p = text; p && *p; p = strchr(p, '\n')) {
+                if (*p == '\n')
+                        p++;
+                if (*p != '#')
+                        continue;
+                p += strspn(p, "#");
+                if (*p != ' ')
+                        continue;
+                p++;
+                size_t len = strcspn(p, "\t\n");
+                pt_str_append_n(&note->title, p, len);
+                break;
+        }
+
+        pt_str key;
+        pt_str_init(&key);
+        for (const char *p = strstr(text, "[["); p; p = strstr(p, "[[")) {
+                const char *start = p + 2;
+                const char *end = strstr(start, "]]");
+                if (!end)
+                        break;
+                p = end + 2;
+                if (memchr(start, '\n', (size_t)(end - start)) ||
+                    memchr(start, '\t', (size_t)(end - start)))
+                        continue;
+
+                pt_vault_key(start, (size_t)(end - start), &key);
+                if (key.len == 0)
+                        continue;
+                pt_str_append_char(&key, '\n');
+
+                // Skip targets this note already links to
+                bool duplicate = false;
+                for (const char *q = note->links.data; *q;
+                     q = strchr(q, '\n') + 1) {
+                        if (strncmp(q, key.data, key.len) == 0) {
+                                duplicate = true;
+                                break;
+                        }
+                }
+                if (!duplicate)
+                        pt_str_append(&note->links, key.data);
+        }
+        pt_str_free(&key);
+}
+
+static int pt_vault_read_note(PTVault *vault, PTNote *note,
+                              const struct stat *st) {
+        pt_str full;
+        pt_str_init(&full);
+        pt_vault_full_path(vault, note->path.data, &full);
+
+        size_t size;
+        char *text = pt_vault_read_all(full.data, &size);
+        pt_str_free(&full);
+        if (!text)
+                return -1;
+
+        pt_vault_parse_note(note, text);
+        note->mtime = (long)st->st_mtime;
+        note->size = (long)st->st_size;
+        free(text);
+        return 0;
+}
+
+/* ---- persistence ---- */
+
+static void pt_vault_clear(PTVault *vault) {
+        for (size_t i = 0; i < vault->note_count; i++)
+                pt_note_free(&vault->notes[i]);
+        for (size_t i = 0; i < vault->list_count; i++)
+                free(vault->lists[i].items);
+        vault->note_count = 0;
+        vault->list_count = 0;
+
+        pt_map_free(&vault->files);
+        pt_map_free(&vault->names);
+        pt_map_free(&vault->titles);
+        pt_map_free(&vault->backlinks);
+        pt_map_init(&vault->files);
+        pt_map_init(&vault->names);
+        pt_map_init(&vault->titles);
+        pt_map_init(&vault->backlinks);
+}
+
+static void pt_vault_remember_index(PTVault *vault) {
+        struct stat st;
+        if (stat(vault->index_path.data, &st) == 0) {
+                vault->index_mtime = (long)st.st_mtime;
+                vault->index_size = (long)st.st_size;
+                vault->index_ino = (long)st.st_ino;
+        }
+}
+
+/**
+ * Loads the index file. Each line holds the mtime, size, path, title and
+ * the '\x1f' separated link targets of a note, separated by tabs. Lines
+ * appended for a note that is already listed replace its entry.
+ */
+static int pt_vault_load(PTVault *vault) {
+        size_t size;
+        char *data = pt_vault_read_all(vault->index_path.data, &size);
+        if (!data)
+                return -1;
+
+        size_t header_len = strlen(PT_VAULT_INDEX_HEADER);
+        if (size < header_len ||
+            strncmp(data, PT_VAULT_INDEX_HEADER, header_len) != 0) {
+                free(data);
+                return -1;
+        }
+
+        pt_vault_clear(vault);
+        pt_vault_remember_index(vault);
+
+        char *line = data + header_len;
+        while (*line) {
+                char *nl = strchr(line, '\n');
+                if (!nl)
+                        break;
+                *nl = '\0';
+
+                char *fields[5];
+                size_t field_count = 0;
+                char *p = line;
+                while (field_count < 5) {
+                        fields[field_count++] = p;
+                        char *tab = strchr(p, '\t');
+                        if (!tab)
+                                break;
+                        *tab = '\0';
+                        p = tab + 1;
+                }
+                line = nl + 1;
+                if (field_count != 5 || fields[2][0] == '\0')
+                        continue;
+
+                // A line appended later for the same note replaces it
+                size_t idx;
+                if (pt_map_get(&vault->files, fields[2], &idx)) {
+                        pt_vault_unindex_note(vault, idx);
+                        pt_str_reset(&vault->notes[idx].title);
+                        pt_str_reset(&vault->notes[idx].links);
+                } else {
+                        idx = pt_vault_add_note(vault, fields[2]);
+                        if (idx == (size_t)-1)
+                                break;
+                }
+                PTNote *note = &vault->notes[idx];
+                note->mtime = strtol(fields[0], NULL, 10);
+                note->size = strtol(fields[1], NULL, 10);
+                pt_str_append(&note->title, fields[3]);
+                for (char *c = fields[4]; *c; c++) {
+                        pt_str_append_char(&note->links,
+                                           *c == PT_VAULT_LINK_SEP ? '\n'
+                                                                   : *c);
+                }
+                if (note->links.len > 0 &&
+                    note->links.data[note->links.len - 1] != '\n')
+                        pt_str_append_char(&note->links, '\n');
+                pt_vault_index_note(vault, idx);
+        }
+
+        free(data);
+        return 0;
+}
+
+static void pt_vault_write_note(FILE *file, const PTNote *note) {
+        fprintf(file, "%ld\t%ld\t%s\t%s\t", note->mtime, note->size,
+                note->path.data, note->title.data);
+        for (const char *c = note->links.data; *c; c++) {
+                // The last link is not followed by a separator
+                if (*c != '\n')
+                        fputc(*c, file);
+                else if (c[1])
+                        fputc(PT_VAULT_LINK_SEP, file);
+        }
+        fputc('\n', file);
+}
+
+/** Writes the index next to the notes, replacing the old one atomically */
+static int pt_vault_save(PTVault *vault) {
+        pt_str tmp;
+        pt_str_init(&tmp);
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+        pt_str_append(&tmp, vault->index_path.data);
+        pt_str_append(&tmp, suffix);
+
+        FILE *file = fopen(tmp.data, "w");
+        if (!file) {
+                pt_str_free(&tmp);
+                return -1;
+        }
+
+        fputs(PT_VAULT_INDEX_HEADER, file);
+        for (size_t i = 0; i < vault->note_count; i++) {
+                if (vault->notes[i].path.len > 0)
+                        pt_vault_write_note(file, &vault->notes[i]);
+        }
+
+        int rc = fclose(file) == 0 ? 0 : -1;
+        if (rc == 0)
+                rc = rename(tmp.data, vault->index_path.data);
+        if (rc != 0)
+                remove(tmp.data);
+        else
+                pt_vault_remember_index(vault);
+        pt_str_free(&tmp);
+        return rc;
+}
+
+/** Appends the line of note `idx` to the index, or writes it if there is none */
+static int pt_vault_append(PTVault *vault, size_t idx) {
+        struct stat st;
+        if (stat(vault->index_path.data, &st) != 0 || st.st_size == 0)
+                return pt_vault_save(vault);
+
+        FILE *file = fopen(vault->index_path.data, "a");
+        if (!file)
+                return -1;
+        pt_vault_write_note(file, &vault->notes[idx]);
+        int rc = fclose(file) == 0 ? 0 : -1;
+        pt_vault_remember_index(vault);
+        return rc;
+}
+
+/* ---- scanning ---- */
+
+static bool pt_vault_is_note(const char *name) {
+        size_t len = strlen(name);
+        return len > 3 && strcmp(name + len - 3, ".md") == 0 &&
+               strpbrk(name, "\t\n") == NULL;
+}
+
+/** Indexes the note at `rel_path` if it changed. Returns its index */
+static size_t pt_vault_scan_file(PTVault *vault, const char *rel_path,
+                                 const struct stat *st, bool *seen) {
+        size_t idx;
+        if (pt_map_get(&vault->files, rel_path, &idx)) {
+                PTNote *note = &vault->notes[idx];
+                if (seen)
+                        seen[idx] = true;
+                if (note->mtime == (long)st->st_mtime &&
+                    note->size == (long)st->st_size)
+                        return idx;
+
+                pt_vault_unindex_note(vault, idx);
+                pt_vault_read_note(vault, note, st);
+                pt_vault_index_note(vault, idx);
+                return idx;
+        }
+
+        idx = pt_vault_add_note(vault, rel_path);
+        if (idx == (size_t)-1)
+                return idx;
+        if (pt_vault_read_note(vault, &vault->notes[idx], st) != 0) {
+                pt_note_free(&vault->notes[idx]);
+                vault->note_count--;
+                return (size_t)-1;
+        }
+        pt_vault_index_note(vault, idx);
+        return idx;
+}
+
+/**
+ * Walks `rel_dir` below the root, `depth` levels down. Only files whose
+ * size or mtime differ from the index are read again, and every indexed
+ * note that is still there gets its flag in `seen` set.
+ */
+static void pt_vault_scan_dir(PTVault *vault, pt_str *rel_dir, int depth,
+                              bool *seen) {
+        pt_str dir_path;
+        pt_str_init(&dir_path);
+        pt_vault_full_path(vault, rel_dir->data, &dir_path);
+#ifdef __linux__
+        // Run in the refresher, but the watch lands in the inotify instance
+        // it shares with the editor. It is added before the directory is
+        // read so that no change falls between the two.
+        if (vault->watch >= 0 &&
+            inotify_add_watch(vault->watch, dir_path.data,
+                              PT_VAULT_WATCH_EVENTS) < 0)
+                vault->watch = -1;
+#endif
+        DIR *dir = opendir(dir_path.data);
+        pt_str_free(&dir_path);
+        if (!dir)
+                return;
+
+        pt_str child;
+        pt_str_init(&child);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] == '.')
+                        continue;
+
+                pt_str_reset(&child);
+                if (rel_dir->len > 0) {
+                        pt_str_append(&child, rel_dir->data);
+                        pt_str_append_char(&child, '/');
+                }
+                pt_str_append(&child, entry->d_name);
+
+                pt_str full;
+                pt_str_init(&full);
+                pt_vault_full_path(vault, child.data, &full);
+                struct stat st;
+                int rc = lstat(full.data, &st);
+                pt_str_free(&full);
+                if (rc != 0)
+                        continue;
+
+                if (S_ISDIR(st.st_mode)) {
+                        if (depth < PT_VAULT_MAX_DEPTH)
+                                pt_vault_scan_dir(vault, &child, depth + 1,
+                                                  seen);
+                } else if (S_ISREG(st.st_mode) &&
+                           pt_vault_is_note(entry->d_name)) {
+                        pt_vault_scan_file(vault, child.data, &st, seen);
+                }
+        }
+        pt_str_free(&child);
+        closedir(dir);
+}
+
+static int pt_vault_scan(PTVault *vault) {
+        // Notes found by the walk are appended past `known`, so only the
+        // notes that were already indexed need a flag
+        size_t known = vault->note_count;
+        bool *seen = calloc(known + 1, sizeof(bool));
+        if (!seen)
+                return -1;
+
+        pt_str rel;
+        pt_str_init(&rel);
+        pt_vault_scan_dir(vault, &rel, 0, seen);
+        pt_str_free(&rel);
+
+        for (size_t i = 0; i < known; i++) {
+                PTNote *note = &vault->notes[i];
+                if (!seen[i] && note->path.len > 0) {
+                        pt_vault_unindex_note(vault, i);
+                        pt_str_reset(&note->path);
+                        pt_str_reset(&note->title);
+                        pt_str_reset(&note->links);
+                }
+        }
+        free(seen);
+        return 0;
+}
+
+/** Whether `root` is the home directory or `/`, which are not vaults */
+static bool pt_vault_is_too_broad(const char *root) {
+        struct stat st;
+        struct stat other;
+        if (stat(root, &st) != 0)
+                return true;
+        const char *home = getenv("HOME");
+        const char *broad[] = {"/", home};
+        for (size_t i = 0; i < 2; i++) {
+                if (broad[i] && stat(broad[i], &other) == 0 &&
+                    st.st_dev == other.st_dev && st.st_ino == other.st_ino)
+                        return true;
+        }
+        return false;
+}
+
+/**
+ * Brings the index up to date with the files in a child, so that the
+ * editor never waits for the walk. The child is the only writer of the
+ * whole index; saves made meanwhile are applied again once its result is
+ * loaded.
+ */
+static void pt_vault_refresh(PTVault *vault) {
+        pt_str_reset(&vault->pending);
+        vault->refreshed_at = time(NULL);
+        vault->is_changed = false;
+        fflush(stdout);
+        vault->refresher = fork();
+        if (vault->refresher == 0) {
+                bool is_watched = vault->watch >= 0;
+                pt_vault_scan(vault);
+                pt_vault_save(vault);
+                _exit(is_watched && vault->watch < 0 ? PT_VAULT_UNWATCHED
+                                                     : 0);
+        }
+}
+
+/** Re-reads the note at `rel_path` and appends it to the index */
+static void pt_vault_refresh_note(PTVault *vault, const char *rel_path) {
+        pt_str full;
+        pt_str_init(&full);
+        pt_vault_full_path(vault, rel_path, &full);
+        struct stat st;
+        int rc = stat(full.data, &st);
+        pt_str_free(&full);
+        if (rc != 0 || !pt_vault_is_note(rel_path))
+                return;
+
+        size_t idx = pt_vault_scan_file(vault, rel_path, &st, NULL);
+        if (idx != (size_t)-1)
+                pt_vault_append(vault, idx);
+}
+
+#ifdef __linux__
+/** Drains the inotify events and notes whether any note was touched */
+static void pt_vault_read_events(PTVault *vault) {
+        union {
+                struct inotify_event event;
+                char bytes[4096];
+        } buffer;
+        for (;;) {
+                ssize_t len = read(vault->watch, buffer.bytes,
+                                   sizeof(buffer.bytes));
+                if (len < 0 && errno == EINTR)
+                        continue;
+                if (len <= 0)
+                        return;
+
+                for (ssize_t at = 0; at < len;) {
+                        const struct inotify_event *event =
+                                (const void *)(buffer.bytes + at);
+                        at += (ssize_t)(sizeof(*event) + event->len);
+                        if (event->mask & IN_Q_OVERFLOW) {
+                                vault->is_changed = true;
+                                continue;
+                        }
+                        // Hidden entries, like the index itself and the
+                        // sidecar caches, are never walked
+                        if (event->len == 0 || event->name[0] == '.')
+                                continue;
+                        if ((event->mask & IN_ISDIR) ||
+                            pt_vault_is_note(event->name))
+                                vault->is_changed = true;
+                }
+        }
+}
+#endif
+
+/* ---- public API ---- */
+
+PTVault *pt_vault_open(const char *root) {
+        if (pt_vault_is_too_broad(root))
+                return NULL;
+        PTVault *vault = calloc(1, sizeof(PTVault));
+        if (!vault)
+                return NULL;
+
+        pt_str_init(&vault->root);
+        pt_str_init(&vault->index_path);
+        pt_str_init(&vault->pending);
+        pt_str_append(&vault->root, root);
+        pt_vault_full_path(vault, PT_VAULT_INDEX_NAME, &vault->index_path);
+        pt_map_init(&vault->files);
+        pt_map_init(&vault->names);
+        pt_map_init(&vault->titles);
+        pt_map_init(&vault->backlinks);
+        vault->watch = -1;
+#ifdef __linux__
+        vault->watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+
+        pt_vault_load(vault);
+        pt_vault_refresh(vault);
+        return vault;
+}
+
+PTVault *pt_vault_find(const char *path) {
+        const char *root = getenv("PORTA_VAULT");
+        if (root && root[0])
+                return pt_vault_open(root);
+
+        // Only directories named in `path` are tried, so that the path of
+        // the file stays relative to the root
+        pt_str dir, index;
+        pt_str_init(&dir);
+        pt_str_init(&index);
+        pt_str_append(&dir, path);
+        PTVault *vault = NULL;
+        for (;;) {
+                char *slash = strrchr(dir.data, '/');
+                if (slash) {
+                        dir.len = slash == dir.data ? 1
+                                                    : (size_t)(slash - dir.data);
+                        dir.data[dir.len] = '\0';
+                } else if (strcmp(dir.data, ".") != 0) {
+                        pt_str_reset(&dir);
+                        pt_str_append_char(&dir, '.');
+                } else {
+                        break;
+                }
+
+                pt_str_reset(&index);
+                pt_str_append(&index, dir.data);
+                pt_str_append_char(&index, '/');
+                pt_str_append(&index, PT_VAULT_INDEX_NAME);
+                if (access(index.data, F_OK) == 0) {
+                        vault = pt_vault_open(dir.data);
+                        break;
+                }
+                if (strcmp(dir.data, "/") == 0)
+                        break;
+        }
+        pt_str_free(&dir);
+        pt_str_free(&index);
+        return vault;
+}
+
+void pt_vault_free(PTVault *vault) {
+        if (!vault)
+                return;
+        if (vault->refresher > 0)
+                waitpid(vault->refresher, NULL, 0);
+        if (vault->watch >= 0)
+                close(vault->watch);
+        pt_vault_clear(vault);
+        pt_map_free(&vault->files);
+        pt_map_free(&vault->names);
+        pt_map_free(&vault->titles);
+        pt_map_free(&vault->backlinks);
+        free(vault->notes);
+        free(vault->lists);
+        pt_str_free(&vault->root);
+        pt_str_free(&vault->index_path);
+        pt_str_free(&vault->pending);
+        free(vault);
+}
+
+void pt_vault_poll(PTVault *vault) {
+        int status = 0;
+        bool is_refreshed = vault->refresher > 0 &&
+                            waitpid(vault->refresher, &status, WNOHANG) != 0;
+        if (is_refreshed) {
+                vault->refresher = 0;
+                // Some directory could not be watched, e.g. past the
+                // inotify limit, so the timer takes over
+                if (vault->watch >= 0 && WIFEXITED(status) &&
+                    WEXITSTATUS(status) == PT_VAULT_UNWATCHED) {
+                        close(vault->watch);
+                        vault->watch = -1;
+                }
+        }
+#ifdef __linux__
+        if (vault->watch >= 0)
+                pt_vault_read_events(vault);
+#endif
+
+        struct stat st;
+        if (stat(vault->index_path.data, &st) == 0 &&
+            ((long)st.st_mtime != vault->index_mtime ||
+             (long)st.st_size != vault->index_size ||
+             (long)st.st_ino != vault->index_ino) &&
+            pt_vault_load(vault) == 0) {
+                // The index may have been written before the latest saves
+                for (const char *p = vault->pending.data; *p;) {
+                        const char *nl = strchr(p, '\n');
+                        pt_str rel;
+                        pt_str_init(&rel);
+                        pt_str_append_n(&rel, p, (size_t)(nl - p));
+                        pt_vault_refresh_note(vault, rel.data);
+                        pt_str_free(&rel);
+                        p = nl + 1;
+                }
+        }
+        if (is_refreshed)
+                pt_str_reset(&vault->pending);
+
+        // Notes also change outside the editor
+        bool is_due = vault->watch < 0 && time(NULL) - vault->refreshed_at >=
+                                                  PT_VAULT_REFRESH_SECONDS;
+        if (vault->refresher == 0 && (vault->is_changed || is_due))
+                pt_vault_refresh(vault);
+}
+
+const char *pt_vault_resolve(PTVault *vault, const char *target) {
+        pt_str key;
+        pt_str_init(&key);
+        pt_vault_key(target, strlen(target), &key);
+
+        size_t idx;
+        bool found = key.len > 0 &&
+                     (pt_map_get(&vault->names, key.data, &idx) ||
+                      pt_map_get(&vault->titles, key.data, &idx));
+        pt_str_free(&key);
+
+        if (!found || vault->notes[idx].path.len == 0)
+                return NULL;
+        return vault->notes[idx].path.data;
+}
+
+size_t pt_vault_backlinks(PTVault *vault, const char *rel_path,
+                          const char **sources, size_t max) {
+        size_t idx;
+        if (!pt_map_get(&vault->files, rel_path, &idx))
+                return 0;
+
+        pt_str keys[3];
+        for (size_t k = 0; k < 3; k++)
+                pt_str_init(&keys[k]);
+        const PTNote *note = &vault->notes[idx];
+        pt_vault_name_keys(note, &keys[0], &keys[1]);
+        pt_vault_key(note->title.data, note->title.len, &keys[2]);
+
+        size_t count = 0;
+        for (size_t k = 0; k < 3; k++) {
+                size_t list_idx;
+                if (keys[k].len == 0 ||
+                    !pt_map_get(&vault->backlinks, keys[k].data, &list_idx))
+                        continue;
+
+                const PTNoteList *list = &vault->lists[list_idx];
+                for (size_t i = 0; i < list->len && count < max; i++) {
+                        const char *path = vault->notes[list->items[i]].path.data;
+                        bool duplicate = false;
+                        for (size_t j = 0; j < count; j++)
+                                duplicate |= strcmp(sources[j], path) == 0;
+                        if (!duplicate && path[0])
+                                sources[count++] = path;
+                }
+        }
+
+        for (size_t k = 0; k < 3; k++)
+                pt_str_free(&keys[k]);
+        return count;
+}
+
+void pt_vault_update(PTVault *vault, const char *rel_path) {
+        pt_vault_refresh_note(vault, rel_path);
+        if (vault->refresher > 0) {
+                pt_str_append(&vault->pending, rel_path);
+                pt_str_append_char(&vault->pending, '\n');
+        }
+}
+
+const char *pt_vault_relative(const PTVault *vault, const char *path) {
+        size_t root_len = vault->root.len;
+        if (strncmp(path, vault->root.data, root_len) == 0 &&
+            path[root_len] == '/')
+                return path + root_len + 1;
+        if (strcmp(vault->root.data, ".") == 0 && path[0] != '/' &&
+            strncmp(path, "../", 3) != 0)
+                return path;
+        return NULL;
+}
+
+bool pt_vault_last_link(const pt_str *content, pt_str *target) {
+        const char *data = content->data;
+        for (size_t i = content->len; i >= 2; i--) {
+                if (data[i - 1] != ']' || data[i - 2] != ']')
+                        continue;
+
+                // Find the matching opening brackets on the same line
+                size_t end = i - 2;
+                size_t j = end;
+                while (j >= 2 && data[j - 1] != '\n' &&
+                       !(data[j - 1] == '[' && data[j - 2] == '['))
+                        j--;
+                if (j < 2 || data[j - 1] != '[' || data[j - 2] != '[')
+                        continue;
+
+                size_t len = end - j;
+                const char *pipe = memchr(data + j, '|', len);
+                if (pipe)
+                        len = (size_t)(pipe - (data + j));
+                pt_str_reset(target);
+                pt_str_append_n(target, data + j, len);
+                return target->len > 0;
+        }
+        return false;
+}
@@ -0,0 +1,108 @@
+#ifndef PT_VAULT_H
+#define PT_VAULT_H
+#include "ds.h"
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+
+typedef struct {
+        pt_str path;  // relative to the vault root, empty once deleted
+        pt_str title; // text of the first heading, may be empty
+        pt_str links; // normalized link targets, each ended by '\n'
+        long mtime;
+        long size;
+} PTNote;
+
+typedef struct {
+        size_t *items;
+        size_t len;
+        size_t cap;
+} PTNoteList;
+
+/**
+ * Index of the markdown notes below a directory. Names, titles and
+ * backlinks are kept in hash maps so that resolving a wikilink or listing
+ * the backlinks of a note does not depend on the size of the vault.
+ */
+typedef struct {
+        pt_str root;
+        pt_str index_path;
+        PTNote *notes;
+        size_t note_count;
+        size_t note_cap;
+        pt_map files;     // exact relative path -> note
+        pt_map names;     // normalized name or path -> note
+        pt_map titles;    // normalized title -> note
+        pt_map backlinks; // normalized target -> list of linking notes
+        PTNoteList *lists;
+        size_t list_count;
+        size_t list_cap;
+
+        // Identity of the on-disk index last loaded or written
+        long index_mtime;
+        long index_size;
+        long index_ino;
+        pid_t refresher;
+        time_t refreshed_at; // when the last refresh started
+        pt_str pending;      // notes saved since then, each ended by '\n'
+
+        // inotify instance watching the walked directories, or -1 when
+        // changes are only found by walking again every minute
+        int watch;
+        bool is_changed; // a note changed since the last refresh started
+} PTVault;
+
+/**
+ * Opens the vault rooted at `root`. The persisted index is loaded right
+ * away and a background process brings it up to date with the files on
+ * disk; pick up its result with `pt_vault_poll`. Returns NULL for the home
+ * directory and `/`, which are too broad to be walked.
+ */
+PTVault *pt_vault_open(const char *root);
+
+/**
+ * Opens the vault the file at `path` belongs to: the directory named by
+ * $PORTA_VAULT, or else the closest directory on `path` that already has
+ * an index. Returns NULL if there is neither, so no index is ever written
+ * where none was asked for.
+ */
+PTVault *pt_vault_find(const char *path);
+void pt_vault_free(PTVault *vault);
+
+/**
+ * Reaps a finished background refresh and reloads the on-disk index if it
+ * was rewritten. Another refresh starts once a note changed on disk, or,
+ * where changes cannot be watched, when the last one is a minute old.
+ * Cheap enough to call on every pass of the main loop.
+ */
+void pt_vault_poll(PTVault *vault);
+
+/**
+ * Resolves the target of a wikilink to a path relative to the root.
+ * Returns NULL when no note matches.
+ */
+const char *pt_vault_resolve(PTVault *vault, const char *target);
+
+/**
+ * Fills `sources` with up to `max` paths of notes linking to the note at
+ * `rel_path`. Returns the number of paths written.
+ */
+size_t pt_vault_backlinks(PTVault *vault, const char *rel_path,
+                          const char **sources, size_t max);
+
+/**
+ * Re-reads a single note, e.g. after it has been saved, and appends it to
+ * the on-disk index. Only the background refresh rewrites the index whole.
+ */
+void pt_vault_update(PTVault *vault, const char *rel_path);
+
+/** Returns `path` relative to the vault root, or NULL if outside of it */
+const char *pt_vault_relative(const PTVault *vault, const char *path);
+
+/**
+ * Finds the last `[[target|alias]]` in `content` and writes its target to
+ * `target`. Returns false if there is no complete wikilink.
+ */
+bool pt_vault_last_link(const pt_str *content, pt_str *target);
+
+#endif
@@ -0,0 +1,750 @@
+#define _POSIX_C_SOURCE 200112L
+#include "vt.h"
+#include "ds.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PT_VT_TAB_WIDTH 8
+#define PT_VT_MAX_PARAMS 16
+
+static PTCell *pt_vt_at(PTVT *vt, unsigned short row, unsigned short col) {
+        return &vt->cells[(size_t)row * vt->cols + col];
+}
+
+static void pt_vt_clear_cells(PTVT *vt, size_t from, size_t to) {
+        for (size_t i = from; i < to; i++) {
+                vt->cells[i].codepoint = 0;
+                vt->cells[i].attrs = 0;
+                vt->cells[i].scale = 1;
+        }
+}
+
+static void pt_vt_sink_write(PTSink *sink, const char *data, size_t len) {
+        pt_vt_feed((PTVT *)sink, data, len);
+}
+
+static void pt_vt_sink_flush(PTSink *sink) { pt_vt_end_frame((PTVT *)sink); }
+
+int pt_vt_init(PTVT *vt, unsigned short rows, unsigned short cols) {
+        memset(vt, 0, sizeof(PTVT));
+        vt->sink.write = pt_vt_sink_write;
+        vt->sink.flush = pt_vt_sink_flush;
+        return pt_vt_resize(vt, rows, cols);
+}
+
+void pt_vt_free(PTVT *vt) {
+        free(vt->cells);
+        vt->cells = NULL;
+        vt->rows = 0;
+        vt->cols = 0;
+}
+
+int pt_vt_resize(PTVT *vt, unsigned short rows, unsigned short cols) {
+        if (rows == 0 || cols == 0)
+                return -1;
+        PTCell *cells = realloc(vt->cells, (size_t)rows * cols * sizeof(PTCell));
+        if (!cells)
+                return -1;
+        vt->cells = cells;
+        vt->rows = rows;
+        vt->cols = cols;
+        vt->cursor_row = 0;
+        vt->cursor_col = 0;
+        vt->scroll_top = 0;
+        vt->scroll_bottom = (unsigned short)(rows - 1);
+        pt_vt_clear_cells(vt, 0, (size_t)rows * cols);
+        return 0;
+}
+
+/* ---- screen operations ---- */
+
+static void pt_vt_scroll_up(PTVT *vt) {
+        size_t top = (size_t)vt->scroll_top * vt->cols;
+        size_t bottom = (size_t)vt->scroll_bottom * vt->cols;
+        memmove(&vt->cells[top], &vt->cells[top + vt->cols],
+                (bottom - top) * sizeof(PTCell));
+        pt_vt_clear_cells(vt, bottom, bottom + vt->cols);
+}
+
+static void pt_vt_line_feed(PTVT *vt) {
+        if (vt->cursor_row == vt->scroll_bottom)
+                pt_vt_scroll_up(vt);
+        else if (vt->cursor_row + 1 < vt->rows)
+                vt->cursor_row++;
+}
+
+static void pt_vt_put(PTVT *vt, unsigned long codepoint, unsigned char scale) {
+        if (vt->cursor_col >= vt->cols) {
+                vt->cursor_col = 0;
+                pt_vt_line_feed(vt);
+        }
+        PTCell *cell = pt_vt_at(vt, vt->cursor_row, vt->cursor_col);
+        cell->codepoint = codepoint;
+        cell->attrs = vt->attrs;
+        cell->scale = scale;
+
+        // Scaled text takes `scale` columns per character
+        unsigned int next = (unsigned int)vt->cursor_col + scale;
+        vt->cursor_col = (unsigned short)(next > vt->cols ? vt->cols : next);
+}
+
+static void pt_vt_move_to(PTVT *vt, long row, long col) {
+        if (row < 0)
+                row = 0;
+        if (row >= vt->rows)
+                row = vt->rows - 1;
+        if (col < 0)
+                col = 0;
+        if (col >= vt->cols)
+                col = vt->cols - 1;
+        vt->cursor_row = (unsigned short)row;
+        vt->cursor_col = (unsigned short)col;
+        vt->frame.cursor_moves++;
+        vt->total.cursor_moves++;
+}
+
+/* ---- sequences ---- */
+
+/**
+ * Splits the parameters of a CSI sequence. Sub-parameters after ':' are
+ * dropped. Missing parameters are 0.
+ */
+static size_t pt_vt_params(const char *seq, long *params) {
+        size_t count = 0;
+        params[0] = 0;
+        bool in_sub = false;
+        for (const char *p = seq; *p; p++) {
+                if (*p >= '0' && *p <= '9') {
+                        if (!in_sub)
+                                params[count] = params[count] * 10 + (*p - '0');
+                } else if (*p == ';') {
+                        in_sub = false;
+                        if (count + 1 < PT_VT_MAX_PARAMS)
+                                params[++count] = 0;
+                } else if (*p == ':') {
+                        in_sub = true;
+                }
+        }
+        return count + 1;
+}
+
+static void pt_vt_sgr(PTVT *vt, const long *params, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+                switch (params[i]) {
+                case 0:
+                        vt->attrs = 0;
+                        break;
+                case 1:
+                        vt->attrs |= PT_VT_BOLD;
+                        break;
+                case 4:
+                        vt->attrs |= PT_VT_UNDERLINE;
+                        break;
+                case 7:
+                        vt->attrs |= PT_VT_REVERSE;
+                        break;
+                case 22:
+                        vt->attrs &= (unsigned char)~PT_VT_BOLD;
+                        break;
+                case 24:
+                        vt->attrs &= (unsigned char)~PT_VT_UNDERLINE;
+                        break;
+                case 27:
+                        vt->attrs &= (unsigned char)~PT_VT_REVERSE;
+                        break;
+                default:
+                        // Colours are not tracked
+                        break;
+                }
+        }
+}
+
+static void pt_vt_csi(PTVT *vt, char final) {
+        bool is_private = vt->seq[0] == '?';
+        long params[PT_VT_MAX_PARAMS];
+        size_t count = pt_vt_params(vt->seq + (is_private ? 1 : 0), params);
+        long n = params[0] > 0 ? params[0] : 1;
+        size_t size = (size_t)vt->rows * vt->cols;
+        size_t cursor = (size_t)vt->cursor_row * vt->cols + vt->cursor_col;
+
+        if (is_private) {
+                // Entering or leaving the alternate screen clears it
+                if (params[0] == 1049 && (final == 'h' || final == 'l')) {
+                        pt_vt_clear_cells(vt, 0, size);
+                        vt->cursor_row = 0;
+                        vt->cursor_col = 0;
+                }
+                return;
+        }
+
+        switch (final) {
+        case 'H':
+        case 'f':
+                pt_vt_move_to(vt, (params[0] > 0 ? params[0] : 1) - 1,
+                              (count > 1 && params[1] > 0 ? params[1] : 1) - 1);
+                break;
+        case 'A':
+                pt_vt_move_to(vt, vt->cursor_row - n, vt->cursor_col);
+                break;
+        case 'B':
+                pt_vt_move_to(vt, vt->cursor_row + n, vt->cursor_col);
+                break;
+        case 'C':
+                pt_vt_move_to(vt, vt->cursor_row, vt->cursor_col + n);
+                break;
+        case 'D':
+                pt_vt_move_to(vt, vt->cursor_row, vt->cursor_col - n);
+                break;
+        case 'J':
+                if (params[0] == 0)
+                        pt_vt_clear_cells(vt, cursor, size);
+                else if (params[0] == 1)
+                        pt_vt_clear_cells(vt, 0, cursor + 1);
+                else
+                        pt_vt_clear_cells(vt, 0, size);
+                break;
+        case 'K': {
+                size_t line = (size_t)vt->cursor_row * vt->cols;
+                if (params[0] == 0)
+                        pt_vt_clear_cells(vt, cursor, line + vt->cols);
+                else if (params[0] == 1)
+                        pt_vt_clear_cells(vt, line, cursor + 1);
+                else
+                        pt_vt_clear_cells(vt, line, line + vt->cols);
+                break;
+        }
+        case 'm':
+                pt_vt_sgr(vt, params, count);
+                break;
+        case 'r': {
+                long top = params[0] > 0 ? params[0] : 1;
+                long bottom = count > 1 && params[1] > 0 ? params[1] : vt->rows;
+                if (top < bottom && bottom <= vt->rows) {
+                        vt->scroll_top = (unsigned short)(top - 1);
+                        vt->scroll_bottom = (unsigned short)(bottom - 1);
+                }
+                pt_vt_move_to(vt, 0, 0);
+                break;
+        }
+        default:
+                break;
+        }
+}
+
+/** Decodes the UTF-8 in `text` and puts each character with `scale` */
+static void pt_vt_put_text(PTVT *vt, const char *text, unsigned char scale) {
+        for (const unsigned char *p = (const unsigned char *)text; *p;) {
+                unsigned long cp = *p;
+                int extra = 0;
+                if (cp >= 0xF0) {
+                        cp &= 0x07;
+                        extra = 3;
+                } else if (cp >= 0xE0) {
+                        cp &= 0x0F;
+                        extra = 2;
+                } else if (cp >= 0xC0) {
+                        cp &= 0x1F;
+                        extra = 1;
+                }
+                p++;
+                for (; extra > 0 && (*p & 0xC0) == 0x80; extra--, p++)
+                        cp = (cp << 6) | (*p & 0x3F);
+                pt_vt_put(vt, cp, scale);
+        }
+}
+
+/** OSC 66 is kitty's text sizing: "66;s=<scale>;<text>" */
+static void pt_vt_osc(PTVT *vt) {
+        if (strncmp(vt->seq, "66;", 3) != 0)
+                return;
+        const char *text = strchr(vt->seq + 3, ';');
+        if (!text)
+                return;
+
+        unsigned char scale = 1;
+        const char *s = strstr(vt->seq + 3, "s=");
+        if (s && s < text) {
+                long value = strtol(s + 2, NULL, 10);
+                if (value >= 1 && value <= 7)
+                        scale = (unsigned char)value;
+        }
+        pt_vt_put_text(vt, text + 1, scale);
+}
+
+static void pt_vt_begin_sequence(PTVT *vt, PTVTParseState state) {
+        vt->state = state;
+        vt->seq_len = 0;
+        vt->seq[0] = '\0';
+        vt->frame.sequences++;
+        vt->total.sequences++;
+}
+
+static void pt_vt_seq_append(PTVT *vt, char c) {
+        // Overlong sequences are truncated rather than overflowing
+        if (vt->seq_len + 1 < sizeof(vt->seq)) {
+                vt->seq[vt->seq_len++] = c;
+                vt->seq[vt->seq_len] = '\0';
+        }
+}
+
+static void pt_vt_ground(PTVT *vt, unsigned char c) {
+        if (vt->utf8_remaining > 0) {
+                if ((c & 0xC0) == 0x80) {
+                        vt->utf8_codepoint = (vt->utf8_codepoint << 6) | (c & 0x3F);
+                        if (--vt->utf8_remaining == 0)
+                                pt_vt_put(vt, vt->utf8_codepoint, 1);
+                        return;
+                }
+                vt->utf8_remaining = 0;
+        }
+
+        switch (c) {
+        case '\033':
+                vt->state = PT_VT_ESCAPE;
+                return;
+        case '\r':
+                vt->cursor_col = 0;
+                return;
+        case '\n':
+                pt_vt_line_feed(vt);
+                return;
+        case '\b':
+                if (vt->cursor_col > 0)
+                        vt->cursor_col--;
+                return;
+        case '\t': {
+                unsigned int next =
+                        (vt->cursor_col / PT_VT_TAB_WIDTH + 1u) * PT_VT_TAB_WIDTH;
+                unsigned int last = vt->cols - 1u;
+                vt->cursor_col = (unsigned short)(next > last ? last : next);
+                return;
+        }
+        default:
+                break;
+        }
+
+        if (c < 0x20 || c == 0x7F)
+                return;
+        if (c >= 0xF0) {
+                vt->utf8_codepoint = c & 0x07;
+                vt->utf8_remaining = 3;
+        } else if (c >= 0xE0) {
+                vt->utf8_codepoint = c & 0x0F;
+                vt->utf8_remaining = 2;
+        } else if (c >= 0xC0) {
+                vt->utf8_codepoint = c & 0x1F;
+                vt->utf8_remaining = 1;
+        } else {
+                pt_vt_put(vt, c, 1);
+        }
+}
+
+void pt_vt_feed(PTVT *vt, const char *data, size_t len) {
+        vt->frame.bytes += len;
+        vt->total.bytes += len;
+
+        for (size_t i = 0; i < len; i++) {
+                char c = data[i];
+                switch (vt->state) {
+                case PT_VT_GROUND:
+                        pt_vt_ground(vt, (unsigned char)c);
+                        break;
+                case PT_VT_ESCAPE:
+                        if (c == '[') {
+                                pt_vt_begin_sequence(vt, PT_VT_CSI);
+                        } else if (c == ']') {
+                                pt_vt_begin_sequence(vt, PT_VT_OSC);
+                        } else {
+                                // Two byte sequences such as ESC 7 are ignored
+                                vt->frame.sequences++;
+                                vt->total.sequences++;
+                                vt->state = PT_VT_GROUND;
+                        }
+                        break;
+                case PT_VT_CSI:
+                        if (c >= 0x40 && c <= 0x7E) {
+                                pt_vt_csi(vt, c);
+                                vt->state = PT_VT_GROUND;
+                        } else {
+                                pt_vt_seq_append(vt, c);
+                        }
+                        break;
+                case PT_VT_OSC:
+                        if (c == '\a') {
+                                pt_vt_osc(vt);
+                                vt->state = PT_VT_GROUND;
+                        } else if (c == '\033') {
+                                vt->state = PT_VT_OSC_ESCAPE;
+                        } else {
+                                pt_vt_seq_append(vt, c);
+                        }
+                        break;
+                case PT_VT_OSC_ESCAPE:
+                        // ESC \ ends the OSC, anything else aborts it
+                        if (c == '\\')
+                                pt_vt_osc(vt);
+                        vt->state = PT_VT_GROUND;
+                        break;
+                }
+        }
+}
+
+void pt_vt_end_frame(PTVT *vt) {
+        vt->frame.frames = 1;
+        vt->total.frames++;
+        vt->last_frame = vt->frame;
+        memset(&vt->frame, 0, sizeof(PTVTCounters));
+}
+
+const PTCell *pt_vt_cell(const PTVT *vt, unsigned short row,
+                         unsigned short col) {
+        if (row >= vt->rows || col >= vt->cols)
+                return NULL;
+        return &vt->cells[(size_t)row * vt->cols + col];
+}
+
+bool pt_vt_same_screen(const PTVT *a, const PTVT *b) {
+        if (a->rows != b->rows || a->cols != b->cols)
+                return false;
+        size_t size = (size_t)a->rows * a->cols;
+        for (size_t i = 0; i < size; i++) {
+                const PTCell *x = &a->cells[i];
+                const PTCell *y = &b->cells[i];
+                if (x->codepoint != y->codepoint || x->attrs != y->attrs ||
+                    x->scale != y->scale)
+                        return false;
+        }
+        return true;
+}
+
+unsigned long long pt_vt_screen_hash(const PTVT *vt) {
+        unsigned long long hash = PT_HASH_SEED;
+        size_t size = (size_t)vt->rows * vt->cols;
+        for (size_t i = 0; i < size; i++) {
+                const PTCell *cell = &vt->cells[i];
+                unsigned long long value = cell->codepoint |
+                                           (unsigned long long)cell->attrs << 32 |
+                                           (unsigned long long)cell->scale << 40;
+                hash = pt_hash_bytes(hash, (const char *)&value,
+                                     sizeof(value));
+        }
+        return hash;
+}
+
+size_t pt_vt_row_text(const PTVT *vt, unsigned short row, char *out,
+                      size_t cap) {
+        size_t len = 0;
+        size_t end = 0; // length without trailing blanks
+        if (cap == 0)
+                return 0;
+        for (unsigned short col = 0; col < vt->cols && row < vt->rows; col++) {
+                unsigned long cp = pt_vt_cell(vt, row, col)->codepoint;
+                char buf[4];
+                size_t n;
+                if (cp == 0) {
+                        buf[0] = ' ';
+                        n = 1;
+                } else if (cp < 0x80) {
+                        buf[0] = (char)cp;
+                        n = 1;
+                } else if (cp < 0x800) {
+                        buf[0] = (char)(0xC0 | (cp >> 6));
+                        buf[1] = (char)(0x80 | (cp & 0x3F));
+                        n = 2;
+                } else if (cp < 0x10000) {
+                        buf[0] = (char)(0xE0 | (cp >> 12));
+                        buf[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                        buf[2] = (char)(0x80 | (cp & 0x3F));
+                        n = 3;
+                } else {
+                        buf[0] = (char)(0xF0 | (cp >> 18));
+                        buf[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+                        buf[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                        buf[3] = (char)(0x80 | (cp & 0x3F));
+                        n = 4;
+                }
+                if (len + n >= cap)
+                        break;
+                memcpy(out + len, buf, n);
+                len += n;
+                if (cp != 0)
+                        end = len;
+        }
+        out[end] = '\0';
+        return end;
+}
+
+#ifdef PT_TEST
+
+#include "editor.h"
+#include "render.h"
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+static void feed(PTVT *vt, const char *s) { pt_vt_feed(vt, s, strlen(s)); }
+
+static const char *row_text(const PTVT *vt, unsigned short row) {
+        static char buf[512];
+        pt_vt_row_text(vt, row, buf, sizeof(buf));
+        return buf;
+}
+
+static void test_plain_text(void) {
+        PTVT vt;
+        assert(pt_vt_init(&vt, 4, 10) == 0);
+        feed(&vt, "hello\r\nworld");
+        assert(strcmp(row_text(&vt, 0), "hello") == 0);
+        assert(strcmp(row_text(&vt, 1), "world") == 0);
+        assert(vt.cursor_row == 1);
+        assert(vt.cursor_col == 5);
+        pt_vt_free(&vt);
+        putchar('.');
+}
+
+static void test_cursor_position(void) {
+        PTVT vt;
+        pt_vt_init(&vt, 5, 20);
+        feed(&vt, "\033[3;5Hxy\033[1;1Ha");
+        assert(strcmp(row_text(&vt, 2), "    xy") == 0);
+        assert(strcmp(row_text(&vt, 0), "a") == 0);
+        assert(vt.total.cursor_moves == 2);
+        assert(vt.total.sequences == 2);
+        // Positions outside the screen are clamped
+        feed(&vt, "\033[99;99Hz");
+        assert(pt_vt_cell(&vt, 4, 19)->codepoint == 'z');
+        pt_vt_free(&vt);
+        putchar('.');
+}
+
+static void test_erase(void) {
+        PTVT vt;
+        pt_vt_init(&vt, 3, 5);
+        feed(&vt, "aaaaa\r\nbbbbb\r\nccccc");
+        feed(&vt, "\033[2;3H\033[J");
+        assert(strcmp(row_text(&vt, 0), "aaaaa") == 0);
+        assert(strcmp(row_text(&vt, 1), "bb") == 0);
+        assert(strcmp(row_text(&vt, 2), "") == 0);
+        feed(&vt, "\033[H\033[J");
+        assert(strcmp(row_text(&vt, 0), "") == 0);
+        pt_vt_free(&vt);
+        putchar('.');
+}
+
+static void test_sgr(void) {
+        PTVT vt;
+        pt_vt_init(&vt, 2, 20);
+        feed(&vt, "a\033[1mb\033[0mc\033[4:3md\033[24m\033[7me\033[27mf");
+        assert(pt_vt_cell(&vt, 0, 0)->attrs == 0);
+        assert(pt_vt_cell(&vt, 0, 1)->attrs == PT_VT_BOLD);
+        assert(pt_vt_cell(&vt, 0, 2)->attrs == 0);
+        assert(pt_vt_cell(&vt, 0, 3)->attrs == PT_VT_UNDERLINE);
+        assert(pt_vt_cell(&vt, 0, 4)->attrs == PT_VT_REVERSE);
+        assert(pt_vt_cell(&vt, 0, 5)->attrs == 0);
+        pt_vt_free(&vt);
+        putchar('.');
+}
+
+static void test_scroll_region(void) {
+        PTVT vt;
+        pt_vt_init(&vt, 4, 5);
+        feed(&vt, "\033[4;1Hlast\033[2;3r");
+        feed(&vt, "\033[2;1Hone\n\rtwo\n\rthree");
+        assert(strcmp(row_text(&vt, 1), "two") == 0);
+        assert(strcmp(row_text(&vt, 2), "three") == 0);
+        assert(strcmp(row_text(&vt, 3), "last") == 0);
+        pt_vt_free(&vt);
+        putchar('.');
+}
+
+static void test_osc66_and_utf8(void) {
+        PTVT vt;
+        pt_vt_init(&vt, 3, 20);
+        feed(&vt, "\033]66;s=2;Hi\a caf\xc3\xa9 \xe2\x95\x91");
+        assert(pt_vt_cell(&vt, 0, 0)->codepoint == 'H');
+        assert(pt_vt_cell(&vt, 0, 0)->scale == 2);
+        assert(pt_vt_cell(&vt, 0, 2)->codepoint == 'i');
+        assert(pt_vt_cell(&vt, 0, 8)->codepoint == 0xE9);
+        assert(pt_vt_cell(&vt, 0, 10)->codepoint == 0x2551);
+        assert(vt.total.sequences == 1);
+        // Split in the middle of a character and of a sequence
+        feed(&vt, "\r\n\xc3");
+        feed(&vt, "\xa9\033[");
+        feed(&vt, "1mx");
+        assert(pt_vt_cell(&vt, 1, 0)->codepoint == 0xE9);
+        assert(pt_vt_cell(&vt, 1, 1)->attrs == PT_VT_BOLD);
+        pt_vt_free(&vt);
+        putchar('.');
+}
+
+static void test_frames_and_equivalence(void) {
+        PTVT a, b;
+        pt_vt_init(&a, 3, 10);
+        pt_vt_init(&b, 3, 10);
+
+        // The same screen reached with different output
+        feed(&a, "\033[H\033[J\033[2;1Hab");
+        pt_vt_end_frame(&a);
+        feed(&b, "\033[2;1Ha\033[2;2Hb");
+        pt_vt_end_frame(&b);
+        assert(pt_vt_same_screen(&a, &b));
+        assert(pt_vt_screen_hash(&a) == pt_vt_screen_hash(&b));
+        assert(a.last_frame.bytes == 14);
+        assert(a.last_frame.sequences == 3);
+        assert(b.last_frame.cursor_moves == 2);
+        assert(a.frame.bytes == 0);
+        assert(a.total.frames == 1);
+
+        feed(&b, "c");
+        assert(!pt_vt_same_screen(&a, &b));
+        pt_vt_free(&a);
+        pt_vt_free(&b);
+        putchar('.');
+}
+
+static void test_as_sink(void) {
+        PTVT vt;
+        pt_vt_init(&vt, 2, 10);
+        PTSink *sink = &vt.sink;
+        sink->write(sink, "ok", 2);
+        sink->flush(sink);
+        assert(strcmp(row_text(&vt, 0), "ok") == 0);
+        assert(vt.total.frames == 1);
+        pt_vt_free(&vt);
+        putchar('.');
+}
+
+static void type(PTState *state, const char *keys) {
+        for (const char *k = keys; *k; k++)
+                pt_process_key(state, *k == '\n' ? '\r' : *k);
+}
+
+/* What the renderer draws, as it ends up on screen */
+static void test_render_state(void) {
+        PTState *state = pt_new_glob_state(pt_str_from("vt_test.md"));
+        state->is_headless = true;
+        state->rows = 24;
+        state->cols = 100;
+        PTVT vt;
+        pt_vt_init(&vt, state->rows, state->cols);
+        pt_set_sink(&vt.sink);
+
+        // The last line sits in the middle with the cursor after it
+        type(state, "one banana\ntwo bananas");
+        pt_render_state(state);
+        assert(strcmp(row_text(&vt, 9), "         one banana") == 0);
+        assert(strcmp(row_text(&vt, 10), "         two bananas") == 0);
+        assert(strncmp(row_text(&vt, 23), "4 words  22 chars  2 lines", 26) ==
+               0);
+        assert(vt.cursor_row == 10);
+        assert(vt.cursor_col == 20);
+        assert(vt.total.frames == 1);
+
+        // Ctrl-F: search matches are in reverse video, unless censored
+        type(state, "\x06" "ana");
+        pt_render_state(state);
+        assert(strcmp(row_text(&vt, 23), "Search: ana [4 matches]") == 0);
+        for (unsigned short col = 9; col < 22; col++) {
+                bool in_match = col >= 14 && col < 19;
+                assert((pt_vt_cell(&vt, 9, col)->attrs == PT_VT_REVERSE) ==
+                       in_match);
+                assert((pt_vt_cell(&vt, 10, col)->attrs == PT_VT_REVERSE) ==
+                       in_match);
+        }
+        state->is_censored = true;
+        pt_render_state(state);
+        for (unsigned short col = 9; col < 22; col++)
+                assert(pt_vt_cell(&vt, 9, col)->attrs == 0);
+        assert(strcmp(row_text(&vt, 23), "Search: ana [4 matches]") == 0);
+
+        pt_set_sink(NULL);
+        pt_vt_free(&vt);
+        putchar('.');
+}
+
+/* A link that only takes output while it has room, onto a screen */
+typedef struct {
+        PTSink sink;
+        PTVT *vt;
+        size_t room;
+} SlowLink;
+
+static size_t slow_link_write(PTSink *sink, const char *data, size_t len) {
+        SlowLink *link = (SlowLink *)sink;
+        size_t n = len < link->room ? len : link->room;
+        pt_vt_feed(link->vt, data, n);
+        link->room -= n;
+        return n;
+}
+
+/* The frame skipping of the main loop, on a link that stalls */
+static void test_slow_link(void) {
+        PTState *state = pt_new_glob_state(pt_str_from("vt_test.md"));
+        state->is_headless = true;
+        state->rows = 24;
+        state->cols = 100;
+        PTVT vt;
+        pt_vt_init(&vt, state->rows, state->cols);
+        SlowLink link;
+        memset(&link, 0, sizeof(link));
+        link.sink.try_write = slow_link_write;
+        link.vt = &vt;
+        link.room = (size_t)-1;
+        pt_set_sink(&link.sink);
+
+        type(state, "a");
+        assert(!pt_output_is_behind());
+        pt_render_state(state);
+        assert(strcmp(row_text(&vt, 10), "         a") == 0);
+
+        // The link stalls in the middle of the next frame, so the frames
+        // for the keys typed meanwhile are skipped
+        link.room = 10;
+        type(state, "b");
+        pt_render_state(state);
+        size_t drawn = 0;
+        for (const char *k = "cdef"; *k; k++) {
+                pt_process_key(state, *k);
+                if (!pt_output_is_behind()) {
+                        pt_render_state(state);
+                        drawn++;
+                }
+        }
+        assert(drawn == 0);
+        assert(pt_output_is_behind());
+
+        // Once it has caught up, the latest state is drawn
+        link.room = (size_t)-1;
+        for (int i = 0; i < 1000 && pt_output_is_behind(); i++) {
+                struct timespec ms = {0, 1000000};
+                nanosleep(&ms, NULL);
+        }
+        assert(!pt_output_is_behind());
+        pt_render_state(state);
+        assert(strcmp(row_text(&vt, 10), "         abcdef") == 0);
+
+        pt_set_sink(NULL);
+        pt_vt_free(&vt);
+        putchar('.');
+}
+
+int main(void) {
+        printf("Running vt tests...\n");
+        test_plain_text();
+        test_cursor_position();
+        test_erase();
+        test_sgr();
+        test_scroll_region();
+        test_osc66_and_utf8();
+        test_frames_and_equivalence();
+        test_as_sink();
+        test_render_state();
+        test_slow_link();
+
+        putchar('\n');
+        printf("All vt tests passed.\n");
+        return 0;
+}
+
+#endif /* PT_TEST */
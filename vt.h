@@ -0,0 +1,88 @@
+#ifndef PT_VT_H
+#define PT_VT_H
+#include "term.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Minimal VT100/xterm emulator used as an output sink, so that what porta
+ * puts on screen can be inspected and measured without a terminal. It
+ * understands what porta emits: CUP, ED, EL, SGR, DECSTBM, the alternate
+ * screen and kitty's OSC 66 text sizing. Everything else is skipped.
+ */
+
+#define PT_VT_BOLD 0x01
+#define PT_VT_UNDERLINE 0x02
+#define PT_VT_REVERSE 0x04
+
+typedef struct {
+        unsigned long codepoint; // 0 for an empty cell
+        unsigned char attrs;
+        unsigned char scale; // OSC 66 s=, 1 for normal text
+} PTCell;
+
+typedef struct {
+        size_t bytes;
+        size_t sequences;    // escape sequences
+        size_t cursor_moves; // CUP and relative cursor movement
+        size_t frames;       // flushes
+} PTVTCounters;
+
+typedef enum {
+        PT_VT_GROUND,
+        PT_VT_ESCAPE,
+        PT_VT_CSI,
+        PT_VT_OSC,
+        PT_VT_OSC_ESCAPE
+} PTVTParseState;
+
+typedef struct {
+        PTSink sink;
+        unsigned short rows;
+        unsigned short cols;
+        PTCell *cells;
+        unsigned short cursor_row; // 0 based
+        unsigned short cursor_col;
+        unsigned short scroll_top; // 0 based, inclusive
+        unsigned short scroll_bottom;
+        unsigned char attrs;
+
+        PTVTParseState state;
+        char seq[256]; // parameters of the sequence being parsed
+        size_t seq_len;
+        unsigned long utf8_codepoint;
+        int utf8_remaining;
+
+        PTVTCounters frame; // since the last flush
+        PTVTCounters last_frame;
+        PTVTCounters total;
+} PTVT;
+
+int pt_vt_init(PTVT *vt, unsigned short rows, unsigned short cols);
+void pt_vt_free(PTVT *vt);
+
+/** Changes the screen size, clearing the screen */
+int pt_vt_resize(PTVT *vt, unsigned short rows, unsigned short cols);
+
+void pt_vt_feed(PTVT *vt, const char *data, size_t len);
+
+/** Ends the current frame, like a flush of the terminal output would */
+void pt_vt_end_frame(PTVT *vt);
+
+const PTCell *pt_vt_cell(const PTVT *vt, unsigned short row,
+                         unsigned short col);
+
+/** True if both screens show the same cells */
+bool pt_vt_same_screen(const PTVT *a, const PTVT *b);
+
+/** Hash of the cells on screen, equal for equivalent screens */
+unsigned long long pt_vt_screen_hash(const PTVT *vt);
+
+/**
+ * Writes the text of `row` as UTF-8 to `out`, with empty cells as spaces
+ * and trailing ones dropped. Returns the length written.
+ */
+size_t pt_vt_row_text(const PTVT *vt, unsigned short row, char *out,
+                      size_t cap);
+
+#endif